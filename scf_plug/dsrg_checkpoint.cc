@@ -0,0 +1,265 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/libmints/matrix.h"
+#include "psi4/libpsi4util/exception.h"
+#include "dsrg_checkpoint.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <fstream>
+
+namespace psi{ namespace scf_plug {
+
+namespace {
+
+const char checkpoint_magic[8] = "SCFPCHK";
+const uint32_t checkpoint_byte_order = 0x01020304;
+
+uint64_t align_up(uint64_t offset)
+{
+    return (offset + DSRG_Checkpoint::alignment - 1) / DSRG_Checkpoint::alignment * DSRG_Checkpoint::alignment;
+}
+
+}
+
+DSRG_Checkpoint::DSRG_Checkpoint(uint64_t fingerprint, int nmo, int doccpi, int frozen_c, int frozen_v, double s)
+{
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, checkpoint_magic, sizeof(header_.magic));
+    header_.version = version;
+    header_.byte_order = checkpoint_byte_order;
+    header_.fingerprint = fingerprint;
+    header_.nmo = nmo;
+    header_.doccpi = doccpi;
+    header_.frozen_c = frozen_c;
+    header_.frozen_v = frozen_v;
+    header_.s = s;
+}
+
+DSRG_Checkpoint::DSRG_Checkpoint(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        if(fd >= 0) close(fd);
+        throw PSIEXCEPTION("Could not open the checkpoint " + path + ": " + strerror(errno));
+    }
+    map_size_ = st.st_size;
+    map_ = map_size_ >= sizeof(Checkpoint_Header) ? mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map_ == MAP_FAILED)
+    {
+        map_ = nullptr;
+        throw PSIEXCEPTION("Could not map the checkpoint " + path + ".");
+    }
+
+    memcpy(&header_, map_, sizeof(header_));
+    bool valid = memcmp(header_.magic, checkpoint_magic, sizeof(header_.magic)) == 0 && header_.version == version
+                 && header_.byte_order == checkpoint_byte_order && header_.nsection >= 0 && header_.nsection <= Checkpoint_Header::max_sections;
+    for(int k = 0; valid && k < header_.nsection; ++k)
+    {
+        const Checkpoint_Section& section = header_.section[k];
+        valid = section.offset + section.rows * section.cols * sizeof(double) <= map_size_;
+    }
+    if(!valid)
+    {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        throw PSIEXCEPTION("The file " + path + " is not a scf_plug checkpoint of version " + std::to_string(version) + ".");
+    }
+}
+
+DSRG_Checkpoint::~DSRG_Checkpoint()
+{
+    if(map_) munmap(map_, map_size_);
+}
+
+void DSRG_Checkpoint::add(const std::string& name, size_t rows, size_t cols, Row_Source rows_of)
+{
+    if(header_.nsection == Checkpoint_Header::max_sections || name.size() >= sizeof(header_.section[0].name))
+    {
+        throw PSIEXCEPTION("Checkpoint section " + name + " does not fit the header.");
+    }
+    Checkpoint_Section& section = header_.section[header_.nsection++];
+    strncpy(section.name, name.c_str(), sizeof(section.name) - 1);
+    section.rows = rows;
+    section.cols = cols;
+    sources_.push_back(rows_of);
+}
+
+void DSRG_Checkpoint::add(const std::string& name, SharedMatrix M)
+{
+    double** Mp = M->pointer();
+    add(name, M->rowdim(), M->coldim(), [Mp](size_t r, double*) -> const double* { return Mp[r]; });
+}
+
+void DSRG_Checkpoint::write(const std::string& path)
+{
+    uint64_t offset = alignment;
+    for(int k = 0; k < header_.nsection; ++k)
+    {
+        header_.section[k].offset = offset;
+        offset = align_up(offset + header_.section[k].rows * header_.section[k].cols * sizeof(double));
+    }
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        std::vector<char> head(alignment, 0);
+        memcpy(head.data(), &header_, sizeof(header_));
+        out.write(head.data(), head.size());
+        for(int k = 0; k < header_.nsection; ++k)
+        {
+            const Checkpoint_Section& section = header_.section[k];
+            std::vector<double> buf(section.cols);
+            out.seekp(section.offset);
+            for(size_t r = 0; r < section.rows; ++r)
+            {
+                out.write((const char*)sources_[k](r, buf.data()), section.cols * sizeof(double));
+            }
+        }
+        // pad the last section to its boundary, so every section maps whole pages
+        if(offset > (uint64_t)out.tellp())
+        {
+            out.seekp(offset - 1);
+            out.put(0);
+        }
+        if(!out)
+        {
+            throw PSIEXCEPTION("Could not write the checkpoint " + tmp_path + ".");
+        }
+    }
+    if(rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        throw PSIEXCEPTION("Could not rename the checkpoint to " + path + ": " + strerror(errno));
+    }
+    sources_.clear();
+    path_ = path;
+}
+
+void DSRG_Checkpoint::update_z(SharedMatrix Z, int iter, bool converged)
+{
+    const Checkpoint_Section* section = find("Z");
+    if(path_.empty() || !section || section->rows != (uint64_t)Z->rowdim() || section->cols != (uint64_t)Z->coldim())
+    {
+        throw PSIEXCEPTION("update_z needs a written checkpoint with a Z section of the same shape.");
+    }
+
+    std::fstream out(path_, std::ios::binary | std::ios::in | std::ios::out);
+    out.seekp(section->offset);
+    out.write((const char*)Z->pointer()[0], section->rows * section->cols * sizeof(double));
+    out.flush();
+
+    // the count goes in after the data it describes
+    header_.z_iter = iter;
+    header_.z_converged = converged;
+    out.seekp(offsetof(Checkpoint_Header, z_iter));
+    out.write((const char*)&header_.z_iter, sizeof(header_.z_iter) + sizeof(header_.z_converged));
+    if(!out)
+    {
+        throw PSIEXCEPTION("Could not update the checkpoint " + path_ + ".");
+    }
+}
+
+const Checkpoint_Section* DSRG_Checkpoint::find(const std::string& name) const
+{
+    for(int k = 0; k < header_.nsection; ++k)
+    {
+        if(name == header_.section[k].name) return &header_.section[k];
+    }
+    return nullptr;
+}
+
+SharedMatrix DSRG_Checkpoint::matrix(const std::string& name) const
+{
+    const Checkpoint_Section* section = find(name);
+    if(!map_ || !section) return SharedMatrix();
+
+    SharedMatrix M(new Matrix(name, section->rows, section->cols));
+    if(section->rows * section->cols > 0)
+    {
+        memcpy(M->pointer()[0], (const char*)map_ + section->offset, section->rows * section->cols * sizeof(double));
+    }
+    return M;
+}
+
+SharedMatrix Checkpoint_ZVector_Guess(const std::string& path, bool resume, const DSRG_Checkpoint& current, int z_dim, SharedMatrix C, SharedMatrix S_ao)
+{
+    DSRG_Checkpoint stored(path);
+    const Checkpoint_Header& old_h = stored.header();
+    const Checkpoint_Header& new_h = current.header();
+
+    SharedMatrix Z = stored.matrix("Z");
+    if(!Z || old_h.nmo != new_h.nmo || old_h.doccpi != new_h.doccpi || old_h.frozen_c != new_h.frozen_c
+       || old_h.frozen_v != new_h.frozen_v || Z->rowdim() != z_dim)
+    {
+        throw PSIEXCEPTION("RESTART: the checkpoint " + path + " has other orbital spaces or no Z-vector.");
+    }
+    if(resume)
+    {
+        if(old_h.fingerprint != new_h.fingerprint || old_h.s != new_h.s)
+        {
+            throw PSIEXCEPTION("RESTART RESUME: the checkpoint " + path + " is for another geometry, basis or s; use RESTART GUESS.");
+        }
+        return Z;
+    }
+
+    SharedMatrix C_old = stored.matrix("C");
+    if(!C_old || C_old->rowdim() != C->rowdim() || C_old->coldim() != C->coldim())
+    {
+        throw PSIEXCEPTION("RESTART GUESS: the checkpoint " + path + " has no orbitals of this basis.");
+    }
+
+    // U(p_old, q_new) = C_old^T S C, per spin for a spin-orbital Z
+    SharedMatrix U = Matrix::triplet(C_old, S_ao, C, true, false, false);
+    int nmo = U->rowdim();
+    int spin = z_dim / nmo;
+    SharedMatrix U_z(new Matrix("Orbital overlap", z_dim, z_dim));
+    for(int p = 0; p < nmo; ++p)
+    {
+        for(int q = 0; q < nmo; ++q)
+        {
+            for(int sigma = 0; sigma < spin; ++sigma)
+            {
+                U_z->set(0, spin * p + sigma, spin * q + sigma, U->get(0, p, q));
+            }
+        }
+    }
+    return Matrix::triplet(U_z, Z, U_z, true, false, false);
+}
+
+}} // End namespaces
@@ -0,0 +1,143 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef DSRG_CHECKPOINT_H
+#define DSRG_CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <psi4/libmints/typedefs.h>
+#include "psi4/libmints/matrix.h"
+
+namespace psi{ namespace scf_plug {
+
+/*
+ * Restart file of a DSRG-PT2 density run.  Layout, in native byte order:
+ *
+ *     [0, 4096)    Checkpoint_Header with the section table
+ *     sections     double arrays, row-major, each on a 4096-byte boundary
+ *
+ * so a reader can map the file and use every section in place.  The sections
+ * written by scf_plug are EPSILON (1 x nmo), C (nbf x nmo, the orbitals of Z)
+ * and Z (Z_MP2).  The amplitudes are not stored: they cost one pass over the
+ * MO integrals, which a restarted run has to transform again in any case.
+ *
+ * write() replaces the file through a temporary name, so a kill mid-write
+ * leaves the previous checkpoint intact.  update_z() then rewrites only the Z
+ * section and its iteration count in place; a Z torn by a kill there is still
+ * a valid starting guess, since any Z is.
+ */
+struct Checkpoint_Section
+{
+    char name[16];
+    uint64_t offset;    // bytes from the start of the file
+    uint64_t rows;
+    uint64_t cols;
+};
+
+struct Checkpoint_Header
+{
+    static const int max_sections = 8;
+
+    char magic[8];           // "SCFPCHK"
+    uint32_t version;
+    uint32_t byte_order;     // 0x01020304 as written
+    uint64_t fingerprint;    // Key_Fingerprint of the Geometry_Key
+    int64_t nmo;
+    int64_t doccpi;
+    int64_t frozen_c;        // FROZEN_CORE / FROZEN_VIRTUAL convention, spin orbitals
+    int64_t frozen_v;
+    double s;
+    int64_t z_iter;          // Z-vector iterations behind the stored Z, 0 for none
+    int64_t z_converged;
+    int64_t nsection;
+    Checkpoint_Section section[max_sections];
+};
+
+class DSRG_Checkpoint
+{
+public:
+    static const uint32_t version = 1;
+    static const uint64_t alignment = 4096;
+
+    // row r of a section as cols doubles, converted into buf if need be
+    typedef std::function<const double*(size_t r, double* buf)> Row_Source;
+
+    // a new checkpoint, filled by add() and written by write()
+    DSRG_Checkpoint(uint64_t fingerprint, int nmo, int doccpi, int frozen_c, int frozen_v, double s);
+
+    // an existing checkpoint, mapped read-only
+    explicit DSRG_Checkpoint(const std::string& path);
+
+    ~DSRG_Checkpoint();
+    DSRG_Checkpoint(const DSRG_Checkpoint&) = delete;
+    DSRG_Checkpoint& operator=(const DSRG_Checkpoint&) = delete;
+
+    // the sources are read by write() and must stay valid until then
+    void add(const std::string& name, size_t rows, size_t cols, Row_Source rows_of);
+    void add(const std::string& name, SharedMatrix M);
+
+    void write(const std::string& path);
+
+    // in the file of the last write(): replace Z (same shape) and its iteration count
+    void update_z(SharedMatrix Z, int iter, bool converged);
+
+    const Checkpoint_Header& header() const { return header_; }
+
+    // copy of a section, null if there is none
+    SharedMatrix matrix(const std::string& name) const;
+
+private:
+    Checkpoint_Header header_;
+    std::vector<Row_Source> sources_;
+    std::string path_;
+    void* map_ = nullptr;
+    size_t map_size_ = 0;
+
+    const Checkpoint_Section* find(const std::string& name) const;
+};
+
+/*
+ * Z-vector guess of RESTART from the checkpoint at path, for a run described by
+ * current.  RESUME requires the same geometry, basis, orbital spaces and s and
+ * takes Z as it is.  GUESS only requires the same orbital spaces and rotates Z
+ * from the stored orbitals into C, Z' = U^T Z U with U = C_old^T S C.  That
+ * only re-expresses the old Z in the current orbitals; the Z of another s or a
+ * nearby geometry is different, so it is a starting guess the solve then
+ * converges from (the identity rotation at the same geometry).  Z may be spatial
+ * (z_dim = nmo) or spin-orbital (z_dim = nso, alpha / beta interleaved).
+ */
+SharedMatrix Checkpoint_ZVector_Guess(const std::string& path, bool resume, const DSRG_Checkpoint& current, int z_dim, SharedMatrix C, SharedMatrix S_ao);
+
+}} // End namespaces
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#include "psi4/libpsi4util/process.h"
+#include "psi4/libmints/matrix.h"
+#include "psi4/libmints/vector.h"
+#include "psi4/libmints/molecule.h"
+#include "psi4/libmints/basisset.h"
+#include "psi4/libmints/multipoles.h"
+#include "psi4/physconst.h"
+#include "dsrg_properties.h"
+#include "integral_cache.h"
+#include <math.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace psi{ namespace scf_plug {
+
+Multipole_Properties::Multipole_Properties(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule, int order, const Vector3& origin)
+    : order_(order)
+{
+    // x^a y^b z^c, a + b + c = l, in the ao_multipoles order
+    for(int l = 1; l <= order_; ++l)
+    {
+        for(int ii = 0; ii <= l; ++ii)
+        {
+            for(int jj = 0; jj <= ii; ++jj)
+            {
+                int a = l - ii, b = ii - jj, c = jj;
+                rank_.push_back(l);
+                names_.push_back(std::string(a, 'X') + std::string(b, 'Y') + std::string(c, 'Z'));
+            }
+        }
+    }
+    if(names_.empty()) return;
+
+    ints_ = Cached_Multipole_Ints(basis, molecule, order_, origin);
+
+    SharedVector nuc = MultipoleInt::nuclear_contribution(molecule, order_, origin);
+    for(size_t k = 0; k < names_.size(); ++k)
+    {
+        nuclear_.push_back(nuc->get(k));
+    }
+}
+
+std::vector<double> Multipole_Properties::compute(SharedMatrix C, SharedMatrix D) const
+{
+    std::vector<double> moments(nuclear_);
+    if(moments.empty()) return moments;
+
+    // AO density C D C^T, then one trace per component
+    SharedMatrix D_ao = Matrix::triplet(C, D, C, false, false, true);
+    for(size_t k = 0; k < ints_->size(); ++k)
+    {
+        moments[k] += D_ao->vector_dot((*ints_)[k]);
+    }
+    return moments;
+}
+
+void Multipole_Properties::report(const std::string& label, const std::vector<double>& moments) const
+{
+    static const char* pole[] = {"", "DIPOLE", "QUADRUPOLE", "OCTUPOLE", "HEXADECAPOLE"};
+
+    std::streamsize precision = std::cout.precision();
+    for(size_t k = 0; k < moments.size(); ++k)
+    {
+        int l = rank_[k];
+        std::string name = l < 5 ? pole[l] : std::to_string(1 << l) + "-POLE";
+        double convert = pc_dipmom_au2debye * pow(pc_bohr2angstroms, l - 1);
+
+        std::ostringstream line;
+        line << label << " " << name << " " << names_[k] << ":";
+        std::cout << std::setw(38) << std::left << line.str() << std::right << std::setprecision(15) << moments[k] * convert
+                  << "    (" << moments[k] << " a.u.)" << std::endl;
+        Process::environment.globals[label + " " + name + " " + names_[k]] = moments[k] * convert;
+    }
+    std::cout.precision(precision);
+}
+
+}} // End namespaces
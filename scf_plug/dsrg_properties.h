@@ -0,0 +1,83 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#ifndef DSRG_PROPERTIES_H
+#define DSRG_PROPERTIES_H
+
+#include <vector>
+#include <string>
+#include <psi4/libmints/typedefs.h>
+#include "psi4/libmints/vector3.h"
+
+namespace psi{
+
+class Molecule;
+
+namespace scf_plug {
+
+/*
+ * Analytic one-electron properties of a correlated density.
+ *
+ * The Cartesian multipole moments up to order about origin are the AO
+ * multipole integrals (electron charge included) contracted with the density,
+ * plus the nuclear charges.  The integrals are built once, so any number of
+ * densities (relaxed, unrelaxed, ...) costs one contraction each.
+ *
+ * Components follow the psi4 ao_multipoles order: for l = 1 .. order the
+ * monomials x^a y^b z^c with a, then b, descending (X, Y, Z, XX, XY, XZ, YY,
+ * YZ, ZZ, XXX, ...).  Moments are in atomic units.
+ */
+class Multipole_Properties
+{
+public:
+    Multipole_Properties(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule, int order, const Vector3& origin);
+
+    // moments of the total (alpha + beta) MO density D in the orbitals C
+    std::vector<double> compute(SharedMatrix C, SharedMatrix D) const;
+
+    // print the moments and set "<label> DIPOLE X", "<label> QUADRUPOLE XX", ...
+    // in Debye * Angstrom^(l-1), the psi4 oeprop units
+    void report(const std::string& label, const std::vector<double>& moments) const;
+
+    int order() const { return order_; }
+    size_t size() const { return names_.size(); }
+
+private:
+    int order_;
+    std::shared_ptr<const std::vector<SharedMatrix>> ints_;
+    std::vector<double> nuclear_;
+    std::vector<int> rank_;           // l of each component
+    std::vector<std::string> names_;  // "X", "XY", ...
+};
+
+}} // End namespaces
+
+#endif
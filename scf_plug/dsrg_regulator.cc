@@ -0,0 +1,324 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#include "dsrg_regulator.h"
+#include <math.h>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DSRG_REGULATOR_X86
+#endif
+
+namespace psi{ namespace scf_plug {
+
+namespace {
+
+// e^x = 2^k e^r with x = k ln2 + r, |r| <= ln2/2, e^r from its degree-13 Taylor series
+const double exp_log2e  = 1.4426950408889634074;
+const double exp_ln2_hi = 6.93147180369123816490e-01;
+const double exp_ln2_lo = 1.90821492927058770002e-10;
+const double exp_min_x  = -708.0;
+const double exp_coef[14] = {1.0,
+                             1.0,
+                             1.0 / 2.0,
+                             1.0 / 6.0,
+                             1.0 / 24.0,
+                             1.0 / 120.0,
+                             1.0 / 720.0,
+                             1.0 / 5040.0,
+                             1.0 / 40320.0,
+                             1.0 / 362880.0,
+                             1.0 / 3628800.0,
+                             1.0 / 39916800.0,
+                             1.0 / 479001600.0,
+                             1.0 / 6227020800.0};
+
+// x = -s d^2 <= 0 throughout, so only underflow has to be guarded
+inline void finish_scalar(double x, size_t k, double* r1, double* e2, double* ratio)
+{
+    double ex = exp(x);
+    if(r1)    r1[k] = 1.0 - ex;
+    if(e2)    e2[k] = ex * ex;
+    if(ratio) ratio[k] = (1.0 + ex) / (1.0 - ex);
+}
+
+void regulators_scalar(const double* d, size_t begin, size_t n, double s, double* r1, double* e2, double* ratio)
+{
+    for(size_t k = begin; k < n; ++k)
+    {
+        finish_scalar(-s * d[k] * d[k], k, r1, e2, ratio);
+    }
+}
+
+#ifdef DSRG_REGULATOR_X86
+
+__attribute__((target("avx2,fma")))
+inline __m256d exp_avx2(__m256d x)
+{
+    __m256d underflow = _mm256_cmp_pd(x, _mm256_set1_pd(exp_min_x), _CMP_LT_OQ);
+    x = _mm256_max_pd(x, _mm256_set1_pd(exp_min_x));
+
+    __m256d k = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(exp_log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(exp_ln2_hi), x);
+    r = _mm256_fnmadd_pd(k, _mm256_set1_pd(exp_ln2_lo), r);
+
+    __m256d p = _mm256_set1_pd(exp_coef[13]);
+    for(int c = 12; c >= 0; --c)
+    {
+        p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(exp_coef[c]));
+    }
+
+    // 2^k through the exponent bits, k >= -1022 after the clamp
+    __m256i k64 = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k));
+    __m256i bits = _mm256_slli_epi64(_mm256_add_epi64(k64, _mm256_set1_epi64x(1023)), 52);
+    __m256d ex = _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+
+    return _mm256_andnot_pd(underflow, ex);
+}
+
+__attribute__((target("avx2,fma")))
+void regulators_avx2(const double* d, size_t n, double s, double* r1, double* e2, double* ratio)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d minus_s = _mm256_set1_pd(-s);
+    size_t k = 0;
+
+    for(; k + 4 <= n; k += 4)
+    {
+        __m256d dk = _mm256_loadu_pd(d + k);
+        __m256d ex = exp_avx2(_mm256_mul_pd(minus_s, _mm256_mul_pd(dk, dk)));
+        __m256d one_minus = _mm256_sub_pd(one, ex);
+        if(r1)    _mm256_storeu_pd(r1 + k, one_minus);
+        if(e2)    _mm256_storeu_pd(e2 + k, _mm256_mul_pd(ex, ex));
+        if(ratio) _mm256_storeu_pd(ratio + k, _mm256_div_pd(_mm256_add_pd(one, ex), one_minus));
+    }
+    regulators_scalar(d, k, n, s, r1, e2, ratio);
+}
+
+__attribute__((target("avx512f")))
+inline __m512d exp_avx512(__m512d x)
+{
+    __mmask8 underflow = _mm512_cmp_pd_mask(x, _mm512_set1_pd(exp_min_x), _CMP_LT_OQ);
+    // the all-lanes masked forms with an explicit source: GCC's unmasked ones pass
+    // _mm512_undefined_pd() through and trip -Wmaybe-uninitialized
+    const __mmask8 all = 0xFF;
+    x = _mm512_mask_max_pd(x, all, x, _mm512_set1_pd(exp_min_x));
+
+    __m512d xl = _mm512_mul_pd(x, _mm512_set1_pd(exp_log2e));
+    __m512d k = _mm512_mask_roundscale_pd(xl, all, xl, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(exp_ln2_hi), x);
+    r = _mm512_fnmadd_pd(k, _mm512_set1_pd(exp_ln2_lo), r);
+
+    __m512d p = _mm512_set1_pd(exp_coef[13]);
+    for(int c = 12; c >= 0; --c)
+    {
+        p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(exp_coef[c]));
+    }
+
+    __m512d ex = _mm512_mask_scalef_pd(p, all, p, k);
+    return _mm512_mask_mov_pd(ex, underflow, _mm512_setzero_pd());
+}
+
+__attribute__((target("avx512f")))
+void regulators_avx512(const double* d, size_t n, double s, double* r1, double* e2, double* ratio)
+{
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d minus_s = _mm512_set1_pd(-s);
+    size_t k = 0;
+
+    for(; k + 8 <= n; k += 8)
+    {
+        __m512d dk = _mm512_loadu_pd(d + k);
+        __m512d ex = exp_avx512(_mm512_mul_pd(minus_s, _mm512_mul_pd(dk, dk)));
+        __m512d one_minus = _mm512_sub_pd(one, ex);
+        if(r1)    _mm512_storeu_pd(r1 + k, one_minus);
+        if(e2)    _mm512_storeu_pd(e2 + k, _mm512_mul_pd(ex, ex));
+        if(ratio) _mm512_storeu_pd(ratio + k, _mm512_div_pd(_mm512_add_pd(one, ex), one_minus));
+    }
+    regulators_scalar(d, k, n, s, r1, e2, ratio);
+}
+
+#endif
+
+enum RegulatorISA { ISA_SCALAR = 0, ISA_AVX2 = 1, ISA_AVX512 = 2 };
+
+int detect_isa()
+{
+#ifdef DSRG_REGULATOR_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return ISA_AVX2;
+#endif
+    return ISA_SCALAR;
+}
+
+int regulator_isa()
+{
+    static const int isa = detect_isa();
+    return isa;
+}
+
+void regulators_isa(int isa, const double* d, size_t n, double s, double* r1, double* e2, double* ratio)
+{
+#ifdef DSRG_REGULATOR_X86
+    switch(isa)
+    {
+        case ISA_AVX512:
+            regulators_avx512(d, n, s, r1, e2, ratio);
+            return;
+        case ISA_AVX2:
+            regulators_avx2(d, n, s, r1, e2, ratio);
+            return;
+        default:
+            break;
+    }
+#endif
+    regulators_scalar(d, 0, n, s, r1, e2, ratio);
+}
+
+const char* isa_name(int isa)
+{
+    switch(isa)
+    {
+        case ISA_AVX512: return "AVX-512";
+        case ISA_AVX2:   return "AVX2";
+        default:         return "scalar";
+    }
+}
+
+} // anonymous namespace
+
+void DSRG_Regulators(const double* d, size_t n, double s, double* r1, double* e2, double* ratio)
+{
+    regulators_isa(regulator_isa(), d, n, s, r1, e2, ratio);
+}
+
+double DSRG_Regulator_Self_Check(std::vector<std::string>& checked)
+{
+    // s d^2 from 0 over 1e-16 ... 1e4 in log steps, a dense sweep across the
+    // underflow clamp at 708, and both signs of d; n is not a multiple of 8 so
+    // the scalar tails of the vector loops are covered as well
+    std::vector<double> d(1, 0.0);
+    for(int k = 0; k <= 400; ++k)
+    {
+        d.push_back(sqrt(pow(10.0, -16.0 + 20.0 * k / 400.0)));
+    }
+    for(int k = 0; k <= 200; ++k)
+    {
+        d.push_back(sqrt(700.0 + 16.0 * k / 200.0));
+    }
+    size_t n_half = d.size();
+    for(size_t k = 0; k < n_half; ++k)
+    {
+        d.push_back(-d[k]);
+    }
+    d.push_back(sqrt(-exp_min_x));
+    size_t n = d.size();
+
+    std::vector<double> r1_ref(n), e2_ref(n), ratio_ref(n);
+    regulators_scalar(d.data(), 0, n, 1.0, r1_ref.data(), e2_ref.data(), ratio_ref.data());
+
+    checked.clear();
+    double max_dev = 0.0;
+    for(int isa = ISA_AVX2; isa <= regulator_isa(); ++isa)
+    {
+        checked.push_back(isa_name(isa));
+        std::vector<double> r1(n), e2(n), ratio(n);
+        regulators_isa(isa, d.data(), n, 1.0, r1.data(), e2.data(), ratio.data());
+        for(size_t k = 0; k < n; ++k)
+        {
+            // r1 and e2 lie in [0, 1]; ratio carries the 1 / r1 of the denominator,
+            // so it is compared after scaling with r1 (both are inf at d = 0)
+            double dev = std::max(fabs(r1[k] - r1_ref[k]), fabs(e2[k] - e2_ref[k]));
+            if(ratio[k] != ratio_ref[k])
+            {
+                dev = std::max(dev, fabs(ratio[k] - ratio_ref[k]) * fabs(r1_ref[k]) / (2.0 - r1_ref[k]));
+            }
+            if(std::isnan(dev))
+            {
+                return dev;
+            }
+            max_dev = std::max(max_dev, dev);
+        }
+    }
+    return max_dev;
+}
+
+void DSRG_Divided_Differences(const double* x, size_t n, double h, double s, double* f)
+{
+    for(size_t k = 0; k < n; ++k)
+    {
+        double y = x[k] + h;
+        double q = s * (x[k] * x[k] + y * y);
+        double z = s * h * (x[k] + y);
+        double z2 = z * z;
+
+        // e^{-q} sinh(z) / z, the two exponentials kept together so neither overflows
+        double series = exp(-q) * (1.0 + z2 / 6.0 * (1.0 + z2 / 20.0 * (1.0 + z2 / 42.0 * (1.0 + z2 / 72.0))));
+        double e_shc = fabs(z) < 0.1 ? series : (exp(z - q) - exp(-z - q)) / (2.0 * z);
+
+        f[k] = (2.0 * s * (x[k] + y) * e_shc + expm1(-2.0 * s * x[k] * x[k]) / x[k]) / y;
+    }
+}
+
+DSRG_Regulator_Tensors::DSRG_Regulator_Tensors(const std::vector<double>& e1, const std::vector<double>& e2, int i0, int i1, int a0, int a1, double s)
+    : i0_(i0), a0_(a0), no_(i1 - i0), nv_(a1 - a0)
+{
+    size_t n = no_ * no_ * nv_ * nv_;
+    std::vector<double> d(n);
+    size_t k = 0;
+    for(int i = i0; i < i1; ++i)
+    {
+        for(int j = i0; j < i1; ++j)
+        {
+            for(int a = a0; a < a1; ++a)
+            {
+                for(int b = a0; b < a1; ++b)
+                {
+                    d[k++] = e1[i] + e2[j] - e1[a] - e2[b];
+                }
+            }
+        }
+    }
+
+    // e^{-2 (s/2) d^2} = e^{-s d^2}, straight from the exponential rather than as 1 - r1
+    ex_.resize(n);
+    DSRG_Regulators(d.data(), n, 0.5 * s, nullptr, ex_.data(), nullptr);
+}
+
+std::string DSRG_Regulator_ISA()
+{
+    return isa_name(regulator_isa());
+}
+
+}} // End namespaces
@@ -0,0 +1,116 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#ifndef DSRG_REGULATOR_H
+#define DSRG_REGULATOR_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace psi{ namespace scf_plug {
+
+/*
+ * DSRG regulator family evaluated in one pass over n packed denominators d:
+ *
+ *     r1[k]    = 1 - e^{-s d_k^2}
+ *     e2[k]    = e^{-2 s d_k^2}
+ *     ratio[k] = (1 + e^{-s d_k^2}) / (1 - e^{-s d_k^2})
+ *
+ * Any of the output pointers may be nullptr if that quantity is not needed.
+ * The exponential is evaluated with AVX-512 or AVX2 when the CPU supports it
+ * (selected at run time), otherwise with the scalar libm exp.
+ */
+void DSRG_Regulators(const double* d, size_t n, double s, double* r1, double* e2, double* ratio);
+
+// name of the instruction set used by DSRG_Regulators ("AVX-512", "AVX2" or "scalar")
+std::string DSRG_Regulator_ISA();
+
+/*
+ * Runs every vectorised DSRG_Regulators kernel the CPU supports against the
+ * scalar path for s d^2 from 0 to 1e4, through the underflow clamp at 708.
+ * checked receives the kernels that were run (empty on a scalar-only CPU).
+ * Returns the largest deviation: absolute for r1 and e2, relative to
+ * (1 + e^{-s d^2}) / r1 for ratio.  NaN in any kernel is returned as NaN.
+ */
+double DSRG_Regulator_Self_Check(std::vector<std::string>& checked);
+
+/*
+ * Divided differences f[x_k, x_k + h] of the relaxed-density kernel
+ * f(x) = (1 - e^{-2 s x^2}) / x for one gap h.  With y = x + h,
+ *
+ *     f[x, y] = (2 s (x + y) e^{-s (x^2 + y^2)} shc(s h (x + y)) - (1 - e^{-2 s x^2}) / x) / y
+ *
+ * where shc(z) = sinh(z) / z is summed as a series for |z| < 0.1.  There is no
+ * cancellation as h -> 0, and h = 0 gives f'(x) = 4 s e^{-2 s x^2} - (1 - e^{-2 s x^2}) / x^2.
+ * The loop body is straight-line (the series / sinh choice is a select).
+ */
+void DSRG_Divided_Differences(const double* x, size_t n, double h, double s, double* f);
+
+/*
+ * The regulator family memoised over the active OOVV block, evaluated once so
+ * the density and response kernels never call exp themselves.  The
+ * denominator is d = e1[i] + e2[j] - e1[a] - e2[b] (e1 = e2 for same spin),
+ * i, j in [i0, i1) and a, b in [a0, a1), packed pair-major:
+ *
+ *     k = ((i - i0) * no + (j - i0)) * nv * nv + (a - a0) * nv + (b - a0)
+ *
+ * Only e^{-s d^2} is stored; r1, exp2, ratio and plus() = 1 + e^{-s d^2} (the
+ * weight of the amplitude response terms) follow from it in one or two flops.
+ */
+class DSRG_Regulator_Tensors
+{
+public:
+    DSRG_Regulator_Tensors(const std::vector<double>& e1, const std::vector<double>& e2, int i0, int i1, int a0, int a1, double s);
+
+    size_t index(int i, int j, int a, int b) const
+    {
+        return ((size_t)(i - i0_) * no_ + (j - i0_)) * nv_ * nv_ + (size_t)(a - a0_) * nv_ + (b - a0_);
+    }
+
+    double exp1(int i, int j, int a, int b) const { return ex_[index(i, j, a, b)]; }
+    double r1(int i, int j, int a, int b) const { return 1.0 - exp1(i, j, a, b); }
+    double exp2(int i, int j, int a, int b) const { double e = exp1(i, j, a, b); return e * e; }
+    double ratio(int i, int j, int a, int b) const { double e = exp1(i, j, a, b); return (1.0 + e) / (1.0 - e); }
+    double plus(int i, int j, int a, int b) const { return 1.0 + exp1(i, j, a, b); }
+
+    // contiguous nv x nv block of e^{-s d^2} for pair (i, j)
+    const double* exp1_block(int i, int j) const { return &ex_[index(i, j, a0_, a0_)]; }
+
+private:
+    int i0_, a0_;
+    size_t no_, nv_;
+    std::vector<double> ex_;
+};
+
+}} // End namespaces
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/psifiles.h"
+#include "dsrg_tpdm.h"
+#include "dsrg_regulator.h"
+#include <functional>
+#include <iostream>
+
+namespace psi{ namespace scf_plug {
+
+static inline size_t four_idx(size_t p, size_t q, size_t r, size_t s, size_t dim)
+{
+    size_t dim2 = dim * dim;
+    size_t dim3 = dim2 * dim;
+    return (p * dim3 + q * dim2 + r * dim + s);
+}
+
+// pair(i, j, T_aa, T_ab, T_bb) fills the nv x nv blocks of the unweighted amplitudes
+// t(ij, ab) over the active virtuals, or returns false for a pair that is skipped
+typedef std::function<bool(int i, int j, double* T_aa, double* T_ab, double* T_bb)> Pair_Amplitudes;
+
+static void Write_TPDM(std::shared_ptr<PSIO> psio, int nmo, int doccpi, int occ_start, int vir_end, const std::vector<double>& epsilon, double S, Pair_Amplitudes pair)
+{
+    // drop the AO TPDM of an earlier run before the back-transformation writes a new one
+    psio->open(PSIF_AO_TPDM, PSIO_OPEN_OLD);
+    psio->close(PSIF_AO_TPDM, 0);
+
+    IWL d2aa(psio.get(), PSIF_MO_AA_TPDM, 1.0e-14, 0, 0);
+    IWL d2ab(psio.get(), PSIF_MO_AB_TPDM, 1.0e-14, 0, 0);
+    IWL d2bb(psio.get(), PSIF_MO_BB_TPDM, 1.0e-14, 0, 0);
+    IWL_Block_Writer aa(d2aa), ab(d2ab), bb(d2bb);
+
+    /***********        reference determinant         ***********/
+    for(int i = 0; i < doccpi; ++i)
+    {
+        for(int j = 0; j < doccpi; ++j)
+        {
+            ab.add(i, i, j, j, 1.0);
+            if(i == j) continue;
+            aa.add(i, i, j, j, 0.5);
+            aa.add(i, j, j, i, -0.5);
+            bb.add(i, i, j, j, 0.5);
+            bb.add(i, j, j, i, -0.5);
+        }
+    }
+
+    /***********        amplitudes, OOVV and VVOO         ***********/
+    int nv = vir_end - doccpi;
+    size_t nv2 = (size_t)nv * nv;
+    std::vector<double> T_aa(nv2), T_ab(nv2), T_bb(nv2), d(nv2), r1(nv2);
+    for(int i = occ_start; i < doccpi; ++i)
+    {
+        for(int j = occ_start; j < doccpi; ++j)
+        {
+            if(!pair(i, j, T_aa.data(), T_ab.data(), T_bb.data())) continue;
+
+            // 1 + e^{-s D^2} = 2 - r1, the same denominator for every spin block
+            for(int a = 0; a < nv; ++a)
+            {
+                for(int b = 0; b < nv; ++b)
+                {
+                    d[a * nv + b] = epsilon[i] + epsilon[j] - epsilon[doccpi + a] - epsilon[doccpi + b];
+                }
+            }
+            DSRG_Regulators(d.data(), nv2, S, r1.data(), nullptr, nullptr);
+
+            for(int a = 0; a < nv; ++a)
+            {
+                int A = doccpi + a;
+                for(int b = 0; b < nv; ++b)
+                {
+                    int B = doccpi + b;
+                    size_t k = a * nv + b;
+                    double plus = 2.0 - r1[k];
+
+                    ab.add(i, A, j, B, T_ab[k] * plus);
+                    ab.add(A, i, B, j, T_ab[k] * plus);
+                    aa.add(i, A, j, B, 0.5 * T_aa[k] * plus);
+                    aa.add(A, i, B, j, 0.5 * T_aa[k] * plus);
+                    bb.add(i, A, j, B, 0.5 * T_bb[k] * plus);
+                    bb.add(A, i, B, j, 0.5 * T_bb[k] * plus);
+                }
+            }
+        }
+    }
+
+    aa.finish();
+    ab.finish();
+    bb.finish();
+    std::cout << "TPDM Elements Written:        " << aa.written() + ab.written() + bb.written() << std::endl;
+
+    d2aa.set_keep_flag(1);
+    d2ab.set_keep_flag(1);
+    d2bb.set_keep_flag(1);
+    d2aa.close();
+    d2ab.close();
+    d2bb.close();
+}
+
+void Write_DSRG_PT2_TPDM_RHF(std::shared_ptr<PSIO> psio, int nmo, int doccpi, const RHF_Tensor& amp_t_dsrg_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v, const std::vector<char>& pair_mask)
+{
+    int occ_start = frozen_c/2;
+    int vir_end = nmo - frozen_v/2;
+    int nv = vir_end - doccpi;
+    int nact = doccpi - occ_start;
+    std::vector<double> buf(amp_t_dsrg_ab.single() ? nmo * nmo : 0);
+
+    // t_aa(ij, ab) = t_ab(ij, ab) - t_ab(ij, ba); the beta blocks equal the alpha ones
+    auto pair = [&](int i, int j, double* T_aa, double* T_ab, double* T_bb) -> bool
+    {
+        if(!pair_mask.empty() && !pair_mask[(i - occ_start) * nact + (j - occ_start)]) return false;
+        const double* t = amp_t_dsrg_ab.block(four_idx(i, j, 0, 0, nmo), nmo * nmo, buf.data());
+        for(int a = 0; a < nv; ++a)
+        {
+            for(int b = 0; b < nv; ++b)
+            {
+                size_t k = a * nv + b;
+                T_ab[k] = t[(doccpi + a) * nmo + doccpi + b];
+                T_aa[k] = T_bb[k] = T_ab[k] - t[(doccpi + b) * nmo + doccpi + a];
+            }
+        }
+        return true;
+    };
+    Write_TPDM(psio, nmo, doccpi, occ_start, vir_end, epsilon, S, pair);
+}
+
+void Write_DSRG_PT2_TPDM(std::shared_ptr<PSIO> psio, int nmo, int doccpi, const std::vector<double>& amp_t_dsrg_aa, const std::vector<double>& amp_t_dsrg_bb, const std::vector<double>& amp_t_dsrg_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v)
+{
+    int occ_start = frozen_c/2;
+    int vir_end = nmo - frozen_v/2;
+    int nv = vir_end - doccpi;
+
+    auto pair = [&](int i, int j, double* T_aa, double* T_ab, double* T_bb) -> bool
+    {
+        for(int a = 0; a < nv; ++a)
+        {
+            for(int b = 0; b < nv; ++b)
+            {
+                size_t k = a * nv + b;
+                size_t ijab = four_idx(i, j, doccpi + a, doccpi + b, nmo);
+                T_aa[k] = amp_t_dsrg_aa[ijab];
+                T_ab[k] = amp_t_dsrg_ab[ijab];
+                T_bb[k] = amp_t_dsrg_bb[ijab];
+            }
+        }
+        return true;
+    };
+    Write_TPDM(psio, nmo, doccpi, occ_start, vir_end, epsilon, S, pair);
+}
+
+}} // End namespaces
@@ -0,0 +1,116 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef DSRG_TPDM_H
+#define DSRG_TPDM_H
+
+#include <vector>
+#include <math.h>
+#include <psi4/libmints/typedefs.h>
+#include "psi4/libpsio/psio.hpp"
+#include "psi4/libiwl/iwl.hpp"
+#include "dsrgpt2_rhf.h"
+
+namespace psi{ namespace scf_plug {
+
+/*
+ * Bulk writer into an IWL file.  Elements go straight into the label / value
+ * arrays of the current IWL buffer, which is written whole once it is full;
+ * elements at or below the IWL cutoff are skipped.  Unlike IWL::write_value
+ * there is no per-element print check or string argument, so long contiguous
+ * blocks stream at memory speed.  finish() writes the last, partial buffer.
+ */
+class IWL_Block_Writer
+{
+public:
+    explicit IWL_Block_Writer(IWL& iwl) : iwl_(iwl), labels_(iwl.labels()), values_(iwl.values()), cutoff_(iwl.cutoff()) {}
+
+    void add(int p, int q, int r, int s, double value)
+    {
+        if(fabs(value) <= cutoff_) return;
+        int& idx = iwl_.index();
+        Label* lab = labels_ + 4 * idx;
+        lab[0] = p;
+        lab[1] = q;
+        lab[2] = r;
+        lab[3] = s;
+        values_[idx] = value;
+        ++written_;
+        if(++idx == IWL_INTS_PER_BUF) put();
+    }
+
+    size_t written() const { return written_; }
+
+    void finish() { iwl_.flush(1); }
+
+private:
+    void put()
+    {
+        iwl_.buffer_count() = iwl_.index();
+        iwl_.last_buffer() = 0;
+        iwl_.put();
+        iwl_.index() = 0;
+    }
+
+    IWL& iwl_;
+    Label* labels_;
+    Value* values_;
+    double cutoff_;
+    size_t written_ = 0;
+};
+
+/*
+ * DSRG-PT2 two-particle density of a closed-shell reference, written as the
+ * d2aa / d2ab / d2bb IWL files (PSIF_MO_*_TPDM) read by TPDMBackTransform.
+ * Elements are Gamma(pq|rs) in chemists' order, with the 2-RDM
+ * D(pq, rs) = <p+ q+ s r> entered as D_ab(pq, rs) at (pr|qs) and the
+ * antisymmetric same-spin D(pq, rs) as 0.5 D(pq, rs) at (pr|qs), every
+ * permutation listed (the convention of the v2RDM-CASSCF plugin).
+ *
+ *     reference   D(ij, ij) = 1 for i, j occupied, D_aa(ij, ji) = -1
+ *     amplitudes  D(ij, ab) = D(ab, ij) = t(ij, ab) (1 + e^{-s D_ijab^2})
+ *
+ * over the active occupied pairs and active virtuals, with t the DSRG
+ * amplitudes (1 - e^{-s D^2}) v / D.  The weight 1 + e^{-s D^2} makes
+ * 1/4 sum D(ij, ab) <ij||ab> over both blocks the derivative of the DSRG-PT2
+ * energy with respect to the integrals at fixed denominators; the denominator
+ * (orbital) dependence is in the relaxed one-particle density.  For
+ * s -> infinity the weight goes to 1 and this is the MP2 TPDM.
+ */
+
+// closed shell, from the alpha-beta amplitudes of Build_Ints_Amps_RHF
+void Write_DSRG_PT2_TPDM_RHF(std::shared_ptr<PSIO> psio, int nmo, int doccpi, const RHF_Tensor& amp_t_dsrg_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v, const std::vector<char>& pair_mask = std::vector<char>());
+
+// general path, from the aa / bb / ab amplitudes packed with four_idx over the spatial orbitals
+void Write_DSRG_PT2_TPDM(std::shared_ptr<PSIO> psio, int nmo, int doccpi, const std::vector<double>& amp_t_dsrg_aa, const std::vector<double>& amp_t_dsrg_bb, const std::vector<double>& amp_t_dsrg_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v);
+
+}} // End namespaces
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/libmints/matrix.h"
+#include "psi4/libmints/basisset.h"
+#include "psi4/libmints/mintshelper.h"
+#include "psi4/libmints/integral.h"
+#include "psi4/libmints/twobody.h"
+#include "psi4/libqt/qt.h"
+#include "dsrgpt2_df.h"
+#include "dsrg_regulator.h"
+#include <math.h>
+#include <algorithm>
+
+namespace psi{ namespace scf_plug {
+
+// (P|mn) held per auxiliary-shell block, 32 MiB (always at least one shell)
+static const size_t df_block_doubles = 4194304;
+
+SharedMatrix Build_DF_Ints_ia(MintsHelper& mints, std::shared_ptr<BasisSet> primary, std::shared_ptr<BasisSet> auxiliary, SharedMatrix C, int nmo, int doccpi, int frozen_c, int frozen_v)
+{
+    std::shared_ptr<BasisSet> zero = BasisSet::zero_ao_basis_set();
+    int nbf = primary->nbf();
+    int naux = auxiliary->nbf();
+    int occ_start = frozen_c/2;
+    int nocc = doccpi - occ_start;
+    int nvir = nmo - frozen_v/2 - doccpi;
+    int nia = nocc * nvir;
+
+    // J^{-1/2}, with near-linear dependencies in the auxiliary basis projected out
+    SharedMatrix Jm12 = mints.ao_eri(auxiliary, zero, auxiliary, zero);
+    Jm12->power(-0.5, 1.0e-10);
+
+    // B(ia,Q) = sum_P (ia|P) [J^{-1/2}]_{PQ}, accumulated over blocks of auxiliary shells:
+    // (P|mn) -> (P|ma) -> (P|ia) -> B, so only one block of (P|mn) and of (P|ia) is held
+    // at a time instead of the full Naux x nbf^2 three-index tensor
+    SharedMatrix B_ia (new Matrix("B(ia,Q)", nia, naux));
+    std::shared_ptr<IntegralFactory> factory(new IntegralFactory(auxiliary, zero, primary, primary));
+    std::shared_ptr<TwoBodyAOInt> eri(factory->eri());
+    const double* buffer = eri->buffer();
+    double** Cp = C->pointer();
+    size_t nbf2 = (size_t)nbf * nbf;
+    size_t block_max = std::max<size_t>(1, df_block_doubles / nbf2);
+    std::vector<double> Pmn, Pma(nbf * nvir), Pia;
+
+    for(int P0 = 0; P0 < auxiliary->nshell(); )
+    {
+        // at least one shell, then as many as fit in block_max functions
+        int p0 = auxiliary->shell(P0).function_index();
+        int P1 = P0;
+        size_t np = 0;
+        while(P1 < auxiliary->nshell() && (np == 0 || np + auxiliary->shell(P1).nfunction() <= block_max))
+        {
+            np += auxiliary->shell(P1).nfunction();
+            ++P1;
+        }
+
+        Pmn.assign(np * nbf2, 0.0);
+        for(int P = P0; P < P1; ++P)
+        {
+            int nP = auxiliary->shell(P).nfunction();
+            size_t oP = auxiliary->shell(P).function_index() - p0;
+            for(int M = 0; M < primary->nshell(); ++M)
+            {
+                int nM = primary->shell(M).nfunction();
+                int oM = primary->shell(M).function_index();
+                for(int N = 0; N <= M; ++N)
+                {
+                    int nN = primary->shell(N).nfunction();
+                    int oN = primary->shell(N).function_index();
+                    eri->compute_shell(P, 0, M, N);
+                    for(int p = 0; p < nP; ++p)
+                    {
+                        double* Pp = &Pmn[(oP + p) * nbf2];
+                        for(int m = 0; m < nM; ++m)
+                        {
+                            for(int n = 0; n < nN; ++n)
+                            {
+                                double value = buffer[(p * nM + m) * nN + n];
+                                Pp[(oM + m) * nbf + oN + n] = value;
+                                Pp[(oN + n) * nbf + oM + m] = value;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        Pia.resize(np * nia);
+        for(size_t p = 0; p < np; ++p)
+        {
+            C_DGEMM('N', 'N', nbf, nvir, nbf, 1.0, &Pmn[p * nbf2], nbf, &Cp[0][doccpi], nmo, 0.0, Pma.data(), nvir);
+            C_DGEMM('T', 'N', nocc, nvir, nbf, 1.0, &Cp[0][occ_start], nmo, Pma.data(), nvir, 0.0, &Pia[p * nia], nvir);
+        }
+        if(nia > 0)
+        {
+            C_DGEMM('T', 'N', nia, naux, np, 1.0, Pia.data(), nia, Jm12->pointer()[p0], naux, 1.0, B_ia->pointer()[0], naux);
+        }
+        P0 = P1;
+    }
+    return B_ia;
+}
+
+void DF_DSRG_PT2_Energy_RHF(SharedMatrix B_ia, int nmo, int doccpi, const std::vector<double>& epsilon, const std::vector<double>& s_list, int frozen_c, int frozen_v, double& Emp2, std::vector<double>& Edsrgpt2, const std::vector<char>& pair_mask, const std::vector<char>& mp2_mask)
+{
+    int occ_start = frozen_c/2;
+    int vir_end = nmo - frozen_v/2;
+    int nact = doccpi - occ_start;
+    int nvir = vir_end - doccpi;
+    int naux = B_ia->ncol();
+    int npair = nact * nact;
+    size_t ns = s_list.size();
+
+    // per-pair partial sums, reduced in pair order so the energies do not
+    // depend on the number of threads; slot 0 is MP2, slot 1 + n is s_list[n]
+    std::vector<double> E_ij(npair * (ns + 1), 0.0);
+
+#pragma omp parallel
+    {
+        std::vector<double> K(nvir * nvir), d(nvir * nvir), w(nvir * nvir), r1(nvir * nvir);
+
+#pragma omp for schedule(dynamic)
+        for(int ij = 0; ij < npair; ++ij)
+        {
+            int i = ij / nact;
+            int j = ij % nact;
+            if(!mp2_mask.empty() && !mp2_mask[ij]) continue;
+
+            // K(a,b) = <ij|ab> = (ia|jb)
+            if(naux > 0 && nvir > 0)
+            {
+                C_DGEMM('N', 'T', nvir, nvir, naux, 1.0, B_ia->pointer()[i * nvir], naux, B_ia->pointer()[j * nvir], naux, 0.0, K.data(), nvir);
+            }
+
+            double mp2 = 0.0;
+            for(int a = 0; a < nvir; ++a)
+            {
+                for(int b = 0; b < nvir; ++b)
+                {
+                    size_t k = a * nvir + b;
+                    double v_ab = K[k];
+                    double v_aa = v_ab - K[b * nvir + a];
+                    d[k] = epsilon[occ_start + i] + epsilon[occ_start + j] - epsilon[doccpi + a] - epsilon[doccpi + b];
+
+                    // 0.25 * (aa + bb) + ab
+                    w[k] = (0.5 * v_aa * v_aa + v_ab * v_ab) / d[k];
+                    mp2 += w[k];
+                }
+            }
+            E_ij[ij * (ns + 1)] = mp2;
+            if(!pair_mask.empty() && !pair_mask[ij]) continue;
+
+            for(size_t n = 0; n < ns; ++n)
+            {
+                DSRG_Regulators(d.data(), d.size(), 2.0 * s_list[n], r1.data(), nullptr, nullptr);
+                double value = 0.0;
+                for(size_t k = 0; k < d.size(); ++k)
+                {
+                    value += w[k] * r1[k];
+                }
+                E_ij[ij * (ns + 1) + 1 + n] = value;
+            }
+        }
+    }
+
+    Emp2 = 0.0;
+    Edsrgpt2.assign(ns, 0.0);
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        Emp2 += E_ij[ij * (ns + 1)];
+        for(size_t n = 0; n < ns; ++n)
+        {
+            Edsrgpt2[n] += E_ij[ij * (ns + 1) + 1 + n];
+        }
+    }
+}
+
+}} // End namespaces
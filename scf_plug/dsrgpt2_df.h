@@ -0,0 +1,69 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef DSRGPT2_DF_H
+#define DSRGPT2_DF_H
+
+#include <vector>
+#include <psi4/libmints/typedefs.h>
+
+namespace psi{
+
+class MintsHelper;
+
+namespace scf_plug {
+
+/*
+ * Density-fitted (RI) MP2 / DSRG-PT2 correlation energy for a closed-shell
+ * reference.
+ *
+ * The only integrals needed for the energy are <ij|ab> = (ia|jb), which are
+ * approximated as sum_Q B(ia,Q) B(jb,Q) with B = (ia|P) [J^{-1/2}]_{PQ}.
+ * B holds the active occupied x active virtual block only (O(ov Naux)); it is
+ * accumulated from (P|mn) one block of auxiliary shells at a time, so neither
+ * the Naux x nbf^2 AO tensor nor the full (P|ia) is held.  <ij|ab> is
+ * assembled one (i,j) pair at a time with a DGEMM, so the N^4 MO integral
+ * tensor is never formed.
+ *
+ * frozen_c and frozen_v follow the FROZEN_CORE / FROZEN_VIRTUAL convention and
+ * are given in spin orbitals.
+ */
+
+// B(ia,Q), rows ordered (i - frozen_c/2) * nvir + (a - doccpi) over the active orbitals
+SharedMatrix Build_DF_Ints_ia(MintsHelper& mints, std::shared_ptr<BasisSet> primary, std::shared_ptr<BasisSet> auxiliary, SharedMatrix C, int nmo, int doccpi, int frozen_c, int frozen_v);
+
+// MP2 energy and the DSRG-PT2 energy for every s in s_list from B(ia,Q);
+// pairs cleared in pair_mask are skipped for DSRG-PT2 and pairs cleared in
+// mp2_mask for MP2 (see Pair_Screening_RHF), an empty mask keeps every pair
+void DF_DSRG_PT2_Energy_RHF(SharedMatrix B_ia, int nmo, int doccpi, const std::vector<double>& epsilon, const std::vector<double>& s_list, int frozen_c, int frozen_v, double& Emp2, std::vector<double>& Edsrgpt2, const std::vector<char>& pair_mask = std::vector<char>(), const std::vector<char>& mp2_mask = std::vector<char>());
+
+}} // End namespaces
+
+#endif
@@ -0,0 +1,454 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/libmints/matrix.h"
+#include "psi4/libmints/vector.h"
+#include "psi4/libmints/local.h"
+#include "psi4/libmints/mintshelper.h"
+#include "psi4/liboptions/liboptions.h"
+#include "psi4/libqt/qt.h"
+#include "psi4/libpsi4util/exception.h"
+#include "dsrgpt2_pno.h"
+#include "dsrgpt2_df.h"
+#include "dsrg_regulator.h"
+#include <math.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+namespace psi{ namespace scf_plug {
+
+// eigenvalues of B^T B below this fraction of the largest are dropped from the DF
+// factors of the pair-density estimate that selects the PNOs
+static const double pno_estimate_tol = 1.0e-6;
+
+// MP2 and DSRG-PT2 (for every s in s_list) energy of one n x n pair block K(a,b) = (ia|jb)
+// with denominators d; w and r1 are scratch of at least n * n
+static void pair_energies(const double* K, const double* d, int n, const std::vector<double>& s_list, double& e_mp2, double* e_dsrg, std::vector<double>& w, std::vector<double>& r1)
+{
+    size_t n2 = (size_t)n * n;
+
+    e_mp2 = 0.0;
+    for(int a = 0; a < n; ++a)
+    {
+        for(int b = 0; b < n; ++b)
+        {
+            size_t k = (size_t)a * n + b;
+            double v_ab = K[k];
+            double v_aa = v_ab - K[(size_t)b * n + a];
+            w[k] = (0.5 * v_aa * v_aa + v_ab * v_ab) / d[k];
+            e_mp2 += w[k];
+        }
+    }
+
+    for(size_t m = 0; m < s_list.size(); ++m)
+    {
+        DSRG_Regulators(d, n2, 2.0 * s_list[m], r1.data(), nullptr, nullptr);
+        double value = 0.0;
+        for(size_t k = 0; k < n2; ++k)
+        {
+            value += w[k] * r1[k];
+        }
+        e_dsrg[m] = value;
+    }
+}
+
+namespace {
+
+// one pair (i <= j) in its semicanonical PNO space
+struct PNO_Pair
+{
+    int i, j, npno;
+    std::vector<double> Q;      // nvir x npno, semicanonical PNOs
+    std::vector<double> d;      // npno x npno, f_ii + f_jj - e_p - e_q
+    std::vector<double> K;      // npno x npno, (ip|jq)
+    std::vector<double> T;      // npno x npno, current amplitudes
+    // occupied couplings: pair index of (k,j) or (i,k), its overlap S = Q_ij^T Q_kl
+    // (npno x npno_kl), the Fock element and whether T_kl is stored transposed
+    std::vector<int> couple_pair;
+    std::vector<SharedMatrix> couple_S;
+    std::vector<double> couple_f;
+    std::vector<char> couple_trans;
+};
+
+} // anonymous namespace
+
+void PNO_DSRG_PT2_Energy_RHF(MintsHelper& mints, std::shared_ptr<BasisSet> primary, std::shared_ptr<BasisSet> auxiliary, SharedMatrix C, int nmo, int doccpi, const std::vector<double>& epsilon, const std::vector<double>& s_list, double pno_cutoff, int frozen_c, int frozen_v, Options& options, double& Emp2, std::vector<double>& Edsrgpt2, std::vector<double>& Etrunc)
+{
+    int occ_start = frozen_c/2;
+    int vir_end = nmo - frozen_v/2;
+    int nact = doccpi - occ_start;
+    int nvir = vir_end - doccpi;
+    int nbf = C->rowdim();
+    size_t ns = s_list.size();
+    int maxiter = options.get_int("PNO_MAXITER");
+    double convergence = options.get_double("PNO_CONVERGENCE");
+
+    // Boys-localise the active occupied orbitals; the frozen core stays canonical
+    SharedMatrix C_occ (new Matrix("Active occupied C", nbf, nact));
+    for(int mu = 0; mu < nbf; ++mu)
+    {
+        for(int i = 0; i < nact; ++i)
+        {
+            C_occ->set(0, mu, i, C->get(0, mu, occ_start + i));
+        }
+    }
+    std::shared_ptr<Localizer> localizer = Localizer::build("BOYS", primary, C_occ, options);
+    localizer->localize();
+    SharedMatrix L = localizer->L();
+    SharedMatrix U = localizer->U();
+
+    // occupied Fock matrix of the local orbitals, f_ik = sum_m U_mi U_mk e_m
+    SharedMatrix C_loc = C->clone();
+    std::vector<double> f_loc(nact * nact, 0.0);
+    for(int i = 0; i < nact; ++i)
+    {
+        for(int mu = 0; mu < nbf; ++mu)
+        {
+            C_loc->set(0, mu, occ_start + i, L->get(0, mu, i));
+        }
+        for(int k = 0; k < nact; ++k)
+        {
+            for(int m = 0; m < nact; ++m)
+            {
+                f_loc[i * nact + k] += U->get(0, m, i) * U->get(0, m, k) * epsilon[occ_start + m];
+            }
+        }
+    }
+
+    SharedMatrix B_ia = Build_DF_Ints_ia(mints, primary, auxiliary, C_loc, nmo, doccpi, frozen_c, frozen_v);
+    int naux = B_ia->ncol();
+
+    // truncated DF factors for the pair-density estimate: B V over the leading
+    // eigenvectors of B^T B, so the estimate costs nvir^2 nq per pair instead of nvir^2 naux
+    int nq = 0;
+    SharedMatrix B_est;
+    if(naux > 0 && nact * nvir > 0)
+    {
+        SharedMatrix M = Matrix::doublet(B_ia, B_ia, true, false);
+        SharedMatrix V (new Matrix("B^T B eigenvectors", naux, naux));
+        SharedVector lambda (new Vector("B^T B eigenvalues", naux));
+        M->diagonalize(V, lambda, descending);
+        while(nq < naux && lambda->get(nq) > pno_estimate_tol * lambda->get(0)) ++nq;
+
+        B_est = SharedMatrix(new Matrix("B(ia,q) estimate", nact * nvir, std::max(nq, 1)));
+        C_DGEMM('N', 'N', nact * nvir, nq, naux, 1.0, B_ia->pointer()[0], naux, V->pointer()[0], naux, 0.0, B_est->pointer()[0], B_est->coldim());
+    }
+
+    // unique pairs i <= j, the i < j ones are counted twice
+    std::vector<PNO_Pair> pairs;
+    std::vector<int> pair_index(nact * nact, -1);
+    for(int i = 0; i < nact; ++i)
+    {
+        for(int j = i; j < nact; ++j)
+        {
+            pair_index[i * nact + j] = pair_index[j * nact + i] = pairs.size();
+            pairs.push_back(PNO_Pair());
+            pairs.back().i = i;
+            pairs.back().j = j;
+            pairs.back().npno = 0;
+        }
+    }
+    int npair = pairs.size();
+
+    // per pair and s: the estimate's energy in the full virtual space minus that in the PNO space
+    std::vector<double> E_trunc(npair * ns, 0.0);
+
+    // PNOs of every pair from the semicanonical estimate, and (ip|jq) from B projected onto them
+#pragma omp parallel
+    {
+        size_t nv2 = (size_t)nvir * nvir;
+        std::vector<double> K(nv2), d(nv2), T(nv2), Tt(nv2), w(nv2), r1(nv2);
+        std::vector<double> e_full(ns), e_pno(ns);
+
+#pragma omp for schedule(dynamic)
+        for(int ij = 0; ij < npair; ++ij)
+        {
+            PNO_Pair& pair = pairs[ij];
+            int i = pair.i;
+            int j = pair.j;
+            double fac = (i == j) ? 1.0 : 2.0;
+
+            if(nvir == 0 || nq == 0) continue;
+
+            // estimated K(a,b) = (ia|jb) and the semicanonical denominators
+            C_DGEMM('N', 'T', nvir, nvir, nq, 1.0, B_est->pointer()[i * nvir], B_est->coldim(), B_est->pointer()[j * nvir], B_est->coldim(), 0.0, K.data(), nvir);
+            for(int a = 0; a < nvir; ++a)
+            {
+                for(int b = 0; b < nvir; ++b)
+                {
+                    d[(size_t)a * nvir + b] = f_loc[i * nact + i] + f_loc[j * nact + j] - epsilon[doccpi + a] - epsilon[doccpi + b];
+                }
+            }
+
+            // DSRG amplitudes at s_list[0] and the pair density
+            DSRG_Regulators(d.data(), nv2, s_list[0], r1.data(), nullptr, nullptr);
+            for(size_t k = 0; k < nv2; ++k)
+            {
+                T[k] = K[k] * r1[k] / d[k];
+            }
+            for(int a = 0; a < nvir; ++a)
+            {
+                for(int b = 0; b < nvir; ++b)
+                {
+                    Tt[(size_t)a * nvir + b] = 2.0 * T[(size_t)a * nvir + b] - T[(size_t)b * nvir + a];
+                }
+            }
+
+            SharedMatrix D (new Matrix("Pair density", nvir, nvir));
+            C_DGEMM('T', 'N', nvir, nvir, nvir, fac / 2.0, Tt.data(), nvir, T.data(), nvir, 0.0, D->pointer()[0], nvir);
+            C_DGEMM('N', 'T', nvir, nvir, nvir, fac / 2.0, Tt.data(), nvir, T.data(), nvir, 1.0, D->pointer()[0], nvir);
+
+            SharedMatrix X (new Matrix("PNO", nvir, nvir));
+            SharedVector occ (new Vector("PNO occupation", nvir));
+            D->diagonalize(X, occ, descending);
+
+            int npno = nvir;
+            if(pno_cutoff > 0.0)
+            {
+                npno = 0;
+                while(npno < nvir && occ->get(npno) > pno_cutoff) ++npno;
+            }
+            pair.npno = npno;
+
+            double mp2_est;
+            pair_energies(K.data(), d.data(), nvir, s_list, mp2_est, e_full.data(), w, r1);
+            std::fill(e_pno.begin(), e_pno.end(), 0.0);
+
+            if(npno > 0)
+            {
+                // semicanonicalise the PNOs: diagonalise Q^T diag(e_v) Q
+                SharedMatrix Q (new Matrix("Q", nvir, npno));
+                SharedMatrix F_pno (new Matrix("F PNO", npno, npno));
+                for(int a = 0; a < nvir; ++a)
+                {
+                    for(int p = 0; p < npno; ++p)
+                    {
+                        Q->set(0, a, p, X->get(0, a, p));
+                    }
+                }
+                for(int p = 0; p < npno; ++p)
+                {
+                    for(int q = 0; q < npno; ++q)
+                    {
+                        double value = 0.0;
+                        for(int a = 0; a < nvir; ++a)
+                        {
+                            value += Q->get(0, a, p) * epsilon[doccpi + a] * Q->get(0, a, q);
+                        }
+                        F_pno->set(0, p, q, value);
+                    }
+                }
+                SharedMatrix W (new Matrix("W", npno, npno));
+                SharedVector e_pno_orb (new Vector("PNO energies", npno));
+                F_pno->diagonalize(W, e_pno_orb, ascending);
+                SharedMatrix Q_sc = Matrix::doublet(Q, W, false, false);
+                pair.Q.assign(Q_sc->pointer()[0], Q_sc->pointer()[0] + (size_t)nvir * npno);
+
+                size_t np2 = (size_t)npno * npno;
+                pair.d.resize(np2);
+                for(int p = 0; p < npno; ++p)
+                {
+                    for(int q = 0; q < npno; ++q)
+                    {
+                        pair.d[(size_t)p * npno + q] = f_loc[i * nact + i] + f_loc[j * nact + j] - e_pno_orb->get(p) - e_pno_orb->get(q);
+                    }
+                }
+
+                // B(ip,Q) = sum_a Q(a,p) B(ia,Q) for i and j, then (ip|jq) in the PNO space only
+                std::vector<double> Bi((size_t)npno * naux), Bj((size_t)npno * naux);
+                C_DGEMM('T', 'N', npno, naux, nvir, 1.0, pair.Q.data(), npno, B_ia->pointer()[i * nvir], naux, 0.0, Bi.data(), naux);
+                C_DGEMM('T', 'N', npno, naux, nvir, 1.0, pair.Q.data(), npno, B_ia->pointer()[j * nvir], naux, 0.0, Bj.data(), naux);
+                pair.K.resize(np2);
+                C_DGEMM('N', 'T', npno, npno, naux, 1.0, Bi.data(), naux, Bj.data(), naux, 0.0, pair.K.data(), npno);
+
+                // truncation estimate: the estimated K in the PNO space against the full space
+                std::vector<double> KQ((size_t)nvir * npno), K_est_pno(np2);
+                C_DGEMM('N', 'N', nvir, npno, nvir, 1.0, K.data(), nvir, pair.Q.data(), npno, 0.0, KQ.data(), npno);
+                C_DGEMM('T', 'N', npno, npno, nvir, 1.0, pair.Q.data(), npno, KQ.data(), npno, 0.0, K_est_pno.data(), npno);
+                double mp2_est_pno;
+                pair_energies(K_est_pno.data(), pair.d.data(), npno, s_list, mp2_est_pno, e_pno.data(), w, r1);
+            }
+
+            for(size_t m = 0; m < ns; ++m)
+            {
+                E_trunc[ij * ns + m] = fac * (e_full[m] - e_pno[m]);
+            }
+        }
+    }
+
+    // overlaps of the PNO spaces coupled by the off-diagonal local Fock elements:
+    // T_ij couples to T_kj through f_ik (k != i) and to T_ik through f_kj (k != j)
+#pragma omp parallel for schedule(dynamic)
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        PNO_Pair& pair = pairs[ij];
+        if(pair.npno == 0) continue;
+        for(int side = 0; side < 2; ++side)
+        {
+            // side 0: partner (k, j) with f_ik; side 1: partner (i, k) with f_kj
+            int fixed = side == 0 ? pair.j : pair.i;
+            int moving = side == 0 ? pair.i : pair.j;
+            for(int k = 0; k < nact; ++k)
+            {
+                double f = f_loc[moving * nact + k];
+                if(k == moving || f == 0.0) continue;
+                int kl = pair_index[side == 0 ? k * nact + fixed : fixed * nact + k];
+                const PNO_Pair& other = pairs[kl];
+                if(other.npno == 0) continue;
+
+                SharedMatrix S (new Matrix("PNO overlap", pair.npno, other.npno));
+                C_DGEMM('T', 'N', pair.npno, other.npno, nvir, 1.0, const_cast<double*>(pair.Q.data()), pair.npno, const_cast<double*>(other.Q.data()), other.npno, 0.0, S->pointer()[0], other.npno);
+                pair.couple_pair.push_back(kl);
+                pair.couple_S.push_back(S);
+                pair.couple_f.push_back(f);
+                // pairs are stored with i <= j; T_kl of the partner is T_lk^T when k > l
+                int first = side == 0 ? k : fixed;
+                int second = side == 0 ? fixed : k;
+                pair.couple_trans.push_back(first > second);
+            }
+        }
+    }
+
+    // local amplitudes with the occupied Fock coupling, solved by Jacobi iterations:
+    //     T = (K + X) (1 - e^{-s d^2}) / d,   X = -sum_k f_ik T_kj + f_kj T_ik  (k != i, j resp.)
+    // in each pair's PNO space (d semicanonical); MP2 is the s -> infinity limit.  The
+    // energy uses the renormalised V = K + (K + X) e^{-s d^2}.  Slot 0 is MP2, 1 + m is s_list[m]
+    std::vector<double> E_ij(npair * (ns + 1), 0.0);
+    int max_iter_used = 0;
+    for(size_t m = 0; m <= ns; ++m)
+    {
+        bool mp2 = m == 0;
+        double s = mp2 ? 0.0 : s_list[m - 1];
+
+        std::vector<std::vector<double>> r1_ij(npair), X_ij(npair);
+        for(int ij = 0; ij < npair; ++ij)
+        {
+            PNO_Pair& pair = pairs[ij];
+            size_t np2 = (size_t)pair.npno * pair.npno;
+            r1_ij[ij].assign(np2, 1.0);
+            if(!mp2 && np2 > 0)
+            {
+                DSRG_Regulators(pair.d.data(), np2, s, r1_ij[ij].data(), nullptr, nullptr);
+            }
+            X_ij[ij].assign(np2, 0.0);
+            pair.T.resize(np2);
+            for(size_t k = 0; k < np2; ++k)
+            {
+                pair.T[k] = pair.K[k] * r1_ij[ij][k] / pair.d[k];
+            }
+        }
+
+        int iter = 0;
+        double max_change = 0.0;
+        for(iter = 1; iter <= maxiter; ++iter)
+        {
+            std::vector<double> change(npair, 0.0);
+#pragma omp parallel for schedule(dynamic)
+            for(int ij = 0; ij < npair; ++ij)
+            {
+                const PNO_Pair& pair = pairs[ij];
+                int n = pair.npno;
+                std::vector<double>& X = X_ij[ij];
+                std::fill(X.begin(), X.end(), 0.0);
+                for(size_t c = 0; c < pair.couple_pair.size(); ++c)
+                {
+                    const PNO_Pair& other = pairs[pair.couple_pair[c]];
+                    int no = other.npno;
+                    double** S = pair.couple_S[c]->pointer();
+                    // X -= f S T_kl S^T
+                    std::vector<double> ST((size_t)n * no);
+                    C_DGEMM('N', pair.couple_trans[c] ? 'T' : 'N', n, no, no, 1.0, S[0], no, const_cast<double*>(other.T.data()), no, 0.0, ST.data(), no);
+                    C_DGEMM('N', 'T', n, n, no, -pair.couple_f[c], ST.data(), no, S[0], no, 1.0, X.data(), n);
+                }
+            }
+#pragma omp parallel for schedule(dynamic)
+            for(int ij = 0; ij < npair; ++ij)
+            {
+                PNO_Pair& pair = pairs[ij];
+                for(size_t k = 0; k < pair.T.size(); ++k)
+                {
+                    double t = (pair.K[k] + X_ij[ij][k]) * r1_ij[ij][k] / pair.d[k];
+                    change[ij] = std::max(change[ij], fabs(t - pair.T[k]));
+                    pair.T[k] = t;
+                }
+            }
+            max_change = *std::max_element(change.begin(), change.end());
+            if(max_change < convergence) break;
+        }
+        if(max_change >= convergence)
+        {
+            throw PSIEXCEPTION("The local PNO amplitude equations did not converge in PNO_MAXITER iterations.");
+        }
+        max_iter_used = std::max(max_iter_used, iter);
+
+        for(int ij = 0; ij < npair; ++ij)
+        {
+            const PNO_Pair& pair = pairs[ij];
+            int n = pair.npno;
+            double fac = (pair.i == pair.j) ? 1.0 : 2.0;
+            double value = 0.0;
+            for(int p = 0; p < n; ++p)
+            {
+                for(int q = 0; q < n; ++q)
+                {
+                    size_t k = (size_t)p * n + q;
+                    double v = pair.K[k] + (pair.K[k] + X_ij[ij][k]) * (1.0 - r1_ij[ij][k]);
+                    value += (2.0 * pair.T[k] - pair.T[(size_t)q * n + p]) * v;
+                }
+            }
+            E_ij[ij * (ns + 1) + m] = fac * value;
+        }
+    }
+
+    // reduce in pair order, independent of the number of threads
+    Emp2 = 0.0;
+    Edsrgpt2.assign(ns, 0.0);
+    Etrunc.assign(ns, 0.0);
+    size_t npno_total = 0;
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        Emp2 += E_ij[ij * (ns + 1)];
+        for(size_t m = 0; m < ns; ++m)
+        {
+            Edsrgpt2[m] += E_ij[ij * (ns + 1) + 1 + m];
+            Etrunc[m] += E_trunc[ij * ns + m];
+        }
+        npno_total += pairs[ij].npno;
+    }
+
+    std::cout << "PNO Cutoff:                   " << std::setprecision(3) << pno_cutoff << std::endl;
+    std::cout << "PNO Pairs:                    " << npair << std::endl;
+    std::cout << "Average PNOs per Pair:        " << std::setprecision(4) << (npair > 0 ? (double)npno_total / npair : 0.0) << " of " << nvir << std::endl;
+    std::cout << "PNO Estimate DF Rank:         " << nq << " of " << naux << std::endl;
+    std::cout << "PNO Amplitude Iterations:     " << max_iter_used << std::endl;
+}
+
+}} // End namespaces
@@ -0,0 +1,74 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef DSRGPT2_PNO_H
+#define DSRGPT2_PNO_H
+
+#include <vector>
+#include <psi4/libmints/typedefs.h>
+
+namespace psi{
+
+class MintsHelper;
+class Options;
+
+namespace scf_plug {
+
+/*
+ * Local pair-natural-orbital DSRG-PT2 energy for a closed-shell reference.
+ *
+ * The active occupied orbitals are Boys-localised.  The PNOs of each pair come
+ * from a cheap estimate: the semicanonical DSRG amplitudes at s_list[0]
+ *
+ *     T_ij(a,b) = (ia|jb) (1 - e^{-s d^2}) / d,   d = f_ii + f_jj - e_a - e_b
+ *
+ * with (ia|jb) from the leading eigenvectors of B^T B only (B from
+ * Build_DF_Ints_ia), give the pair density D_ij = (T~^T T + T~ T^T) / (1 + delta_ij),
+ * T~ = 2T - T^T.  Its eigenvectors with occupation above pno_cutoff are the PNOs
+ * of the pair; they are semicanonicalised and B(ia,Q) is projected onto them, so
+ * the full-accuracy pair integrals exist only in the PNO space.
+ *
+ * The amplitudes are then solved with the off-diagonal occupied Fock couplings
+ * of the local orbitals, T_ij = (K_ij + X_ij) (1 - e^{-s d^2}) / d with
+ * X_ij = -sum_k (f_ik T_kj + f_kj T_ik) projected between the PNO spaces, for MP2
+ * and every s (PNO_MAXITER, PNO_CONVERGENCE).  With pno_cutoff = 0 the MP2
+ * energy is the canonical DF-MP2 energy.  The DSRG regulator is not invariant
+ * to occupied rotations, so the DSRG-PT2 energy of the local orbitals differs
+ * from the canonical one by a small amount even then.
+ *
+ * Edsrgpt2[n] is the PNO energy for s_list[n]; Etrunc[n] is the part of the
+ * semicanonical estimate's energy lost by the truncation, reported as an error
+ * estimate and not added to Edsrgpt2.
+ */
+void PNO_DSRG_PT2_Energy_RHF(MintsHelper& mints, std::shared_ptr<BasisSet> primary, std::shared_ptr<BasisSet> auxiliary, SharedMatrix C, int nmo, int doccpi, const std::vector<double>& epsilon, const std::vector<double>& s_list, double pno_cutoff, int frozen_c, int frozen_v, Options& options, double& Emp2, std::vector<double>& Edsrgpt2, std::vector<double>& Etrunc);
+
+}} // End namespaces
+
+#endif
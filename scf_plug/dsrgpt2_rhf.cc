@@ -0,0 +1,938 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/libmints/matrix.h"
+#include "psi4/libmints/vector.h"
+#include "dsrgpt2_rhf.h"
+#include "dsrg_regulator.h"
+#include "zvector_solver.h"
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+
+namespace psi{ namespace scf_plug {
+
+static inline size_t four_idx(size_t p, size_t q, size_t r, size_t s, size_t dim)
+{
+    size_t dim2 = dim * dim;
+    size_t dim3 = dim2 * dim;
+    return (p * dim3 + q * dim2 + r * dim + s);
+}
+
+// pair (i,j) survives the screening; an empty mask keeps every pair
+static inline bool pair_kept(const std::vector<char>& pair_mask, int i, int j, int occ_start, int doccpi)
+{
+    return pair_mask.empty() || pair_mask[(i - occ_start) * (doccpi - occ_start) + (j - occ_start)];
+}
+
+// d[(a - a0) * (a1 - a0) + (b - a0)] = e_i + e_j - e_a - e_b for a, b in [a0, a1)
+static void pack_denominators(const std::vector<double>& epsilon, int i, int j, int a0, int a1, std::vector<double>& d)
+{
+    size_t k = 0;
+    for(int a = a0; a < a1; ++a)
+    {
+        for(int b = a0; b < a1; ++b)
+        {
+            d[k++] = epsilon[i] + epsilon[j] - epsilon[a] - epsilon[b];
+        }
+    }
+}
+
+void Build_Ints_Amps_RHF(SharedMatrix eri_mo, int nmo, int doccpi, const std::vector<double>& epsilon, RHF_Tensor& mo_ints_ab, RHF_Tensor& amp_t_dsrg_ab, double S)
+{
+    // <pq|rs> = (pr|qs)
+    for (size_t p = 0; p < nmo; ++p)
+    {
+        for (size_t q = 0; q < nmo; ++q)
+        {
+            for (size_t r = 0; r < nmo; ++r)
+            {
+                for (size_t s = 0; s < nmo; ++s)
+                {
+                    mo_ints_ab.set(four_idx(p, q, r, s, nmo), eri_mo->get(0, p * nmo + r, q * nmo + s));
+                }
+            }
+        }
+    }
+
+    size_t nvir = nmo - doccpi;
+    std::vector<double> d(nvir * nvir), r1(nvir * nvir);
+
+    for (size_t i = 0; i < doccpi; ++i)
+    {
+        for (size_t j = 0; j < doccpi; ++j)
+        {
+            pack_denominators(epsilon, i, j, doccpi, nmo, d);
+            DSRG_Regulators(d.data(), d.size(), S, r1.data(), nullptr, nullptr);
+
+            for (size_t a = doccpi; a < nmo; ++a)
+            {
+                for (size_t b = doccpi; b < nmo; ++b)
+                {
+                    size_t k = (a - doccpi) * nvir + (b - doccpi);
+                    // from the double integrals, so only the stored amplitude is rounded
+                    amp_t_dsrg_ab.set(four_idx(i, j, a, b, nmo), eri_mo->get(0, i * nmo + a, j * nmo + b) / d[k] * r1[k]);
+                }
+            }
+        }
+    }
+}
+
+double MP2_Energy_RHF(int nmo, int doccpi, const RHF_Tensor& mo_ints_ab, const std::vector<double>& epsilon, int frozen_c, int frozen_v, const std::vector<char>& pair_mask)
+{
+    int nact = doccpi - frozen_c/2;
+    int npair = nact * nact;
+
+    // one partial sum per (i,j) pair, added up in pair order below so the
+    // result does not depend on the number of threads
+    std::vector<double> Emp2_ij(npair, 0.0);
+
+#pragma omp parallel for schedule(dynamic)
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        int i = frozen_c/2 + ij / nact;
+        int j = frozen_c/2 + ij % nact;
+        if(!pair_kept(pair_mask, i, j, frozen_c/2, doccpi)) continue;
+        double value = 0.0;
+
+        for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+        {
+            for(int b = doccpi; b < nmo - frozen_v/2; ++b)
+            {
+                double v_ab = mo_ints_ab[four_idx(i, j, a, b, nmo)];
+                double v_aa = v_ab - mo_ints_ab[four_idx(i, j, b, a, nmo)];
+                double d = epsilon[i] + epsilon[j] - epsilon[a] - epsilon[b];
+
+                // 0.25 * (aa + bb) + ab
+                value += (0.5 * v_aa * v_aa + v_ab * v_ab) / d;
+            }
+        }
+        Emp2_ij[ij] = value;
+    }
+
+    double Emp2 = 0.0;
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        Emp2 += Emp2_ij[ij];
+    }
+    return(Emp2);
+}
+
+double DSRG_PT2_Energy_RHF(int nmo, int doccpi, const RHF_Tensor& mo_ints_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v, const std::vector<char>& pair_mask)
+{
+    return(DSRG_PT2_Energy_Sweep_RHF(nmo, doccpi, mo_ints_ab, epsilon, std::vector<double>(1, S), frozen_c, frozen_v, pair_mask)[0]);
+}
+
+std::vector<double> DSRG_PT2_Energy_Sweep_RHF(int nmo, int doccpi, const RHF_Tensor& mo_ints_ab, const std::vector<double>& epsilon, const std::vector<double>& s_list, int frozen_c, int frozen_v, const std::vector<char>& pair_mask)
+{
+    int vir_end = nmo - frozen_v/2;
+    size_t nvir = vir_end - doccpi;
+    int nact = doccpi - frozen_c/2;
+    int npair = nact * nact;
+    size_t ns = s_list.size();
+
+    // Edsrgpt2_ij[ij * ns + n]: contribution of pair ij at s_list[n], reduced in pair order
+    std::vector<double> Edsrgpt2_ij(npair * ns, 0.0);
+
+#pragma omp parallel
+    {
+        std::vector<double> d(nvir * nvir), w(nvir * nvir), r1(nvir * nvir);
+
+#pragma omp for schedule(dynamic)
+        for(int ij = 0; ij < npair; ++ij)
+        {
+            int i = frozen_c/2 + ij / nact;
+            int j = frozen_c/2 + ij % nact;
+            if(!pair_kept(pair_mask, i, j, frozen_c/2, doccpi)) continue;
+
+            // only the regulator depends on s: build (0.5 v_aa^2 + v_ab^2) / d once per pair
+            pack_denominators(epsilon, i, j, doccpi, vir_end, d);
+
+            for(int a = doccpi; a < vir_end; ++a)
+            {
+                for(int b = doccpi; b < vir_end; ++b)
+                {
+                    size_t k = (a - doccpi) * nvir + (b - doccpi);
+                    double v_ab = mo_ints_ab[four_idx(i, j, a, b, nmo)];
+                    double v_aa = v_ab - mo_ints_ab[four_idx(i, j, b, a, nmo)];
+                    w[k] = (0.5 * v_aa * v_aa + v_ab * v_ab) / d[k];
+                }
+            }
+
+            for(size_t n = 0; n < ns; ++n)
+            {
+                DSRG_Regulators(d.data(), d.size(), 2.0 * s_list[n], r1.data(), nullptr, nullptr);
+                double value = 0.0;
+                for(size_t k = 0; k < d.size(); ++k)
+                {
+                    value += w[k] * r1[k];
+                }
+                Edsrgpt2_ij[ij * ns + n] = value;
+            }
+        }
+    }
+
+    std::vector<double> Edsrgpt2(ns, 0.0);
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        for(size_t n = 0; n < ns; ++n)
+        {
+            Edsrgpt2[n] += Edsrgpt2_ij[ij * ns + n];
+        }
+    }
+    return(Edsrgpt2);
+}
+
+// Z {cd} block of the DSRG-PT2 density: adds the off-diagonal unrelaxed
+// virtual-virtual elements (twice the density) for the active virtuals to Z.
+// v_ab(i, j, a, b) and t_ab(i, j, a, b) read the OOVV integrals and amplitudes
+template <class Ints, class Amps>
+static void Unrelaxed_VV_RHF(SharedMatrix Z_MP2, int nmo, int doccpi, Ints v_ab, Amps t_ab, const std::vector<double>& epsilon, const DSRG_Regulator_Tensors& reg, double S, int frozen_c, int frozen_v, const std::vector<char>& pair_mask)
+{
+    int occ_start = frozen_c/2;
+    int vir_end = nmo - frozen_v/2;
+
+    auto v_aa = [&](int p, int q, int r, int s) -> double
+    {
+        return v_ab(p, q, r, s) - v_ab(p, q, s, r);
+    };
+    auto t_aa = [&](int i, int j, int a, int b) -> double
+    {
+        return t_ab(i, j, a, b) - t_ab(i, j, b, a);
+    };
+    auto denom = [&](int i, int j, int a, int b) -> double
+    {
+        return epsilon[i] + epsilon[j] - epsilon[a] - epsilon[b];
+    };
+
+    // Z(d, c) = -sum_{ija} v_ijac v_ijad f[d_ijac, d_ijad] with f(x) = (1 - e^{-2 s x^2}) / x.
+    // For separated c, d the numerator is M(c, d) = sum X_c Y_d with X = t d / (1 - e^{-s d^2})
+    // and Y = t (1 + e^{-s d^2}), one DGEMM per (i, j) over the a x c panels; the
+    // near pairs use the divided-difference kernel
+    size_t nvir = vir_end - doccpi;
+    Divided_Difference dd_vir(epsilon, doccpi, vir_end);
+    const std::vector<size_t>& near = dd_vir.near_pairs();
+    size_t nk = nvir * nvir;
+    std::vector<double> Xaa(nk), Xab(nk), Yaa(nk), Yab(nk);
+    std::vector<double> Vaa(near.empty() ? 0 : nk), Vab(near.empty() ? 0 : nk), D(near.empty() ? 0 : nk);
+    std::vector<double> x(near.empty() ? 0 : nvir), f(near.empty() ? 0 : nvir);
+    std::vector<double> M(nk, 0.0), N(nk, 0.0), R;
+
+    for(int i = occ_start; i < doccpi; ++i)
+    {
+        for(int j = occ_start; j < doccpi; ++j)
+        {
+            if(!pair_kept(pair_mask, i, j, occ_start, doccpi)) continue;
+            const double* ex = reg.exp1_block(i, j);
+
+            for(int a = doccpi; a < vir_end; ++a)
+            {
+                for(int c = doccpi; c < vir_end; ++c)
+                {
+                    size_t k = (a - doccpi) * nvir + (c - doccpi);
+                    double dc = denom(i, j, a, c);
+                    double q = dc / (1.0 - ex[k]);
+                    double p = 1.0 + ex[k];
+
+                    Xaa[k] = t_aa(i, j, a, c) * q;
+                    Yaa[k] = t_aa(i, j, a, c) * p;
+                    Xab[k] = t_ab(i, j, a, c) * q;
+                    Yab[k] = t_ab(i, j, a, c) * p;
+                    if(!near.empty())
+                    {
+                        Vaa[k] = v_aa(i, j, a, c);
+                        Vab[k] = v_ab(i, j, a, c);
+                        D[k] = dc;
+                    }
+                }
+            }
+
+            C_DGEMM('T', 'N', nvir, nvir, nvir, 1.0, Xaa.data(), nvir, Yaa.data(), nvir, 1.0, M.data(), nvir);
+            C_DGEMM('T', 'N', nvir, nvir, nvir, 2.0, Xab.data(), nvir, Yab.data(), nvir, 1.0, M.data(), nvir);
+
+            for(size_t cd : near)
+            {
+                size_t c = cd / nvir, d = cd % nvir;
+                for(size_t a = 0; a < nvir; ++a) x[a] = D[a * nvir + c];
+                DSRG_Divided_Differences(x.data(), nvir, -dd_vir.gap(c, d), S, f.data());
+
+                double value = 0.0;
+                for(size_t a = 0; a < nvir; ++a)
+                {
+                    value -= (Vaa[a * nvir + c] * Vaa[a * nvir + d] + 2.0 * Vab[a * nvir + c] * Vab[a * nvir + d]) * f[a];
+                }
+                N[cd] += value;
+            }
+        }
+    }
+
+    dd_vir.combine(M, N, R);
+    for(int d = doccpi; d < vir_end; ++d)
+    {
+        for(int c = doccpi; c < vir_end; ++c)
+        {
+            if(c != d) Z_MP2->add(0, d, c, R[(d - doccpi) * nvir + (c - doccpi)]);
+        }
+    }
+}
+
+void DSRG_PT2_Density_RHF(SharedMatrix D_MP2, SharedMatrix Z_MP2, int nmo, int doccpi, const AO_ERI_Store& eri, SharedMatrix C, const RHF_Tensor& mo_ints_ab, const RHF_Tensor& amp_t_dsrg_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v, const std::vector<char>& pair_mask, const ZVector_Settings& zvec, bool relaxed, SharedMatrix D_unrelaxed, SharedMatrix Z_guess, const ZVector_Checkpoint& checkpoint)
+{
+    int occ_start = frozen_c/2;
+    int vir_end = nmo - frozen_v/2;
+
+    // same-spin integrals and amplitudes from the alpha-beta ones
+    auto v_ab = [&](int p, int q, int r, int s) -> double
+    {
+        return mo_ints_ab[four_idx(p, q, r, s, nmo)];
+    };
+    auto v_aa = [&](int p, int q, int r, int s) -> double
+    {
+        return mo_ints_ab[four_idx(p, q, r, s, nmo)] - mo_ints_ab[four_idx(p, q, s, r, nmo)];
+    };
+    auto t_ab = [&](int i, int j, int a, int b) -> double
+    {
+        return amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)];
+    };
+    auto t_aa = [&](int i, int j, int a, int b) -> double
+    {
+        return amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] - amp_t_dsrg_ab[four_idx(i, j, b, a, nmo)];
+    };
+    auto denom = [&](int i, int j, int a, int b) -> double
+    {
+        return epsilon[i] + epsilon[j] - epsilon[a] - epsilon[b];
+    };
+    // screened pairs carry no amplitudes, every term built from them is dropped
+    auto kept = [&](int i, int j) -> bool
+    {
+        return pair_kept(pair_mask, i, j, occ_start, doccpi);
+    };
+
+    // every regulator factor of the OOVV block, evaluated once
+    DSRG_Regulator_Tensors reg(epsilon, epsilon, occ_start, doccpi, doccpi, vir_end, S);
+
+    Z_MP2->zero();
+    D_MP2->zero();
+
+    // spin-summed (alpha + beta) orbital intermediates
+    std::vector<double> Xi(nmo, 0.0);
+    std::vector<double> Xa(nmo, 0.0);
+    std::vector<double> Yi(nmo, 0.0);
+    std::vector<double> Ya(nmo, 0.0);
+
+    /***********        D {ii} {aa}         ***********/
+    size_t nvir = vir_end - doccpi;
+
+    for(int i = occ_start; i < doccpi; ++i)
+    {
+        for(int j = occ_start; j < doccpi; ++j)
+        {
+            if(!kept(i, j)) continue;
+            const double* ex = reg.exp1_block(i, j);
+
+            for(int a = doccpi; a < vir_end; ++a)
+            {
+                for(int b = doccpi; b < vir_end; ++b)
+                {
+                    size_t k = (a - doccpi) * nvir + (b - doccpi);
+                    double taa = t_aa(i, j, a, b), tab = t_ab(i, j, a, b);
+                    double vaa = v_aa(i, j, a, b), vab = v_ab(i, j, a, b);
+
+                    double ratio = (1.0 + ex[k]) / (1.0 - ex[k]);
+                    double exp2 = ex[k] * ex[k];
+                    double temp1 = -0.5 * taa * taa * ratio + 2.0 * S * vaa * vaa * exp2;
+                    double temp3 = 2.0 * (-0.5 * tab * tab * ratio + 2.0 * S * vab * vab * exp2);
+                    D_MP2->add(0, i, i, temp1 + temp3);
+                    D_MP2->add(0, a, a, -temp1 - temp3);
+
+                    double x = (taa * taa + 2.0 * tab * tab) * ratio;
+                    double y = (vaa * vaa + 2.0 * vab * vab) * exp2;
+                    Xi[i] += x;
+                    Xa[a] += x;
+                    Yi[i] += y;
+                    Ya[a] += y;
+                }
+            }
+        }
+    }
+
+    /***********        Z {mn} (active occupied)         ***********/
+    // Z(n, m) = sum_{jab} V(jab, m) V(jab, n) f[d_mjab, d_njab] with f(x) = (1 - e^{-2 s x^2}) / x.
+    // For separated m, n the numerator M(m, n) = sum V_m V_n f(d_n) is one DGEMM per j
+    // over the (ab) x m panels; the near pairs use the divided-difference kernel
+    {
+        size_t nocc = doccpi - occ_start;
+        Divided_Difference dd_occ(epsilon, occ_start, doccpi);
+        const std::vector<size_t>& near = dd_occ.near_pairs();
+        size_t nk = nvir * nvir;
+        std::vector<double> Vaa(nk * nocc), Vab(nk * nocc), Faa(nk * nocc), Fab(nk * nocc), D(nk * nocc);
+        std::vector<double> M(nocc * nocc, 0.0), N(nocc * nocc, 0.0), R;
+        std::vector<double> x(near.empty() ? 0 : nk), f(near.empty() ? 0 : nk);
+
+        for(int j = occ_start; j < doccpi; ++j)
+        {
+            // masked (m, j) pairs leave their column zero
+            std::fill(Vaa.begin(), Vaa.end(), 0.0);
+            std::fill(Vab.begin(), Vab.end(), 0.0);
+            std::fill(Faa.begin(), Faa.end(), 0.0);
+            std::fill(Fab.begin(), Fab.end(), 0.0);
+
+            for(int m = occ_start; m < doccpi; ++m)
+            {
+                const double* ex = reg.exp1_block(m, j);
+
+                for(int a = doccpi; a < vir_end; ++a)
+                {
+                    for(int b = doccpi; b < vir_end; ++b)
+                    {
+                        size_t k = (a - doccpi) * nvir + (b - doccpi);
+                        size_t K = k * nocc + (m - occ_start);
+                        D[K] = denom(m, j, a, b);
+                        if(!kept(m, j)) continue;
+
+                        double fm = (1.0 - ex[k] * ex[k]) / D[K];
+                        Vaa[K] = v_aa(m, j, a, b);
+                        Vab[K] = v_ab(m, j, a, b);
+                        Faa[K] = Vaa[K] * fm;
+                        Fab[K] = Vab[K] * fm;
+                    }
+                }
+            }
+
+            C_DGEMM('T', 'N', nocc, nocc, nk, 1.0, Vaa.data(), nocc, Faa.data(), nocc, 1.0, M.data(), nocc);
+            C_DGEMM('T', 'N', nocc, nocc, nk, 2.0, Vab.data(), nocc, Fab.data(), nocc, 1.0, M.data(), nocc);
+
+            for(size_t mn : near)
+            {
+                size_t m = mn / nocc, n = mn % nocc;
+                for(size_t K = 0; K < nk; ++K) x[K] = D[K * nocc + m];
+                DSRG_Divided_Differences(x.data(), nk, dd_occ.gap(m, n), S, f.data());
+
+                double value = 0.0;
+                for(size_t K = 0; K < nk; ++K)
+                {
+                    value += (Vaa[K * nocc + m] * Vaa[K * nocc + n] + 2.0 * Vab[K * nocc + m] * Vab[K * nocc + n]) * f[K];
+                }
+                N[mn] += value;
+            }
+        }
+
+        dd_occ.combine(M, N, R);
+        for(int n = occ_start; n < doccpi; ++n)
+        {
+            for(int m = occ_start; m < doccpi; ++m)
+            {
+                if(m != n) Z_MP2->add(0, n, m, R[(n - occ_start) * nocc + (m - occ_start)]);
+            }
+        }
+    }
+
+    /***********        Z {cd} (active virtual)         ***********/
+    Unrelaxed_VV_RHF(Z_MP2, nmo, doccpi,
+                     [&](int p, int q, int r, int s) { return mo_ints_ab[four_idx(p, q, r, s, nmo)]; },
+                     [&](int i, int j, int a, int b) { return amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)]; },
+                     epsilon, reg, S, frozen_c, frozen_v, pair_mask);
+
+    /***********        Z {nN} (active-frozen occupied)         ***********/
+    for(int n = occ_start; n < doccpi; ++n)
+    {
+        for(int N = 0; N < occ_start; ++N)
+        {
+            double value = 0.0;
+
+            for(int a = doccpi; a < vir_end; ++a)
+            {
+                for(int b = doccpi; b < vir_end; ++b)
+                {
+                    for(int j = occ_start; j < doccpi; ++j)
+                    {
+                        if(!kept(n, j)) continue;
+                        double plus = reg.plus(n, j, a, b);
+                        value += (v_aa(N, j, a, b) * t_aa(n, j, a, b) + 2.0 * v_ab(N, j, a, b) * t_ab(n, j, a, b)) * plus;
+                    }
+                }
+            }
+            Z_MP2->add(0, n, N, value / (epsilon[n] - epsilon[N]));
+            Z_MP2->set(0, N, n, Z_MP2->get(0, n, N));
+        }
+    }
+
+    /***********        Z {dD} (active-frozen virtual)         ***********/
+    for(int d = doccpi; d < vir_end; ++d)
+    {
+        for(int D = vir_end; D < nmo; ++D)
+        {
+            double value = 0.0;
+
+            for(int a = doccpi; a < vir_end; ++a)
+            {
+                for(int i = occ_start; i < doccpi; ++i)
+                {
+                    for(int j = occ_start; j < doccpi; ++j)
+                    {
+                        if(!kept(i, j)) continue;
+                        double plus = reg.plus(i, j, a, d);
+                        value += (v_aa(i, j, a, D) * t_aa(i, j, a, d) + 2.0 * v_ab(i, j, a, D) * t_ab(i, j, a, d)) * plus;
+                    }
+                }
+            }
+            Z_MP2->add(0, d, D, value / (epsilon[d] - epsilon[D]));
+            Z_MP2->set(0, D, d, Z_MP2->get(0, d, D));
+        }
+    }
+
+    // unrelaxed density: the diagonal and the off-diagonal oo / vv blocks built so far
+    if(D_unrelaxed)
+    {
+        D_unrelaxed->copy(D_MP2);
+        for(int p = 0; p < nmo; ++p)
+        {
+            for(int q = 0; q < nmo; ++q)
+            {
+                if(p != q && (p < doccpi) == (q < doccpi))
+                {
+                    D_unrelaxed->set(0, p, q, 0.5 * Z_MP2->get(0, p, q));
+                }
+            }
+        }
+    }
+    if(!relaxed) return;
+    if(Z_guess) Apply_ZVector_Guess(Z_MP2, Z_guess, doccpi);
+
+    // a single right-hand side: the relaxed density is independent of the
+    // perturbation, so one Z serves every dipole component
+    std::vector<SharedMatrix> Z_block(1, Z_MP2);
+
+    // sum over both spins of <pX||qY> + <pX|qY> = 2 <pX|qY> - <pX|Yq>, contracted with
+    // the off-diagonal Z: a generalised Fock build 2 J - K through the AO integrals
+    auto orbital_hessian = [&](const std::vector<size_t>& active, std::vector<SharedMatrix>& F_hess)
+    {
+        std::vector<SharedMatrix> Z_off, J, K;
+        for(size_t k : active)
+        {
+            Z_off.push_back(Z_block[k]->clone());
+            for(int p = 0; p < nmo; ++p)
+            {
+                Z_off.back()->set(0, p, p, 0.0);
+            }
+        }
+        Hessian_JK(eri, C, Z_off, J, K);
+        for(size_t r = 0; r < active.size(); ++r)
+        {
+            F_hess[active[r]]->copy(K[r]);
+            F_hess[active[r]]->scale(-1.0);
+            F_hess[active[r]]->axpy(2.0, J[r]);
+        }
+    };
+
+    // Xi / Xa / Yi / Ya contributions for the rotation (X, Y)
+    auto xy_terms = [&](int X, int Y) -> double
+    {
+        double value = 0.0;
+        for(int i = occ_start; i < doccpi; ++i)
+        {
+            double v = v_aa(i, X, i, Y) + v_ab(i, X, i, Y);
+            value += v * (-Xi[i] + 4.0 * S * Yi[i]);
+        }
+        for(int a = doccpi; a < vir_end; ++a)
+        {
+            double v = v_aa(a, X, a, Y) + v_ab(a, X, a, Y);
+            value += v * (Xa[a] - 4.0 * S * Ya[a]);
+        }
+        return value;
+    };
+
+    // sum_{jab} <Xj||ab> t_njab (1 + e^{-s D^2}), both spin cases
+    auto occ_amp_term = [&](int X, int n) -> double
+    {
+        double value = 0.0;
+        for(int j = occ_start; j < doccpi; ++j)
+        {
+            if(!kept(n, j)) continue;
+            for(int a = doccpi; a < vir_end; ++a)
+            {
+                for(int b = doccpi; b < vir_end; ++b)
+                {
+                    double plus = reg.plus(n, j, a, b);
+                    value += (v_aa(X, j, a, b) * t_aa(n, j, a, b) + 2.0 * v_ab(X, j, a, b) * t_ab(n, j, a, b)) * plus;
+                }
+            }
+        }
+        return value;
+    };
+
+    // sum_{ija} <ij||aX> t_ijac (1 + e^{-s D^2}), both spin cases
+    auto vir_amp_term = [&](int X, int c) -> double
+    {
+        double value = 0.0;
+        for(int i = occ_start; i < doccpi; ++i)
+        {
+            for(int j = occ_start; j < doccpi; ++j)
+            {
+                if(!kept(i, j)) continue;
+                for(int a = doccpi; a < vir_end; ++a)
+                {
+                    double plus = reg.plus(i, j, a, c);
+                    value += (v_aa(i, j, a, X) * t_aa(i, j, a, c) + 2.0 * v_ab(i, j, a, X) * t_ab(i, j, a, c)) * plus;
+                }
+            }
+        }
+        return value;
+    };
+
+    // Z-independent part of the occupied-virtual equations, built once
+    SharedMatrix Z_rhs = Z_MP2->clone();
+    Z_rhs->zero();
+    for(int c = doccpi; c < vir_end; ++c)
+    {
+        for(int n = occ_start; n < doccpi; ++n)
+        {
+            Z_rhs->set(0, n, c, occ_amp_term(c, n) - vir_amp_term(n, c) + xy_terms(c, n));
+        }
+    }
+    for(int I = 0; I < occ_start; ++I)
+    {
+        for(int A = vir_end; A < nmo; ++A)
+        {
+            Z_rhs->set(0, I, A, xy_terms(I, A));
+        }
+    }
+    for(int c = doccpi; c < vir_end; ++c)
+    {
+        for(int N = 0; N < occ_start; ++N)
+        {
+            Z_rhs->set(0, N, c, xy_terms(N, c) - vir_amp_term(N, c));
+        }
+    }
+    for(int C = vir_end; C < nmo; ++C)
+    {
+        for(int n = occ_start; n < doccpi; ++n)
+        {
+            Z_rhs->set(0, n, C, xy_terms(n, C) + occ_amp_term(C, n));
+        }
+    }
+
+    std::vector<SharedMatrix> rhs(1, Z_rhs);
+
+    // one Jacobi step of the occupied-virtual equations; each pass only applies
+    // the orbital Hessian to the current Z
+    auto sweep = [&](size_t k, SharedMatrix F_hess, SharedMatrix Z_new)
+    {
+        /***********        Z {nc} {cn}         ***********/
+        for(int c = doccpi; c < vir_end; ++c)
+        {
+            for(int n = occ_start; n < doccpi; ++n)
+            {
+                double value = rhs[k]->get(0, n, c) + F_hess->get(0, n, c);
+
+                Z_new->set(0, n, c, value / (epsilon[n] - epsilon[c]));
+                Z_new->set(0, c, n, Z_new->get(0, n, c));
+            }
+        }
+
+        /***********        Z {IA} {AI}         ***********/
+        for(int I = 0; I < occ_start; ++I)
+        {
+            for(int A = vir_end; A < nmo; ++A)
+            {
+                double value = rhs[k]->get(0, I, A) + F_hess->get(0, I, A);
+
+                Z_new->set(0, I, A, value / (epsilon[I] - epsilon[A]));
+                Z_new->set(0, A, I, Z_new->get(0, I, A));
+            }
+        }
+
+        /***********        Z {cN} {Nc}         ***********/
+        for(int c = doccpi; c < vir_end; ++c)
+        {
+            for(int N = 0; N < occ_start; ++N)
+            {
+                double value = rhs[k]->get(0, N, c) + F_hess->get(0, N, c);
+
+                Z_new->set(0, N, c, value / (epsilon[N] - epsilon[c]));
+                Z_new->set(0, c, N, Z_new->get(0, N, c));
+            }
+        }
+
+        /***********        Z {Cn} {nC}         ***********/
+        for(int C = vir_end; C < nmo; ++C)
+        {
+            for(int n = occ_start; n < doccpi; ++n)
+            {
+                double value = rhs[k]->get(0, n, C) + F_hess->get(0, n, C);
+
+                Z_new->set(0, n, C, value / (epsilon[n] - epsilon[C]));
+                Z_new->set(0, C, n, Z_new->get(0, n, C));
+            }
+        }
+    };
+
+    double max_change = 0.0;
+    int iter = Solve_ZVector_Block(Z_block, orbital_hessian, sweep, zvec, max_change, checkpoint);
+    Print_ZVector_Convergence(iter, max_change, zvec);
+
+    for(int p = 0; p < nmo; ++p)
+    {
+        for(int q = 0; q < nmo; ++q)
+        {
+            if(p != q)
+            {
+                D_MP2->set(0, p, q, 0.5 * Z_MP2->get(0, p, q));
+            }
+        }
+    }
+}
+
+double DSRG_PT2_Density_VV_RHF(SharedMatrix D_vv, int nmo, int doccpi, const std::vector<double>& ovov, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v)
+{
+    int occ_start = frozen_c/2;
+    int vir_end = nmo - frozen_v/2;
+    size_t nocc = doccpi - occ_start;
+    size_t nvir = vir_end - doccpi;
+    DSRG_Regulator_Tensors reg(epsilon, epsilon, occ_start, doccpi, doccpi, vir_end, S);
+
+    // <ij|ab> = (ia|jb) from the packed OVOV block, and the DSRG amplitudes on the fly
+    auto v_ab = [&](int i, int j, int a, int b) -> double
+    {
+        return ovov[(((i - occ_start) * nvir + (a - doccpi)) * nocc + (j - occ_start)) * nvir + (b - doccpi)];
+    };
+    auto t_ab = [&](int i, int j, int a, int b) -> double
+    {
+        return v_ab(i, j, a, b) * reg.r1(i, j, a, b) / (epsilon[i] + epsilon[j] - epsilon[a] - epsilon[b]);
+    };
+
+    D_vv->zero();
+    double Emp2 = 0.0;
+
+    // diagonal, as in D {ii} {aa} of DSRG_PT2_Density_RHF
+    for(int i = occ_start; i < doccpi; ++i)
+    {
+        for(int j = occ_start; j < doccpi; ++j)
+        {
+            const double* ex = reg.exp1_block(i, j);
+
+            for(int a = doccpi; a < vir_end; ++a)
+            {
+                for(int b = doccpi; b < vir_end; ++b)
+                {
+                    size_t k = (a - doccpi) * nvir + (b - doccpi);
+                    double tab = t_ab(i, j, a, b);
+                    double taa = tab - t_ab(i, j, b, a);
+                    double vab = v_ab(i, j, a, b);
+                    double vaa = vab - v_ab(i, j, b, a);
+
+                    double ratio = (1.0 + ex[k]) / (1.0 - ex[k]);
+                    double exp2 = ex[k] * ex[k];
+                    double temp1 = -0.5 * taa * taa * ratio + 2.0 * S * vaa * vaa * exp2;
+                    double temp3 = 2.0 * (-0.5 * tab * tab * ratio + 2.0 * S * vab * vab * exp2);
+                    D_vv->add(0, a - doccpi, a - doccpi, -temp1 - temp3);
+                    Emp2 += (0.5 * vaa * vaa + vab * vab) / (epsilon[i] + epsilon[j] - epsilon[a] - epsilon[b]);
+                }
+            }
+        }
+    }
+
+    // off-diagonal, half of the Z {cd} block
+    int dims[] = {nmo};
+    SharedMatrix Z_vv (new Matrix("Z vv", 1, dims, dims, 0));
+    Unrelaxed_VV_RHF(Z_vv, nmo, doccpi, v_ab, t_ab, epsilon, reg, S, frozen_c, frozen_v, std::vector<char>());
+
+    for(int c = doccpi; c < vir_end; ++c)
+    {
+        for(int d = doccpi; d < vir_end; ++d)
+        {
+            if(c != d)
+            {
+                D_vv->set(0, c - doccpi, d - doccpi, 0.5 * Z_vv->get(0, c, d));
+            }
+        }
+    }
+    D_vv->hermitivitize();
+    return Emp2;
+}
+
+int FNO_Rotate_Virtuals_RHF(SharedMatrix D_vv, SharedMatrix C, std::vector<double>& epsilon, int doccpi, double occ_tolerance, double occ_percentage)
+{
+    int nbf = C->rowdim();
+    int nvir = D_vv->rowdim();
+
+    SharedMatrix X_sorted (new Matrix("FNO", nvir, nvir));
+    SharedVector occ_sorted (new Vector("FNO occupation", nvir));
+    D_vv->diagonalize(X_sorted, occ_sorted, descending);
+
+    // the regulator terms make the DSRG density indefinite: rank the natural
+    // orbitals by the magnitude of their occupation
+    std::vector<int> order(nvir);
+    for(int a = 0; a < nvir; ++a) order[a] = a;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return fabs(occ_sorted->get(a)) > fabs(occ_sorted->get(b)); });
+
+    SharedMatrix X (new Matrix("FNO", nvir, nvir));
+    std::vector<double> occ(nvir);
+    for(int p = 0; p < nvir; ++p)
+    {
+        occ[p] = fabs(occ_sorted->get(order[p]));
+        for(int a = 0; a < nvir; ++a)
+        {
+            X->set(0, a, p, X_sorted->get(0, a, order[p]));
+        }
+    }
+
+    // number of natural orbitals kept
+    int nfno = 0;
+    if(occ_percentage > 0.0)
+    {
+        double total = 0.0;
+        for(int a = 0; a < nvir; ++a) total += occ[a];
+
+        double kept = 0.0;
+        while(nfno < nvir && kept < 0.01 * occ_percentage * total)
+        {
+            kept += occ[nfno];
+            ++nfno;
+        }
+    }
+    else
+    {
+        while(nfno < nvir && occ[nfno] > occ_tolerance) ++nfno;
+    }
+
+    // semicanonicalise the kept and the dropped natural orbitals separately
+    SharedMatrix U (new Matrix("FNO rotation", nvir, nvir));
+    std::vector<double> epsilon_vir(nvir, 0.0);
+    int block_start[] = {0, nfno};
+    int block_size[] = {nfno, nvir - nfno};
+
+    for(int block = 0; block < 2; ++block)
+    {
+        int n0 = block_start[block];
+        int n = block_size[block];
+        if(n == 0) continue;
+
+        SharedMatrix F_no (new Matrix("F NO", n, n));
+        for(int p = 0; p < n; ++p)
+        {
+            for(int q = 0; q < n; ++q)
+            {
+                double value = 0.0;
+                for(int a = 0; a < nvir; ++a)
+                {
+                    value += X->get(0, a, n0 + p) * epsilon[doccpi + a] * X->get(0, a, n0 + q);
+                }
+                F_no->set(0, p, q, value);
+            }
+        }
+        SharedMatrix W (new Matrix("W", n, n));
+        SharedVector e_no (new Vector("e NO", n));
+        F_no->diagonalize(W, e_no, ascending);
+
+        for(int p = 0; p < n; ++p)
+        {
+            epsilon_vir[n0 + p] = e_no->get(p);
+            for(int a = 0; a < nvir; ++a)
+            {
+                double value = 0.0;
+                for(int q = 0; q < n; ++q)
+                {
+                    value += X->get(0, a, n0 + q) * W->get(0, q, p);
+                }
+                U->set(0, a, n0 + p, value);
+            }
+        }
+    }
+
+    // C_vir <- C_vir U
+    SharedMatrix C_vir (new Matrix("C vir", nbf, nvir));
+    for(int mu = 0; mu < nbf; ++mu)
+    {
+        for(int a = 0; a < nvir; ++a)
+        {
+            C_vir->set(0, mu, a, C->get(0, mu, doccpi + a));
+        }
+    }
+    SharedMatrix C_fno = Matrix::doublet(C_vir, U, false, false);
+    for(int mu = 0; mu < nbf; ++mu)
+    {
+        for(int a = 0; a < nvir; ++a)
+        {
+            C->set(0, mu, doccpi + a, C_fno->get(0, mu, a));
+        }
+    }
+    for(int a = 0; a < nvir; ++a)
+    {
+        epsilon[doccpi + a] = epsilon_vir[a];
+    }
+
+    return nfno;
+}
+
+double Pair_Screening_RHF(int doccpi, const std::vector<double>& Q_occ, const std::vector<double>& epsilon, double S, double cutoff, int frozen_c, std::vector<char>& pair_mask)
+{
+    int occ_start = frozen_c/2;
+    int nact = doccpi - occ_start;
+    double e_lumo = epsilon[doccpi];
+
+    // (1 - e^{-2 s x^2}) / x peaks at 2 s x^2 = t_max, where 2 t e^{-t} = 1 - e^{-t}
+    const double t_max = 1.2564312086261697;
+    double x_max = S > 0.0 && !std::isinf(S) ? sqrt(t_max / (2.0 * S)) : 0.0;
+
+    pair_mask.assign(nact * nact, 1);
+    double Ediscarded = 0.0;
+
+    for(int i = occ_start; i < doccpi; ++i)
+    {
+        for(int j = occ_start; j < doccpi; ++j)
+        {
+            // |e_i + e_j - e_a - e_b| >= x0 for every active a, b
+            double x0 = 2.0 * e_lumo - epsilon[i] - epsilon[j];
+            double g = 0.0;
+            if(std::isinf(S))
+            {
+                // MP2, the s -> infinity limit
+                g = 1.0 / x0;
+            }
+            else if(S > 0.0)
+            {
+                double x = std::max(x0, x_max);
+                g = (1.0 - exp(-2.0 * S * x * x)) / x;
+            }
+
+            // sum_ab (0.5 v_aa^2 + v_ab^2) <= 3 sum_ab <ij|ab>^2 <= 3 Q_i Q_j
+            double bound = 3.0 * Q_occ[i] * Q_occ[j] * g;
+            if(bound < cutoff)
+            {
+                pair_mask[(i - occ_start) * nact + (j - occ_start)] = 0;
+                Ediscarded += bound;
+            }
+        }
+    }
+    return(Ediscarded);
+}
+
+}} // End namespaces
@@ -0,0 +1,145 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef DSRGPT2_RHF_H
+#define DSRGPT2_RHF_H
+
+#include <vector>
+#include <psi4/libmints/typedefs.h>
+#include "zvector_solver.h"
+
+namespace psi{ namespace scf_plug {
+
+/*
+ * Closed-shell (spin-adapted) specialisation of the MP2 / DSRG-PT2 energy and
+ * relaxed density.
+ *
+ * Only the alpha-beta integrals <pq|rs> = (pr|qs) are stored (nmo^4), the
+ * same-spin integrals are formed on the fly as <pq||rs> = <pq|rs> - <pq|sr>.
+ * Likewise only the alpha-beta amplitudes are kept, since for a closed-shell
+ * reference t(aa)_ijab = t(ab)_ijab - t(ab)_ijba.  The beta blocks are
+ * identical to the alpha ones and are never built.
+ *
+ * Z_MP2 and D_MP2 are nmo x nmo spatial-orbital matrices holding the alpha
+ * block; the spin-summed density is 2 * D_MP2.
+ *
+ * frozen_c and frozen_v follow the FROZEN_CORE / FROZEN_VIRTUAL convention and
+ * are given in spin orbitals.
+ *
+ * pair_mask[(i - occ_start) * nact + (j - occ_start)] marks the active occupied
+ * pairs kept by Pair_Screening_RHF; an empty mask keeps every pair.
+ */
+
+/*
+ * nmo^4 integral / amplitude storage, in double or, to halve the memory, in
+ * float.  Elements are always read back as double, so every energy, density
+ * and Z-vector contraction still accumulates in double precision.
+ */
+class RHF_Tensor
+{
+public:
+    RHF_Tensor(size_t size, bool single) : single_(single)
+    {
+        if(single_) f_.assign(size, 0.0f);
+        else d_.assign(size, 0.0);
+    }
+
+    double operator[](size_t k) const { return single_ ? (double)f_[k] : d_[k]; }
+    void set(size_t k, double value)
+    {
+        if(single_) f_[k] = (float)value;
+        else d_[k] = value;
+    }
+
+    // the n elements from offset as double, converted into buf when stored in float
+    const double* block(size_t offset, size_t n, double* buf) const
+    {
+        if(!single_) return d_.data() + offset;
+        for(size_t k = 0; k < n; ++k) buf[k] = f_[offset + k];
+        return buf;
+    }
+
+    bool single() const { return single_; }
+    size_t memory() const { return single_ ? f_.size() * sizeof(float) : d_.size() * sizeof(double); }
+
+private:
+    bool single_;
+    std::vector<double> d_;
+    std::vector<float> f_;
+};
+
+// fill <pq|rs> and the alpha-beta DSRG amplitudes from the chemist-notation MO integrals
+void Build_Ints_Amps_RHF(SharedMatrix eri_mo, int nmo, int doccpi, const std::vector<double>& epsilon, RHF_Tensor& mo_ints_ab, RHF_Tensor& amp_t_dsrg_ab, double S);
+
+double MP2_Energy_RHF(int nmo, int doccpi, const RHF_Tensor& mo_ints_ab, const std::vector<double>& epsilon, int frozen_c, int frozen_v, const std::vector<char>& pair_mask = std::vector<char>());
+
+double DSRG_PT2_Energy_RHF(int nmo, int doccpi, const RHF_Tensor& mo_ints_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v, const std::vector<char>& pair_mask = std::vector<char>());
+
+// DSRG-PT2 correlation energy for every s in s_list from a single pass over the integrals
+std::vector<double> DSRG_PT2_Energy_Sweep_RHF(int nmo, int doccpi, const RHF_Tensor& mo_ints_ab, const std::vector<double>& epsilon, const std::vector<double>& s_list, int frozen_c, int frozen_v, const std::vector<char>& pair_mask = std::vector<char>());
+
+// unrelaxed oo/vv density, orbital response (Z-vector) and relaxed off-diagonal density.
+// D_unrelaxed, if given, receives the density without the orbital response; with
+// relaxed = false the Z-vector equations are not solved and D_MP2 is left incomplete.
+// Z_guess, if given, starts the solve (restarts); checkpoint saves its iterates.
+// The orbital Hessian is applied through the AO integrals eri and the orbitals C
+// of mo_ints_ab (see Hessian_JK).
+void DSRG_PT2_Density_RHF(SharedMatrix D_MP2, SharedMatrix Z_MP2, int nmo, int doccpi, const AO_ERI_Store& eri, SharedMatrix C, const RHF_Tensor& mo_ints_ab, const RHF_Tensor& amp_t_dsrg_ab, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v, const std::vector<char>& pair_mask = std::vector<char>(), const ZVector_Settings& zvec = ZVector_Settings(), bool relaxed = true, SharedMatrix D_unrelaxed = SharedMatrix(), SharedMatrix Z_guess = SharedMatrix(), const ZVector_Checkpoint& checkpoint = ZVector_Checkpoint());
+
+// unrelaxed virtual-virtual block of D_MP2 over the active virtuals (nvir x nvir) from
+// the active OVOV integrals alone, ovov[((i * nvir + a) * nocc + j) * nvir + b] = (ia|jb)
+// (active indices from 0); the amplitudes are formed on the fly.  Returns the MP2
+// correlation energy of the same block, the full-space reference of the FNO correction.
+double DSRG_PT2_Density_VV_RHF(SharedMatrix D_vv, int nmo, int doccpi, const std::vector<double>& ovov, const std::vector<double>& epsilon, double S, int frozen_c, int frozen_v);
+
+/*
+ * Frozen natural orbitals: diagonalise D_vv and keep the natural orbitals with
+ * |occupation| above occ_tolerance, or, if occ_percentage > 0, the fewest that
+ * carry occ_percentage % of the total |occupation| (the DSRG density is not
+ * positive semidefinite).  The kept and the
+ * dropped orbitals are semicanonicalised separately and replace the active
+ * virtual columns of C (kept first); epsilon is updated to match.
+ * Returns the number of kept virtuals.
+ */
+int FNO_Rotate_Virtuals_RHF(SharedMatrix D_vv, SharedMatrix C, std::vector<double>& epsilon, int doccpi, double occ_tolerance, double occ_percentage);
+
+/*
+ * Pair screening: with Q_i = sum_a (ia|ia) over the active virtuals, Schwarz
+ * gives |e_ij| <= 3 Q_i Q_j max_x (1 - e^{-2 s x^2}) / x, the maximum taken
+ * over |x| >= 2 e_LUMO - e_i - e_j.  Pairs whose bound falls below cutoff are
+ * cleared in pair_mask; returns the summed bound of the discarded pairs.
+ * The bound grows with s, so the largest s screens every smaller one; it does
+ * not bound MP2, for which S = infinity gives 3 Q_i Q_j / x0.
+ */
+double Pair_Screening_RHF(int doccpi, const std::vector<double>& Q_occ, const std::vector<double>& epsilon, double S, double cutoff, int frozen_c, std::vector<char>& pair_mask);
+
+}} // End namespaces
+
+#endif
@@ -0,0 +1,756 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/libmints/matrix.h"
+#include "dsrgpt2_so.h"
+#include "dsrg_regulator.h"
+#include "zvector_solver.h"
+#include <math.h>
+#include <cmath>
+
+namespace psi{ namespace scf_plug {
+
+static inline size_t four_idx(size_t p, size_t q, size_t r, size_t s, size_t dim)
+{
+    size_t dim2 = dim * dim;
+    size_t dim3 = dim2 * dim;
+    return (p * dim3 + q * dim2 + r * dim + s);
+}
+
+void Build_Ints_Amps_SO(SharedMatrix eri_mo, int nmo, int doccpi, const std::vector<double>& epsilon_a, const std::vector<double>& epsilon_b, std::vector<double>& mo_ints_aa, std::vector<double>& mo_ints_bb, std::vector<double>& mo_ints_ab, std::vector<double>& epsilon_ijab_aa, std::vector<double>& epsilon_ijab_bb, std::vector<double>& epsilon_ijab_ab, std::vector<double>& amp_t_dsrg_aa, std::vector<double>& amp_t_dsrg_bb, std::vector<double>& amp_t_dsrg_ab, double S)
+{
+    size_t nmo4 = (size_t)nmo * nmo * nmo * nmo;
+    for(std::vector<double>* v : {&mo_ints_aa, &mo_ints_bb, &mo_ints_ab, &epsilon_ijab_aa, &epsilon_ijab_bb, &epsilon_ijab_ab, &amp_t_dsrg_aa, &amp_t_dsrg_bb, &amp_t_dsrg_ab})
+    {
+        v->assign(nmo4, 0.0);
+    }
+
+    for (size_t i = 0; i < doccpi; ++i)
+    {
+        for (size_t j = 0; j < doccpi; ++j)
+        {
+            for (size_t a = doccpi; a < nmo; ++a)
+            {
+                for (size_t b = doccpi; b < nmo; ++b)
+                {
+                    epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] = epsilon_a[i] + epsilon_a[j] - epsilon_a[a] - epsilon_a[b];
+                    epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] = epsilon_b[i] + epsilon_b[j] - epsilon_b[a] - epsilon_b[b];
+                    epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] = epsilon_a[i] + epsilon_b[j] - epsilon_a[a] - epsilon_b[b];
+                }
+            }
+        }
+    }
+
+    //form the integrals <pq||rs> = <pq|rs> - <pq|sr> = (pr|qs) - (ps|qr)
+    for (size_t p = 0; p < nmo; p++) 
+    {
+        for (size_t q = 0; q < nmo; q++) 
+        {
+            for (size_t r = 0; r < nmo; r++) 
+            {
+                for (size_t s = 0; s < nmo; s++) 
+                {
+                    mo_ints_aa[four_idx(p, q, r, s, nmo)] = eri_mo->get(0, p * nmo + r, q * nmo + s) - eri_mo->get(0, p * nmo + s, q * nmo + r);
+                    mo_ints_bb[four_idx(p, q, r, s, nmo)] = eri_mo->get(0, p * nmo + r, q * nmo + s) - eri_mo->get(0, p * nmo + s, q * nmo + r);
+                    mo_ints_ab[four_idx(p, q, r, s, nmo)] = eri_mo->get(0, p * nmo + r, q * nmo + s);
+
+                    if(p < doccpi && q < doccpi && r >= doccpi && s >= doccpi)
+                    {
+                        amp_t_dsrg_aa[four_idx(p, q, r, s, nmo)] = mo_ints_aa[four_idx(p, q, r, s, nmo)] / epsilon_ijab_aa[four_idx(p, q, r, s, nmo)] * (1.0 - exp(-S * epsilon_ijab_aa[four_idx(p, q, r, s, nmo)] * epsilon_ijab_aa[four_idx(p, q, r, s, nmo)]));
+                        amp_t_dsrg_bb[four_idx(p, q, r, s, nmo)] = mo_ints_bb[four_idx(p, q, r, s, nmo)] / epsilon_ijab_bb[four_idx(p, q, r, s, nmo)] * (1.0 - exp(-S * epsilon_ijab_bb[four_idx(p, q, r, s, nmo)] * epsilon_ijab_bb[four_idx(p, q, r, s, nmo)]));
+                        amp_t_dsrg_ab[four_idx(p, q, r, s, nmo)] = mo_ints_ab[four_idx(p, q, r, s, nmo)] / epsilon_ijab_ab[four_idx(p, q, r, s, nmo)] * (1.0 - exp(-S * epsilon_ijab_ab[four_idx(p, q, r, s, nmo)] * epsilon_ijab_ab[four_idx(p, q, r, s, nmo)]));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void DSRG_PT2_Density_SO(SharedMatrix D_MP2, SharedMatrix Z_MP2, int nmo, int doccpi, const AO_ERI_Store& eri, SharedMatrix C, const std::vector<double>& mo_ints_aa, const std::vector<double>& mo_ints_bb, const std::vector<double>& mo_ints_ab, const std::vector<double>& epsilon_ijab_aa, const std::vector<double>& epsilon_ijab_bb, const std::vector<double>& epsilon_ijab_ab, const std::vector<double>& amp_t_dsrg_aa, const std::vector<double>& amp_t_dsrg_bb, const std::vector<double>& amp_t_dsrg_ab, const std::vector<double>& epsilon_a, const std::vector<double>& epsilon_b, double S, int frozen_c, int frozen_v, const ZVector_Settings& zvec, bool relaxed, SharedMatrix D_unrelaxed, SharedMatrix Z_guess, const ZVector_Checkpoint& checkpoint)
+{
+    int nso = 2 * nmo;
+    int nvir_act = nmo - frozen_v/2 - doccpi;
+
+    // regulator factors of the active aa, bb and ab OOVV blocks, evaluated once for the density and Z-vector terms
+    DSRG_Regulator_Tensors reg_aa(epsilon_a, epsilon_a, frozen_c/2, doccpi, doccpi, nmo - frozen_v/2, S);
+    DSRG_Regulator_Tensors reg_bb(epsilon_b, epsilon_b, frozen_c/2, doccpi, doccpi, nmo - frozen_v/2, S);
+    DSRG_Regulator_Tensors reg_ab(epsilon_a, epsilon_b, frozen_c/2, doccpi, doccpi, nmo - frozen_v/2, S);
+
+    for(int i = frozen_c/2; i < doccpi; ++i)
+    {
+        for(int j = frozen_c/2; j < doccpi; ++j)
+        {
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                size_t row = four_idx(i, j, a, doccpi, nmo);
+                size_t v0 = (size_t)(a - doccpi) * nvir_act;
+                const double* ex_aa = reg_aa.exp1_block(i, j) + v0;
+                const double* ex_bb = reg_bb.exp1_block(i, j) + v0;
+                const double* ex_ab = reg_ab.exp1_block(i, j) + v0;
+
+                for(int v = 0; v < nvir_act; ++v)
+                {
+                    size_t idx = row + v;
+                    double ratio_aa = (1.0 + ex_aa[v]) / (1.0 - ex_aa[v]);
+                    double ratio_bb = (1.0 + ex_bb[v]) / (1.0 - ex_bb[v]);
+                    double ratio_ab = (1.0 + ex_ab[v]) / (1.0 - ex_ab[v]);
+                    double exp2_aa = ex_aa[v] * ex_aa[v];
+                    double exp2_bb = ex_bb[v] * ex_bb[v];
+                    double exp2_ab = ex_ab[v] * ex_ab[v];
+                    double temp1 ;
+                    double temp2 ;
+                    double temp3 ;
+
+                    temp1 = -0.5 *  amp_t_dsrg_aa[idx] * amp_t_dsrg_aa[idx] * ratio_aa + 2.0 * S * mo_ints_aa[idx] * mo_ints_aa[idx] * exp2_aa;
+                    temp2 = -0.5 *  amp_t_dsrg_bb[idx] * amp_t_dsrg_bb[idx] * ratio_bb + 2.0 * S * mo_ints_bb[idx] * mo_ints_bb[idx] * exp2_bb;
+                    temp3 = 2.0 * ( -0.5 * amp_t_dsrg_ab[idx] * amp_t_dsrg_ab[idx] * ratio_ab + 2.0 * S * mo_ints_ab[idx] * mo_ints_ab[idx] * exp2_ab);
+                    D_MP2->add(0, 2*i, 2*i, temp1 + temp3);
+                    D_MP2->add(0, 2*i+1, 2*i+1, temp2 + temp3);
+                    D_MP2->add(0, 2*a, 2*a, -temp1 - temp3);
+                    D_MP2->add(0, 2*a+1, 2*a+1, -temp2 - temp3);
+                }
+            }
+        }
+    }
+
+    // Z {mn} and Z {cd} as packed DGEMM products plus the near pairs from the
+    // divided-difference kernel, see Divided_Difference; the gaps use the alpha
+    // orbital energies for every spin block
+    int nocc_act = doccpi - frozen_c/2;
+
+    auto add_spin_blocks = [&](const Divided_Difference& dd, int p0, int np, const std::vector<double>& M_aa, const std::vector<double>& M_bb, const std::vector<double>& M_ab, const std::vector<double>& N_aa, const std::vector<double>& N_bb, const std::vector<double>& N_ab)
+    {
+        std::vector<double> M_a(np * np), M_b(np * np), N_a(np * np), N_b(np * np), R_a, R_b;
+        for(int k = 0; k < np * np; ++k)
+        {
+            M_a[k] = M_aa[k] + 2.0 * M_ab[k];
+            M_b[k] = M_bb[k] + 2.0 * M_ab[k];
+            N_a[k] = N_aa[k] + 2.0 * N_ab[k];
+            N_b[k] = N_bb[k] + 2.0 * N_ab[k];
+        }
+        dd.combine(M_a, N_a, R_a);
+        dd.combine(M_b, N_b, R_b);
+
+        for(int q = 0; q < np; ++q)
+        {
+            for(int p = 0; p < np; ++p)
+            {
+                if(p == q) continue;
+                Z_MP2->add(0, 2*(p0 + q), 2*(p0 + p), R_a[q * np + p]);
+                Z_MP2->add(0, 2*(p0 + q)+1, 2*(p0 + p)+1, R_b[q * np + p]);
+            }
+        }
+    };
+
+    {
+        Divided_Difference dd_occ(epsilon_a, frozen_c/2, doccpi);
+        const std::vector<size_t>& near = dd_occ.near_pairs();
+        size_t nk = (size_t)nvir_act * nvir_act;
+        std::vector<double> V(nk * nocc_act), F(nk * nocc_act), D(nk * nocc_act);
+        std::vector<double> x(near.empty() ? 0 : nk), f(near.empty() ? 0 : nk);
+
+        // M(m, n) = sum_{jab} <mj||ab> <nj||ab> f(d_njab), f(x) = (1 - e^{-2 s x^2}) / x, and
+        // N(m, n) = sum_{jab} <mj||ab> <nj||ab> f[d_mjab, d_mjab + e_n - e_m] for the near pairs
+        auto contract_oo = [&](const std::vector<double>& ints, const std::vector<double>& eps_ijab, const DSRG_Regulator_Tensors& reg, std::vector<double>& M, std::vector<double>& N)
+        {
+            M.assign(nocc_act * nocc_act, 0.0);
+            N.assign(nocc_act * nocc_act, 0.0);
+            for(int j = frozen_c/2; j < doccpi; ++j)
+            {
+                for(int m = frozen_c/2; m < doccpi; ++m)
+                {
+                    for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+                    {
+                        for(int b = doccpi; b < nmo - frozen_v/2; ++b)
+                        {
+                            size_t K = ((size_t)(a - doccpi) * nvir_act + (b - doccpi)) * nocc_act + (m - frozen_c/2);
+                            D[K] = eps_ijab[four_idx(m, j, a, b, nmo)];
+                            V[K] = ints[four_idx(m, j, a, b, nmo)];
+                            F[K] = V[K] * (1.0 - reg.exp2(m, j, a, b)) / D[K];
+                        }
+                    }
+                }
+
+                C_DGEMM('T', 'N', nocc_act, nocc_act, nk, 1.0, V.data(), nocc_act, F.data(), nocc_act, 1.0, M.data(), nocc_act);
+
+                for(size_t mn : near)
+                {
+                    size_t m = mn / nocc_act, n = mn % nocc_act;
+                    for(size_t K = 0; K < nk; ++K) x[K] = D[K * nocc_act + m];
+                    DSRG_Divided_Differences(x.data(), nk, dd_occ.gap(m, n), S, f.data());
+                    for(size_t K = 0; K < nk; ++K)
+                    {
+                        N[mn] += V[K * nocc_act + m] * V[K * nocc_act + n] * f[K];
+                    }
+                }
+            }
+        };
+
+        std::vector<double> M_aa, M_bb, M_ab, N_aa, N_bb, N_ab;
+        contract_oo(mo_ints_aa, epsilon_ijab_aa, reg_aa, M_aa, N_aa);
+        contract_oo(mo_ints_bb, epsilon_ijab_bb, reg_bb, M_bb, N_bb);
+        contract_oo(mo_ints_ab, epsilon_ijab_ab, reg_ab, M_ab, N_ab);
+        add_spin_blocks(dd_occ, frozen_c/2, nocc_act, M_aa, M_bb, M_ab, N_aa, N_bb, N_ab);
+    }
+
+    {
+        Divided_Difference dd_vir(epsilon_a, doccpi, nmo - frozen_v/2);
+        const std::vector<size_t>& near = dd_vir.near_pairs();
+        size_t nk = (size_t)nvir_act * nvir_act;
+        std::vector<double> X(nk), Y(nk), V(near.empty() ? 0 : nk), D(near.empty() ? 0 : nk);
+        std::vector<double> x(near.empty() ? 0 : nvir_act), f(near.empty() ? 0 : nvir_act);
+
+        // M(c, d) = sum_{ija} t_ijac t_ijad (d / (1 - e^{-s d^2}))_ijac (1 + e^{-s d^2})_ijad and
+        // N(c, d) = -sum_{ija} <ij||ac> <ij||ad> f[d_ijac, d_ijac + e_c - e_d] for the near pairs
+        auto contract_vv = [&](const std::vector<double>& ints, const std::vector<double>& amps, const std::vector<double>& eps_ijab, const DSRG_Regulator_Tensors& reg, std::vector<double>& M, std::vector<double>& N)
+        {
+            M.assign(nk, 0.0);
+            N.assign(nk, 0.0);
+            for(int i = frozen_c/2; i < doccpi; ++i)
+            {
+                for(int j = frozen_c/2; j < doccpi; ++j)
+                {
+                    for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+                    {
+                        for(int c = doccpi; c < nmo - frozen_v/2; ++c)
+                        {
+                            size_t k = (size_t)(a - doccpi) * nvir_act + (c - doccpi);
+                            double d = eps_ijab[four_idx(i, j, a, c, nmo)];
+                            double t = amps[four_idx(i, j, a, c, nmo)];
+
+                            X[k] = t * d / reg.r1(i, j, a, c);
+                            Y[k] = t * reg.plus(i, j, a, c);
+                            if(!near.empty())
+                            {
+                                V[k] = ints[four_idx(i, j, a, c, nmo)];
+                                D[k] = d;
+                            }
+                        }
+                    }
+
+                    C_DGEMM('T', 'N', nvir_act, nvir_act, nvir_act, 1.0, X.data(), nvir_act, Y.data(), nvir_act, 1.0, M.data(), nvir_act);
+
+                    for(size_t cd : near)
+                    {
+                        size_t c = cd / nvir_act, d = cd % nvir_act;
+                        for(int a = 0; a < nvir_act; ++a) x[a] = D[a * nvir_act + c];
+                        DSRG_Divided_Differences(x.data(), nvir_act, -dd_vir.gap(c, d), S, f.data());
+                        for(int a = 0; a < nvir_act; ++a)
+                        {
+                            N[cd] -= V[a * nvir_act + c] * V[a * nvir_act + d] * f[a];
+                        }
+                    }
+                }
+            }
+        };
+
+        std::vector<double> M_aa, M_bb, M_ab, N_aa, N_bb, N_ab;
+        contract_vv(mo_ints_aa, amp_t_dsrg_aa, epsilon_ijab_aa, reg_aa, M_aa, N_aa);
+        contract_vv(mo_ints_bb, amp_t_dsrg_bb, epsilon_ijab_bb, reg_bb, M_bb, N_bb);
+        contract_vv(mo_ints_ab, amp_t_dsrg_ab, epsilon_ijab_ab, reg_ab, M_ab, N_ab);
+        add_spin_blocks(dd_vir, doccpi, nvir_act, M_aa, M_bb, M_ab, N_aa, N_bb, N_ab);
+    }
+
+    for(int n = frozen_c/2; n < doccpi; ++n)
+    {
+        for(int N = 0; N < frozen_c/2; ++N)
+        {
+            double temp1;
+            double temp2;
+            double temp3;
+
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                for(int b = doccpi; b < nmo - frozen_v/2; ++b)
+                {
+                    for(int j = frozen_c/2; j < doccpi; ++j)
+                    {
+                        temp1 = mo_ints_aa[four_idx(N, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(n, j, a, b, nmo)] * reg_aa.plus(n, j, a, b);        
+                        temp2 = mo_ints_bb[four_idx(N, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(n, j, a, b, nmo)] * reg_bb.plus(n, j, a, b);        
+                        temp3 = 2.0 * mo_ints_ab[four_idx(N, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(n, j, a, b, nmo)] * reg_ab.plus(n, j, a, b);        
+                        Z_MP2->add(0, 2*n, 2*N, (temp1 + temp3) /(epsilon_a[n]-epsilon_a[N]));
+                        Z_MP2->add(0, 2*n+1, 2*N+1, (temp2 + temp3) /(epsilon_a[n]-epsilon_a[N]));
+                    }
+                }
+            }
+            Z_MP2->set(0, 2*N, 2*n, Z_MP2->get(0, 2*n, 2*N));
+            Z_MP2->set(0, 2*N+1, 2*n+1, Z_MP2->get(0, 2*n+1, 2*N+1));
+        }
+    }
+
+    for(int d = doccpi; d < nmo - frozen_v/2; ++d)
+    {
+        for(int D = nmo - frozen_v/2; D < nmo; ++D)
+        {
+            double temp1;
+            double temp2;
+            double temp3;
+
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                for(int i = frozen_c/2; i < doccpi; ++i)
+                {
+                    for(int j = frozen_c/2; j < doccpi; ++j)
+                    {
+                        temp1 = mo_ints_aa[four_idx(i, j, a, D, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, d, nmo)] * reg_aa.plus(i, j, a, d);        
+                        temp2 = mo_ints_bb[four_idx(i, j, a, D, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, d, nmo)] * reg_bb.plus(i, j, a, d);        
+                        temp3 = 2.0 * mo_ints_ab[four_idx(i, j, a, D, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, d, nmo)] * reg_ab.plus(i, j, a, d);        
+                        Z_MP2->add(0, 2*d, 2*D, (temp1 + temp3) / (epsilon_a[d] - epsilon_a[D]));
+                        Z_MP2->add(0, 2*d+1, 2*D+1, (temp2 + temp3) / (epsilon_a[d] - epsilon_a[D]));
+                    }
+                }
+            }        
+            Z_MP2->set(0, 2*D, 2*d, Z_MP2->get(0, 2*d, 2*D));
+            Z_MP2->set(0, 2*D+1, 2*d+1, Z_MP2->get(0, 2*d+1, 2*D+1));
+        }
+    } 
+
+    std::vector<double> Xi_a(nmo, 0.0);
+    std::vector<double> Xi_b(nmo, 0.0);
+    std::vector<double> Xa_a(nmo, 0.0);
+    std::vector<double> Xa_b(nmo, 0.0);
+    std::vector<double> Yi_a(nmo, 0.0);
+    std::vector<double> Yi_b(nmo, 0.0);
+    std::vector<double> Ya_a(nmo, 0.0);
+    std::vector<double> Ya_b(nmo, 0.0);
+
+    for(int i = frozen_c/2; i < doccpi; ++i)
+    {
+        for(int j = frozen_c/2; j < doccpi; ++j)
+        {
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                size_t row = four_idx(i, j, a, doccpi, nmo);
+                size_t v0 = (size_t)(a - doccpi) * nvir_act;
+                const double* ex_aa = reg_aa.exp1_block(i, j) + v0;
+                const double* ex_bb = reg_bb.exp1_block(i, j) + v0;
+                const double* ex_ab = reg_ab.exp1_block(i, j) + v0;
+
+                for(int v = 0; v < nvir_act; ++v)
+                {
+                    size_t idx = row + v;
+                    double ratio_aa = (1.0 + ex_aa[v]) / (1.0 - ex_aa[v]);
+                    double ratio_bb = (1.0 + ex_bb[v]) / (1.0 - ex_bb[v]);
+                    double ratio_ab = (1.0 + ex_ab[v]) / (1.0 - ex_ab[v]);
+                    double exp2_aa = ex_aa[v] * ex_aa[v];
+                    double exp2_bb = ex_bb[v] * ex_bb[v];
+                    double exp2_ab = ex_ab[v] * ex_ab[v];
+                    double x_aa = amp_t_dsrg_aa[idx] * amp_t_dsrg_aa[idx] * ratio_aa;
+                    double x_bb = amp_t_dsrg_bb[idx] * amp_t_dsrg_bb[idx] * ratio_bb;
+                    double x_ab = 2.0 * amp_t_dsrg_ab[idx] * amp_t_dsrg_ab[idx] * ratio_ab;
+                    double y_aa = mo_ints_aa[idx] * mo_ints_aa[idx] * exp2_aa;
+                    double y_bb = mo_ints_bb[idx] * mo_ints_bb[idx] * exp2_bb;
+                    double y_ab = 2.0 * mo_ints_ab[idx] * mo_ints_ab[idx] * exp2_ab;
+
+                    Xi_a[i] += x_aa + x_ab;
+                    Xi_b[i] += x_bb + x_ab;
+                    Xa_a[a] += x_aa + x_ab;
+                    Xa_b[a] += x_bb + x_ab;
+
+                    Yi_a[i] += y_aa + y_ab;
+                    Yi_b[i] += y_bb + y_ab;
+                    Ya_a[a] += y_aa + y_ab;
+                    Ya_b[a] += y_bb + y_ab;
+                }
+            }
+        }
+    }
+
+    // Z-independent part of the response equations (amplitude and Xi / Yi / Xa / Ya terms), built once
+    SharedMatrix Z_rhs = Z_MP2->clone();
+    Z_rhs->zero();
+
+    /***********        Z {nc} {cn} right-hand side         ***********/
+    for(int c = doccpi; c < nmo - frozen_v/2; ++c)
+    {
+        for(int n = frozen_c/2; n < doccpi; ++n)
+        {
+            double T1_temp1 = 0.0, T1_temp2 = 0.0, T1_temp3 = 0.0;
+            double T2_temp1 = 0.0, T2_temp2 = 0.0, T2_temp3 = 0.0;
+            double T4_temp1 = 0.0, T4_temp2 = 0.0;
+            double T5_temp1 = 0.0, T5_temp2 = 0.0; 
+
+            for(int j = frozen_c/2; j < doccpi; ++j)
+            {
+                for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+                {
+                    for(int b = doccpi; b < nmo - frozen_v/2; ++b)
+                    {
+                        T1_temp1 += mo_ints_aa[four_idx(c, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(n, j, a, b, nmo)] * reg_aa.plus(n, j, a, b); 
+                        T1_temp2 += mo_ints_bb[four_idx(c, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(n, j, a, b, nmo)] * reg_bb.plus(n, j, a, b); 
+                        T1_temp3 += 2.0 * mo_ints_ab[four_idx(c, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(n, j, a, b, nmo)] * reg_ab.plus(n, j, a, b); 
+                    }
+                }
+            }
+
+            for(int i = frozen_c/2; i < doccpi; ++i)
+            {
+                for(int j = frozen_c/2; j < doccpi; ++j)
+                {
+                    for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+                    {
+                        T2_temp1 -= mo_ints_aa[four_idx(i, j, a, n, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, c, nmo)] * reg_aa.plus(i, j, a, c); 
+                        T2_temp2 -= mo_ints_bb[four_idx(i, j, a, n, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, c, nmo)] * reg_bb.plus(i, j, a, c); 
+                        T2_temp3 -= 2.0 * mo_ints_ab[four_idx(i, j, a, n, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, c, nmo)] * reg_ab.plus(i, j, a, c); 
+                    }
+                }
+            }
+
+            for(int i = frozen_c/2; i < doccpi; ++i)
+            {
+                T4_temp1 -= mo_ints_aa[four_idx(i, c, i, n, nmo)] * Xi_a[i];
+                T4_temp1 -= mo_ints_ab[four_idx(i, c, i, n, nmo)] * Xi_b[i];
+                T4_temp2 -= mo_ints_bb[four_idx(i, c, i, n, nmo)] * Xi_b[i];
+                T4_temp2 -= mo_ints_ab[four_idx(i, c, i, n, nmo)] * Xi_a[i];
+
+                T5_temp1 += 4.0 * S * mo_ints_aa[four_idx(i, c, i, n, nmo)] * Yi_a[i];
+                T5_temp1 += 4.0 * S * mo_ints_ab[four_idx(i, c, i, n, nmo)] * Yi_b[i];
+                T5_temp2 += 4.0 * S * mo_ints_bb[four_idx(i, c, i, n, nmo)] * Yi_b[i];
+                T5_temp2 += 4.0 * S * mo_ints_ab[four_idx(i, c, i, n, nmo)] * Yi_a[i];
+            }
+
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                T4_temp1 += mo_ints_aa[four_idx(a, c, a, n, nmo)] * Xa_a[a];
+                T4_temp1 += mo_ints_ab[four_idx(a, c, a, n, nmo)] * Xa_b[a];
+                T4_temp2 += mo_ints_bb[four_idx(a, c, a, n, nmo)] * Xa_b[a];
+                T4_temp2 += mo_ints_ab[four_idx(a, c, a, n, nmo)] * Xa_a[a];
+
+                T5_temp1 -= 4.0 * S * mo_ints_aa[four_idx(a, c, a, n, nmo)] * Ya_a[a];
+                T5_temp1 -= 4.0 * S * mo_ints_ab[four_idx(a, c, a, n, nmo)] * Ya_b[a];
+                T5_temp2 -= 4.0 * S * mo_ints_bb[four_idx(a, c, a, n, nmo)] * Ya_b[a];
+                T5_temp2 -= 4.0 * S * mo_ints_ab[four_idx(a, c, a, n, nmo)] * Ya_a[a];
+            }
+
+            Z_rhs->set(0, 2*n, 2*c, T1_temp1 + T1_temp3 + T2_temp1 + T2_temp3 + T4_temp1 + T5_temp1);
+            Z_rhs->set(0, 2*n+1, 2*c+1, T1_temp2 + T1_temp3 + T2_temp2 + T2_temp3 + T4_temp2 + T5_temp2);
+        }
+    }
+
+    /***********        Z {IA} {AI} right-hand side         ***********/
+    for(int I = 0; I < frozen_c/2; ++I)
+    {
+        for(int A = nmo - frozen_v/2; A < nmo; ++A)
+        {
+            double T2_temp1 = 0.0, T2_temp2 = 0.0;
+            double T3_temp1 = 0.0, T3_temp2 = 0.0;
+
+            for(int i = frozen_c/2; i < doccpi; ++i)
+            {
+                T2_temp1 -= mo_ints_aa[four_idx(i, I, i, A, nmo)] * Xi_a[i];
+                T2_temp1 -= mo_ints_ab[four_idx(i, I, i, A, nmo)] * Xi_b[i];
+                T2_temp2 -= mo_ints_bb[four_idx(i, I, i, A, nmo)] * Xi_b[i];
+                T2_temp2 -= mo_ints_ab[four_idx(i, I, i, A, nmo)] * Xi_a[i];
+
+                T3_temp1 += 4.0 * S * mo_ints_aa[four_idx(i, I, i, A, nmo)] * Yi_a[i];
+                T3_temp1 += 4.0 * S * mo_ints_ab[four_idx(i, I, i, A, nmo)] * Yi_b[i];
+                T3_temp2 += 4.0 * S * mo_ints_bb[four_idx(i, I, i, A, nmo)] * Yi_b[i];
+                T3_temp2 += 4.0 * S * mo_ints_ab[four_idx(i, I, i, A, nmo)] * Yi_a[i];
+            }
+
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                T2_temp1 += mo_ints_aa[four_idx(a, I, a, A, nmo)] * Xa_a[a];
+                T2_temp1 += mo_ints_ab[four_idx(a, I, a, A, nmo)] * Xa_b[a];
+                T2_temp2 += mo_ints_bb[four_idx(a, I, a, A, nmo)] * Xa_b[a];
+                T2_temp2 += mo_ints_ab[four_idx(a, I, a, A, nmo)] * Xa_a[a];
+
+                T3_temp1 -= 4.0 * S * mo_ints_aa[four_idx(a, I, a, A, nmo)] * Ya_a[a];
+                T3_temp1 -= 4.0 * S * mo_ints_ab[four_idx(a, I, a, A, nmo)] * Ya_b[a];
+                T3_temp2 -= 4.0 * S * mo_ints_bb[four_idx(a, I, a, A, nmo)] * Ya_b[a];
+                T3_temp2 -= 4.0 * S * mo_ints_ab[four_idx(a, I, a, A, nmo)] * Ya_a[a];
+            }
+
+            Z_rhs->set(0, 2*I, 2*A, T2_temp1 + T3_temp1);
+            Z_rhs->set(0, 2*I+1, 2*A+1, T2_temp2 + T3_temp2);
+        }
+    }
+
+    /***********        Z {cN} {Nc} right-hand side         ***********/
+    for(int c = doccpi ; c < nmo - frozen_v/2; ++c)
+    {
+        for(int N = 0; N < frozen_c/2; ++N)
+        {
+            double T2_temp1 = 0.0, T2_temp2 = 0.0;
+            double T3_temp1 = 0.0, T3_temp2 = 0.0;
+            double T4_temp1 = 0.0, T4_temp2 = 0.0, T4_temp3 = 0.0;
+
+            for(int i = frozen_c/2; i < doccpi; ++i)
+            {
+                T2_temp1 -= mo_ints_aa[four_idx(i, N, i, c, nmo)] * Xi_a[i];
+                T2_temp1 -= mo_ints_ab[four_idx(i, N, i, c, nmo)] * Xi_b[i];
+                T2_temp2 -= mo_ints_bb[four_idx(i, N, i, c, nmo)] * Xi_b[i];
+                T2_temp2 -= mo_ints_ab[four_idx(i, N, i, c, nmo)] * Xi_a[i];
+
+                T3_temp1 += 4.0 * S * mo_ints_aa[four_idx(i, N, i, c, nmo)] * Yi_a[i];
+                T3_temp1 += 4.0 * S * mo_ints_ab[four_idx(i, N, i, c, nmo)] * Yi_b[i];
+                T3_temp2 += 4.0 * S * mo_ints_bb[four_idx(i, N, i, c, nmo)] * Yi_b[i];
+                T3_temp2 += 4.0 * S * mo_ints_ab[four_idx(i, N, i, c, nmo)] * Yi_a[i];
+            }
+
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                T2_temp1 += mo_ints_aa[four_idx(a, N, a, c, nmo)] * Xa_a[a];
+                T2_temp1 += mo_ints_ab[four_idx(a, N, a, c, nmo)] * Xa_b[a];
+                T2_temp2 += mo_ints_bb[four_idx(a, N, a, c, nmo)] * Xa_b[a];
+                T2_temp2 += mo_ints_ab[four_idx(a, N, a, c, nmo)] * Xa_a[a];
+
+                T3_temp1 -= 4.0 * S * mo_ints_aa[four_idx(a, N, a, c, nmo)] * Ya_a[a];
+                T3_temp1 -= 4.0 * S * mo_ints_ab[four_idx(a, N, a, c, nmo)] * Ya_b[a];
+                T3_temp2 -= 4.0 * S * mo_ints_bb[four_idx(a, N, a, c, nmo)] * Ya_b[a];
+                T3_temp2 -= 4.0 * S * mo_ints_ab[four_idx(a, N, a, c, nmo)] * Ya_a[a];
+            }
+
+            for(int i = frozen_c/2; i < doccpi; ++i)
+            {
+                for(int j = frozen_c/2; j < doccpi; ++j)
+                {
+                    for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+                    {
+                        T4_temp1 -= mo_ints_aa[four_idx(i, j, a, N, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, c, nmo)] * reg_aa.plus(i, j, a, c); 
+                        T4_temp2 -= mo_ints_bb[four_idx(i, j, a, N, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, c, nmo)] * reg_bb.plus(i, j, a, c); 
+                        T4_temp3 -= 2.0 * mo_ints_ab[four_idx(i, j, a, N, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, c, nmo)] * reg_ab.plus(i, j, a, c); 
+                    }
+                }
+            }
+
+            Z_rhs->set(0, 2*N, 2*c, T2_temp1 + T3_temp1 + T4_temp1 + T4_temp3);
+            Z_rhs->set(0, 2*N+1, 2*c+1, T2_temp2 + T3_temp2 + T4_temp2 + T4_temp3);
+        }
+    }
+
+    /***********        Z {Cn} {nC} right-hand side         ***********/
+    for(int C = nmo - frozen_v/2; C < nmo; ++C)
+    {
+        for(int n = frozen_c/2; n < doccpi; ++n)
+        {
+            double T2_temp1 = 0.0, T2_temp2 = 0.0;
+            double T3_temp1 = 0.0, T3_temp2 = 0.0;
+            double T4_temp1 = 0.0, T4_temp2 = 0.0, T4_temp3 = 0.0;
+
+            for(int i = frozen_c/2; i < doccpi; ++i)
+            {
+                T2_temp1 -= mo_ints_aa[four_idx(i, n, i, C, nmo)] * Xi_a[i];
+                T2_temp1 -= mo_ints_ab[four_idx(i, n, i, C, nmo)] * Xi_b[i];
+                T2_temp2 -= mo_ints_bb[four_idx(i, n, i, C, nmo)] * Xi_b[i];
+                T2_temp2 -= mo_ints_ab[four_idx(i, n, i, C, nmo)] * Xi_a[i];
+
+                T3_temp1 += 4.0 * S * mo_ints_aa[four_idx(i, n, i, C, nmo)] * Yi_a[i];
+                T3_temp1 += 4.0 * S * mo_ints_ab[four_idx(i, n, i, C, nmo)] * Yi_b[i];
+                T3_temp2 += 4.0 * S * mo_ints_bb[four_idx(i, n, i, C, nmo)] * Yi_b[i];
+                T3_temp2 += 4.0 * S * mo_ints_ab[four_idx(i, n, i, C, nmo)] * Yi_a[i];
+            }
+
+            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            {
+                T2_temp1 += mo_ints_aa[four_idx(a, n, a, C, nmo)] * Xa_a[a];
+                T2_temp1 += mo_ints_ab[four_idx(a, n, a, C, nmo)] * Xa_b[a];
+                T2_temp2 += mo_ints_bb[four_idx(a, n, a, C, nmo)] * Xa_b[a];
+                T2_temp2 += mo_ints_ab[four_idx(a, n, a, C, nmo)] * Xa_a[a];
+
+                T3_temp1 -= 4.0 * S * mo_ints_aa[four_idx(a, n, a, C, nmo)] * Ya_a[a];
+                T3_temp1 -= 4.0 * S * mo_ints_ab[four_idx(a, n, a, C, nmo)] * Ya_b[a];
+                T3_temp2 -= 4.0 * S * mo_ints_bb[four_idx(a, n, a, C, nmo)] * Ya_b[a];
+                T3_temp2 -= 4.0 * S * mo_ints_ab[four_idx(a, n, a, C, nmo)] * Ya_a[a];
+            }
+
+            for(int j = frozen_c/2; j < doccpi; ++j)
+            {
+                for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+                {
+                    for(int b = doccpi; b < nmo - frozen_v/2; ++b)
+                    {
+                        T4_temp1 += mo_ints_aa[four_idx(C, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(n, j, a, b, nmo)] * reg_aa.plus(n, j, a, b); 
+                        T4_temp2 += mo_ints_bb[four_idx(C, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(n, j, a, b, nmo)] * reg_bb.plus(n, j, a, b); 
+                        T4_temp3 += 2.0 * mo_ints_ab[four_idx(C, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(n, j, a, b, nmo)] * reg_ab.plus(n, j, a, b); 
+                    }
+                }
+            }
+
+            Z_rhs->set(0, 2*n, 2*C, T2_temp1 + T3_temp1 + T4_temp1 + T4_temp3);
+            Z_rhs->set(0, 2*n+1, 2*C+1, T2_temp2 + T3_temp2 + T4_temp2 + T4_temp3);
+        }
+    }
+
+    // unrelaxed density: the diagonal and the off-diagonal oo / vv blocks built so far
+    if(D_unrelaxed)
+    {
+        for(int p = 0; p < nso; ++p)
+        {
+            for(int q = 0; q < nso; ++q)
+            {
+                double value = D_MP2->get(0, p, q);
+                if(p != q)
+                {
+                    value = (p < 2 * doccpi) == (q < 2 * doccpi) ? 0.5 * Z_MP2->get(0, p, q) : 0.0;
+                }
+                D_unrelaxed->set(0, p, q, value);
+            }
+        }
+    }
+    if(!relaxed) return;
+    if(Z_guess) Apply_ZVector_Guess(Z_MP2, Z_guess, 2 * doccpi);
+
+    // a single right-hand side: the relaxed density is independent of the
+    // perturbation, so one Z serves every dipole component
+    std::vector<SharedMatrix> Z_block(1, Z_MP2);
+    std::vector<SharedMatrix> rhs(1, Z_rhs);
+
+    // sum_pq <pX||qY> Z_qp (same spin) + <pX|qY> Z_qp (opposite spin) as a generalised
+    // Fock build through the AO integrals, J(Z_a + Z_b) - K(Z_sigma) for spin sigma.
+    // F[k] holds the alpha and beta products in the spin-orbital layout of Z.
+    auto orbital_hessian = [&](const std::vector<size_t>& active, std::vector<SharedMatrix>& F)
+    {
+        size_t nrhs = active.size();
+        std::vector<SharedMatrix> Z_ab(2 * nrhs), J, K;
+        for(size_t r = 0; r < nrhs; ++r)
+        {
+            SharedMatrix Z = Z_block[active[r]];
+            Z_ab[2*r] = SharedMatrix(new Matrix("Z alpha", nmo, nmo));
+            Z_ab[2*r+1] = SharedMatrix(new Matrix("Z beta", nmo, nmo));
+            for(int p = 0; p < nmo; ++p)
+            {
+                for(int q = 0; q < nmo; ++q)
+                {
+                    Z_ab[2*r]->set(0, p, q, p != q ? Z->get(0, 2*p, 2*q) : 0.0);
+                    Z_ab[2*r+1]->set(0, p, q, p != q ? Z->get(0, 2*p+1, 2*q+1) : 0.0);
+                }
+            }
+        }
+        Hessian_JK(eri, C, Z_ab, J, K);
+
+        for(size_t r = 0; r < nrhs; ++r)
+        {
+            SharedMatrix Fk = F[active[r]];
+            Fk->zero();
+            for(int p = 0; p < nmo; ++p)
+            {
+                for(int q = 0; q < nmo; ++q)
+                {
+                    double j_pq = J[2*r]->get(0, p, q) + J[2*r+1]->get(0, p, q);
+                    Fk->set(0, 2*p, 2*q, j_pq - K[2*r]->get(0, p, q));
+                    Fk->set(0, 2*p+1, 2*q+1, j_pq - K[2*r+1]->get(0, p, q));
+                }
+            }
+        }
+    };
+
+    // one Jacobi step of the occupied-virtual equations; each pass only applies
+    // the orbital Hessian to the current Z
+    auto sweep = [&](size_t k, SharedMatrix F, SharedMatrix Z_new)
+    {
+        /***********        Z {nc} {cn} (DONE)         ***********/
+        for(int c = doccpi; c < nmo - frozen_v/2; ++c)
+        {
+            for(int n = frozen_c/2; n < doccpi; ++n)
+            {
+                double T3_temp1 = F->get(0, 2*n, 2*c), T3_temp2 = F->get(0, 2*n+1, 2*c+1);
+
+                Z_new->set(0, 2*n, 2*c, (T3_temp1 + rhs[k]->get(0, 2*n, 2*c)) / (epsilon_a[n] - epsilon_a[c]));
+                Z_new->set(0, 2*c, 2*n, Z_new->get(0, 2*n, 2*c));
+                Z_new->set(0, 2*n+1, 2*c+1, (T3_temp2 + rhs[k]->get(0, 2*n+1, 2*c+1)) / (epsilon_a[n] - epsilon_a[c]));
+                Z_new->set(0, 2*c+1, 2*n+1, Z_new->get(0, 2*n+1, 2*c+1));
+            }
+        }
+
+        /***********        Z {IA} {AI} (DONE)        ***********/
+        for(int I = 0; I < frozen_c/2; ++I)
+        {
+            for(int A = nmo - frozen_v/2; A < nmo; ++A)
+            {
+                double T1_temp1 = F->get(0, 2*I, 2*A), T1_temp2 = F->get(0, 2*I+1, 2*A+1);
+
+                Z_new->set(0, 2*I, 2*A, (T1_temp1 + rhs[k]->get(0, 2*I, 2*A)) / (epsilon_a[I] - epsilon_a[A]));
+                Z_new->set(0, 2*A, 2*I, Z_new->get(0, 2*I, 2*A));
+                Z_new->set(0, 2*I+1, 2*A+1, (T1_temp2 + rhs[k]->get(0, 2*I+1, 2*A+1)) / (epsilon_a[I] - epsilon_a[A]));
+                Z_new->set(0, 2*A+1, 2*I+1, Z_new->get(0, 2*I+1, 2*A+1));
+            }
+        }        
+
+        /***********        Z {cN} {Nc} (DONE)        ***********/
+        for(int c = doccpi ; c < nmo - frozen_v/2; ++c)
+        {
+            for(int N = 0; N < frozen_c/2; ++N)
+            {
+                double T1_temp1 = F->get(0, 2*N, 2*c), T1_temp2 = F->get(0, 2*N+1, 2*c+1);
+
+                Z_new->set(0, 2*N, 2*c, (T1_temp1 + rhs[k]->get(0, 2*N, 2*c)) / (epsilon_a[N] - epsilon_a[c]));
+                Z_new->set(0, 2*c, 2*N, Z_new->get(0, 2*N, 2*c));
+                Z_new->set(0, 2*N+1, 2*c+1, (T1_temp2 + rhs[k]->get(0, 2*N+1, 2*c+1)) / (epsilon_a[N] - epsilon_a[c]));
+                Z_new->set(0, 2*c+1, 2*N+1, Z_new->get(0, 2*N+1, 2*c+1));
+            }
+        }   
+
+        /***********        Z {Cn} {nC}         ***********/
+        for(int C = nmo - frozen_v/2; C < nmo; ++C)
+        {
+            for(int n = frozen_c/2; n < doccpi; ++n)
+            {
+                double T1_temp1 = F->get(0, 2*n, 2*C), T1_temp2 = F->get(0, 2*n+1, 2*C+1);
+
+                Z_new->set(0, 2*n, 2*C, (T1_temp1 + rhs[k]->get(0, 2*n, 2*C)) / ( epsilon_a[n] - epsilon_a[C] ));
+                Z_new->set(0, 2*C, 2*n, Z_new->get(0, 2*n, 2*C));
+                Z_new->set(0, 2*n+1, 2*C+1, (T1_temp2 + rhs[k]->get(0, 2*n+1, 2*C+1)) / ( epsilon_a[n] - epsilon_a[C] ));
+                Z_new->set(0, 2*C+1, 2*n+1, Z_new->get(0, 2*n+1, 2*C+1));
+            }
+        }
+    };
+
+    double max_change = 0.0;
+    int iter = Solve_ZVector_Block(Z_block, orbital_hessian, sweep, zvec, max_change, checkpoint);
+    Print_ZVector_Convergence(iter, max_change, zvec);
+
+    for(int p = 0; p < nso; ++p)
+    {
+        for(int q = 0; q < nso; ++q)
+        {
+            if(p != q)
+            {
+                D_MP2->set(0, p, q, 0.5 * Z_MP2->get(0, p, q));
+            }
+        }
+    }
+}
+
+SharedMatrix Spin_Sum_SO(SharedMatrix D_so, const std::string& name)
+{
+    int nmo = D_so->rowdim() / 2;
+    SharedMatrix D (new Matrix(name, nmo, nmo));
+    for(int p = 0; p < 2 * nmo; ++p)
+    {
+        for(int q = 0; q < 2 * nmo; ++q)
+        {
+            D->add(0, p / 2, q / 2, D_so->get(0, p, q));
+        }
+    }
+    return D;
+}
+
+}} // End namespaces
@@ -0,0 +1,69 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef DSRGPT2_SO_H
+#define DSRGPT2_SO_H
+
+#include <vector>
+#include <string>
+#include <psi4/libmints/typedefs.h>
+#include "zvector_solver.h"
+
+namespace psi{ namespace scf_plug {
+
+/*
+ * Spin-orbital MP2 / DSRG-PT2 density (SPIN_ADAPTED 0 or a reference with
+ * different alpha and beta orbitals), the counterpart of DSRG_PT2_Density_RHF.
+ *
+ * The aa, bb and ab integrals <pq||rs> / <pq|rs>, denominators and amplitudes are
+ * kept as separate nmo^4 blocks.  Z_MP2, D_MP2 and D_unrelaxed are 2 nmo x 2 nmo
+ * spin-orbital matrices, alpha orbital p at 2 p and beta at 2 p + 1; Spin_Sum_SO
+ * folds them into the spatial alpha + beta density.
+ *
+ * frozen_c and frozen_v follow the FROZEN_CORE / FROZEN_VIRTUAL convention and
+ * are given in spin orbitals.
+ */
+
+// fill the aa, bb and ab integrals, OOVV denominators and DSRG amplitudes from the
+// chemist-notation MO integrals
+void Build_Ints_Amps_SO(SharedMatrix eri_mo, int nmo, int doccpi, const std::vector<double>& epsilon_a, const std::vector<double>& epsilon_b, std::vector<double>& mo_ints_aa, std::vector<double>& mo_ints_bb, std::vector<double>& mo_ints_ab, std::vector<double>& epsilon_ijab_aa, std::vector<double>& epsilon_ijab_bb, std::vector<double>& epsilon_ijab_ab, std::vector<double>& amp_t_dsrg_aa, std::vector<double>& amp_t_dsrg_bb, std::vector<double>& amp_t_dsrg_ab, double S);
+
+// unrelaxed oo/vv density, orbital response (Z-vector) and relaxed off-diagonal density,
+// with the same D_unrelaxed / relaxed / Z_guess / checkpoint conventions as
+// DSRG_PT2_Density_RHF; Z_guess is a spin-orbital Z.  The orbital Hessian is applied
+// through the AO integrals eri and the orbitals C (see Hessian_JK).
+void DSRG_PT2_Density_SO(SharedMatrix D_MP2, SharedMatrix Z_MP2, int nmo, int doccpi, const AO_ERI_Store& eri, SharedMatrix C, const std::vector<double>& mo_ints_aa, const std::vector<double>& mo_ints_bb, const std::vector<double>& mo_ints_ab, const std::vector<double>& epsilon_ijab_aa, const std::vector<double>& epsilon_ijab_bb, const std::vector<double>& epsilon_ijab_ab, const std::vector<double>& amp_t_dsrg_aa, const std::vector<double>& amp_t_dsrg_bb, const std::vector<double>& amp_t_dsrg_ab, const std::vector<double>& epsilon_a, const std::vector<double>& epsilon_b, double S, int frozen_c, int frozen_v, const ZVector_Settings& zvec = ZVector_Settings(), bool relaxed = true, SharedMatrix D_unrelaxed = SharedMatrix(), SharedMatrix Z_guess = SharedMatrix(), const ZVector_Checkpoint& checkpoint = ZVector_Checkpoint());
+
+// spatial alpha + beta density (nmo x nmo) from a spin-orbital one
+SharedMatrix Spin_Sum_SO(SharedMatrix D_so, const std::string& name);
+
+}} // End namespaces
+
+#endif
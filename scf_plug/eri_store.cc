@@ -0,0 +1,200 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/libmints/matrix.h"
+#include "psi4/libmints/basisset.h"
+#include "psi4/libmints/mintshelper.h"
+#include "psi4/libpsio/psio.hpp"
+#include "psi4/libpsi4util/exception.h"
+#include "integral_cache.h"
+#include "eri_store.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+
+namespace psi{ namespace scf_plug {
+
+namespace {
+
+const char eri_magic[8] = "SCFPERI";
+const uint32_t eri_byte_order = 0x01020304;
+
+// closes the descriptor, and with it any flock, on every exit path
+struct File_Descriptor
+{
+    int fd;
+    explicit File_Descriptor(int fd) : fd(fd) {}
+    ~File_Descriptor() { if(fd >= 0) close(fd); }
+};
+
+std::string errno_message(const std::string& what, const std::string& path)
+{
+    return what + " " + path + ": " + strerror(errno);
+}
+
+void write_all(int fd, const char* buf, size_t n, const std::string& path)
+{
+    while(n > 0)
+    {
+        ssize_t written = write(fd, buf, n);
+        if(written < 0)
+        {
+            if(errno == EINTR) continue;
+            throw PSIEXCEPTION(errno_message("Could not write the ERI file", path));
+        }
+        buf += written;
+        n -= written;
+    }
+}
+
+}
+
+uint64_t AO_ERI_Store::Fingerprint(std::shared_ptr<BasisSet> basis, double threshold)
+{
+    std::ostringstream key;
+    key << Geometry_Key(basis, basis->molecule()) << " threshold " << std::hexfloat << threshold;
+    return Key_Fingerprint(key.str());
+}
+
+std::string AO_ERI_Store::Default_Path(std::shared_ptr<BasisSet> basis, double threshold)
+{
+    std::string scratch = PSIOManager::shared_object()->get_default_path();
+    if(!scratch.empty() && scratch.back() != '/') scratch += "/";
+    std::ostringstream name;
+    name << scratch << "scf_plug." << std::hex << std::setw(16) << std::setfill('0') << Fingerprint(basis, threshold) << ".eri";
+    return name.str();
+}
+
+AO_ERI_Store::AO_ERI_Store(MintsHelper& mints, std::shared_ptr<BasisSet> basis)
+    : eri_(mints.ao_eri()), nbf_(basis->nbf()), nbf2_((size_t)basis->nbf() * basis->nbf())
+{
+    data_ = eri_->pointer()[0];
+}
+
+AO_ERI_Store::AO_ERI_Store(const std::string& path, MintsHelper& mints, std::shared_ptr<BasisSet> basis, double threshold)
+    : nbf_(basis->nbf()), nbf2_((size_t)basis->nbf() * basis->nbf())
+{
+    uint64_t fingerprint = Fingerprint(basis, threshold);
+    size_t data_size = nbf2_ * nbf2_ * sizeof(double);
+
+    // one writer per file: concurrent runs wait on the lock and then map its result.
+    // The file appears under its final name only once complete.
+    {
+        std::string lock_path = path + ".lock";
+        File_Descriptor lock(open(lock_path.c_str(), O_RDWR | O_CREAT, 0644));
+        if(lock.fd < 0 || flock(lock.fd, LOCK_EX) != 0)
+        {
+            throw PSIEXCEPTION(errno_message("Could not lock", lock_path));
+        }
+        if(access(path.c_str(), F_OK) != 0)
+        {
+            std::vector<char> head(data_offset, 0);
+            ERI_File_Header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, eri_magic, sizeof(header.magic));
+            header.version = version;
+            header.byte_order = eri_byte_order;
+            header.nbf = nbf_;
+            header.fingerprint = fingerprint;
+            header.threshold = threshold;
+            header.data_offset = data_offset;
+            memcpy(head.data(), &header, sizeof(header));
+
+            SharedMatrix eri = mints.ao_eri();
+            std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+            {
+                File_Descriptor out(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+                if(out.fd < 0)
+                {
+                    throw PSIEXCEPTION(errno_message("Could not create the ERI file", tmp_path));
+                }
+                write_all(out.fd, head.data(), head.size(), tmp_path);
+                write_all(out.fd, (const char*)eri->pointer()[0], data_size, tmp_path);
+            }
+            if(rename(tmp_path.c_str(), path.c_str()) != 0)
+            {
+                unlink(tmp_path.c_str());
+                throw PSIEXCEPTION(errno_message("Could not rename the ERI file to", path));
+            }
+        }
+
+        // the file is in place, so whoever takes a lock from here on only maps it;
+        // drop the lock file while still holding it (a later run may have removed it already)
+        unlink(lock_path.c_str());
+    }
+
+    File_Descriptor in(open(path.c_str(), O_RDONLY));
+    struct stat st;
+    if(in.fd < 0 || fstat(in.fd, &st) != 0)
+    {
+        throw PSIEXCEPTION(errno_message("Could not open the ERI file", path));
+    }
+    map_size_ = st.st_size;
+    if(map_size_ != data_offset + data_size)
+    {
+        throw PSIEXCEPTION("The ERI file " + path + " does not hold nbf^4 integrals for this basis.");
+    }
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, in.fd, 0);
+    if(map_ == MAP_FAILED)
+    {
+        map_ = nullptr;
+        throw PSIEXCEPTION(errno_message("Could not map the ERI file", path));
+    }
+
+    const ERI_File_Header* header = (const ERI_File_Header*)map_;
+    if(memcmp(header->magic, eri_magic, sizeof(header->magic)) != 0 || header->version != version || header->byte_order != eri_byte_order
+       || header->nbf != (uint64_t)nbf_ || header->fingerprint != fingerprint || header->threshold != threshold || header->data_offset != data_offset)
+    {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        throw PSIEXCEPTION("The ERI file " + path + " was written for another geometry, basis or INTS_TOLERANCE.");
+    }
+    data_ = (const double*)((const char*)map_ + data_offset);
+}
+
+void AO_ERI_Store::remove_on_close(const std::string& path)
+{
+    remove_path_ = path;
+}
+
+AO_ERI_Store::~AO_ERI_Store()
+{
+    if(map_) munmap(map_, map_size_);
+    if(!remove_path_.empty()) unlink(remove_path_.c_str());
+}
+
+}} // End namespaces
@@ -0,0 +1,121 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef ERI_STORE_H
+#define ERI_STORE_H
+
+#include <string>
+#include <cstdint>
+#include <psi4/libmints/typedefs.h>
+#include "psi4/libmints/matrix.h"
+
+namespace psi{
+
+class MintsHelper;
+
+namespace scf_plug {
+
+/*
+ * AO two-electron integrals (pq|rs), stored nbf^2 x nbf^2 row-major in the
+ * layout of MintsHelper::ao_eri(), held either in memory or mapped read-only
+ * from a scratch file.
+ *
+ * The file is written once, by whichever run gets there first, and every
+ * other run at the same geometry, basis and INTS_TOLERANCE on the node maps
+ * the same pages instead of computing and holding its own copy.  Layout, in
+ * native byte order:
+ *
+ *     [0, 4096)          ERI_File_Header
+ *     [4096, + nbf^4 8)  the integrals as double
+ *
+ * The header fingerprint is a hash of Geometry_Key and the threshold, and a
+ * mismatch on reuse is an error rather than a silent recompute.  The file
+ * outlives the run for the next one at that geometry; remove_on_close()
+ * deletes it when the store is destroyed (runs that still map it keep their
+ * pages, and the next run writes it again).
+ */
+struct ERI_File_Header
+{
+    char magic[8];          // "SCFPERI"
+    uint32_t version;
+    uint32_t byte_order;    // 0x01020304 as written
+    uint64_t nbf;
+    uint64_t fingerprint;
+    double threshold;
+    uint64_t data_offset;
+};
+
+class AO_ERI_Store
+{
+public:
+    static const uint32_t version = 1;
+    static const uint64_t data_offset = 4096;
+
+    // in memory, computed by mints
+    AO_ERI_Store(MintsHelper& mints, std::shared_ptr<BasisSet> basis);
+
+    // mapped from path, which is first written from mints if it does not exist yet
+    AO_ERI_Store(const std::string& path, MintsHelper& mints, std::shared_ptr<BasisSet> basis, double threshold);
+
+    ~AO_ERI_Store();
+    AO_ERI_Store(const AO_ERI_Store&) = delete;
+    AO_ERI_Store& operator=(const AO_ERI_Store&) = delete;
+
+    // (pq|rs) with pq = p * nbf + q, rs = r * nbf + s
+    double get(size_t pq, size_t rs) const { return data_[pq * nbf2_ + rs]; }
+
+    // the nbf^2 integrals (pq|..) of row pq; consecutive rows are contiguous
+    const double* row(size_t pq) const { return data_ + pq * nbf2_; }
+
+    int nbf() const { return nbf_; }
+    bool mapped() const { return map_ != nullptr; }
+
+    // unlink path (the mapped file) in the destructor
+    void remove_on_close(const std::string& path);
+
+    // fingerprint of the geometry, basis and threshold, also used for the default file name
+    static uint64_t Fingerprint(std::shared_ptr<BasisSet> basis, double threshold);
+
+    // <scratch>/scf_plug.<fingerprint>.eri
+    static std::string Default_Path(std::shared_ptr<BasisSet> basis, double threshold);
+
+private:
+    SharedMatrix eri_;
+    const double* data_ = nullptr;
+    int nbf_ = 0;
+    size_t nbf2_ = 0;
+    void* map_ = nullptr;
+    size_t map_size_ = 0;
+    std::string remove_path_;
+};
+
+}} // End namespaces
+
+#endif
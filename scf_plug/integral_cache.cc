@@ -0,0 +1,162 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#include "psi4/libmints/matrix.h"
+#include "psi4/libmints/vector.h"
+#include "psi4/libmints/molecule.h"
+#include "psi4/libmints/basisset.h"
+#include "psi4/libmints/mintshelper.h"
+#include "psi4/libmints/integral.h"
+#include "psi4/libmints/onebody.h"
+#include "integral_cache.h"
+#include <math.h>
+#include <map>
+#include <deque>
+#include <string>
+#include <sstream>
+
+namespace psi{ namespace scf_plug {
+
+namespace {
+
+const size_t max_entries = 4;
+
+// insertion-ordered map that forgets the oldest entry beyond max_entries
+template <class T>
+class Bounded_Cache
+{
+public:
+    T* find(const std::string& key)
+    {
+        auto it = entries_.find(key);
+        return it == entries_.end() ? nullptr : &it->second;
+    }
+    T& insert(const std::string& key, const T& value)
+    {
+        if(entries_.size() == max_entries)
+        {
+            entries_.erase(order_.front());
+            order_.pop_front();
+        }
+        order_.push_back(key);
+        return entries_[key] = value;
+    }
+
+private:
+    std::map<std::string, T> entries_;
+    std::deque<std::string> order_;
+};
+
+Bounded_Cache<std::shared_ptr<const AO_OneElectron_Ints>> one_electron_cache;
+Bounded_Cache<std::shared_ptr<const std::vector<SharedMatrix>>> multipole_cache;
+
+}
+
+std::string Geometry_Key(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule)
+{
+    std::ostringstream key;
+    key << std::hexfloat << basis->name() << " " << basis->nbf();
+    for(int a = 0; a < molecule->natom(); ++a)
+    {
+        key << " " << molecule->Z(a) << " " << molecule->x(a) << " " << molecule->y(a) << " " << molecule->z(a);
+    }
+    return key.str();
+}
+
+uint64_t Key_Fingerprint(const std::string& key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(char c : key)
+    {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::shared_ptr<const AO_OneElectron_Ints> Cached_OneElectron_Ints(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule)
+{
+    std::string key = Geometry_Key(basis, molecule);
+    if(auto cached = one_electron_cache.find(key)) return *cached;
+
+    auto ints = std::make_shared<AO_OneElectron_Ints>();
+    MintsHelper mints(basis);
+    ints->overlap = mints.ao_overlap();
+    ints->kinetic = mints.ao_kinetic();
+    ints->potential = mints.ao_potential();
+
+    // S^{-1/2} = U s^{-1/2} U^T
+    int nbf = basis->nbf();
+    int dims[] = {nbf};
+    SharedMatrix evecs (new Matrix("evecs", 1, dims, dims, 0));
+    SharedVector evals (new Vector("evals", 1, dims));
+    SharedMatrix Omega (new Matrix("Omega", 1, dims, dims, 0));
+    ints->overlap->diagonalize(evecs, evals);
+    for(int i = 0; i < nbf; ++i)
+    {
+        Omega->set(0, i, i, 1.0 / sqrt(evals->get(0, i)));
+    }
+    ints->S_half = Matrix::triplet(evecs, Omega, evecs, false, false, true);
+
+    // all three dipole components from one integral pass
+    std::shared_ptr<IntegralFactory> ints_fac = std::make_shared<IntegralFactory>(basis);
+    for (const std::string& direction : {"X", "Y", "Z"}) {
+        ints->dipole.push_back(SharedMatrix(new Matrix("AO Dipole " + direction, nbf, nbf)));
+    }
+    std::shared_ptr<OneBodyAOInt> aodOBI(ints_fac->ao_dipole());
+    aodOBI->compute(ints->dipole);
+
+    return one_electron_cache.insert(key, ints);
+}
+
+std::shared_ptr<const std::vector<SharedMatrix>> Cached_Multipole_Ints(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule, int order, const Vector3& origin)
+{
+    std::ostringstream key;
+    key << std::hexfloat << Geometry_Key(basis, molecule) << " order " << order << " origin " << origin[0] << " " << origin[1] << " " << origin[2];
+    if(auto cached = multipole_cache.find(key.str())) return *cached;
+
+    // (order + 1)(order + 2)(order + 3) / 6 - 1 components for l = 1 .. order
+    int ncomp = (order + 1) * (order + 2) * (order + 3) / 6 - 1;
+    int nbf = basis->nbf();
+    auto ints = std::make_shared<std::vector<SharedMatrix>>();
+    for(int k = 0; k < ncomp; ++k)
+    {
+        ints->push_back(SharedMatrix(new Matrix("AO Multipole", nbf, nbf)));
+    }
+    std::shared_ptr<IntegralFactory> ints_fac = std::make_shared<IntegralFactory>(basis);
+    std::shared_ptr<OneBodyAOInt> mpOBI(ints_fac->ao_multipoles(order));
+    mpOBI->set_origin(origin);
+    mpOBI->compute(*ints);
+
+    return multipole_cache.insert(key.str(), ints);
+}
+
+}} // End namespaces
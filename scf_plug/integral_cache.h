@@ -0,0 +1,78 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+
+#ifndef INTEGRAL_CACHE_H
+#define INTEGRAL_CACHE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <psi4/libmints/typedefs.h>
+#include "psi4/libmints/vector3.h"
+
+namespace psi{
+
+class Molecule;
+
+namespace scf_plug {
+
+/*
+ * Per-process cache of the one-electron AO integrals, keyed by the geometry
+ * (charges and coordinates, bit-exact), the basis and, for the multipoles, the
+ * order and origin.  Perturbation directions, field strengths and repeated
+ * plugin calls in one psi4 session at the same geometry then share a single
+ * build.  The cached matrices are shared: callers copy before modifying.
+ * Only the last max_entries geometries are kept.
+ */
+struct AO_OneElectron_Ints
+{
+    SharedMatrix overlap;
+    SharedMatrix kinetic;
+    SharedMatrix potential;
+    SharedMatrix S_half;                // S^{-1/2}, symmetric orthogonaliser
+    std::vector<SharedMatrix> dipole;   // x, y, z about the coordinate origin
+};
+
+// basis name and size with the bit-exact charges and coordinates, as a cache key
+std::string Geometry_Key(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule);
+
+// 64-bit FNV-1a hash of a key, for the file headers
+uint64_t Key_Fingerprint(const std::string& key);
+
+std::shared_ptr<const AO_OneElectron_Ints> Cached_OneElectron_Ints(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule);
+
+// Cartesian multipoles up to order about origin, in the ao_multipoles order; like the
+// one-electron set, the pointer keeps the integrals alive after the cache evicts them
+std::shared_ptr<const std::vector<SharedMatrix>> Cached_Multipole_Ints(std::shared_ptr<BasisSet> basis, std::shared_ptr<Molecule> molecule, int order, const Vector3& origin);
+
+}} // End namespaces
+
+#endif
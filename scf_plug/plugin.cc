@@ -1,6 +1,7 @@
 #include "psi4/psi4-dec.h"
 #include "psi4/libpsi4util/PsiOutStream.h"
 #include "psi4/libpsi4util/process.h"
+#include "psi4/libpsi4util/exception.h"
 #include "psi4/liboptions/liboptions.h"
 #include "psi4/libmints/wavefunction.h"
 #include "psi4/libmints/molecule.h"
@@ -13,17 +14,29 @@
 #include "psi4/libpsio/psio.hpp"
 #include "psi4/libiwl/iwl.hpp"
 #include "backtransform_tpdm.h"
+#include "dsrgpt2_rhf.h"
+#include "dsrgpt2_so.h"
+#include "dsrgpt2_df.h"
+#include "dsrgpt2_pno.h"
+#include "dsrg_regulator.h"
+#include "zvector_solver.h"
+#include "dsrg_properties.h"
+#include "integral_cache.h"
+#include "eri_store.h"
+#include "dsrg_checkpoint.h"
+#include "dsrg_tpdm.h"
 #include <psi4/psifiles.h>
 #include <math.h>
+#include <algorithm>
+#include <limits>
 #include <iomanip>
 #include <vector>
 #include <string>
+#include <memory>
 #include <sstream>
 #include <iostream>
 #include <fstream>
 
-double e = 2.718281828;
-
 namespace psi{ namespace scf_plug {
 
 extern "C" PSI_API
@@ -35,9 +48,88 @@ int read_options(std::string name, Options& options)
         options.add_int("FROZEN_CORE", 0);
         options.add_int("FROZEN_VIRTUAL", 0);
         options.add_int("PERT_DIRECTION", 0);
+        options.add_int("SPIN_ADAPTED", 1);
         options.add_double("CVG", 0);
         options.add_double("PERT", 0);
         options.add_double("S", 0);
+        /*- Additional flow parameters s; the DSRG-PT2 energy is reported for each of them -*/
+        options.add("S_LIST", new ArrayType());
+        /*- CONV uses the exact MO integrals, DF the DF_BASIS_MP2 fitted ones and PNO
+            local pair natural orbitals on top of DF (DF and PNO are energy only) -*/
+        options.add_str("DSRG_TYPE", "CONV", "CONV DF PNO");
+        /*- Auxiliary basis for DSRG_TYPE DF and PNO -*/
+        options.add_str("DF_BASIS_MP2", "");
+        /*- Occupation threshold for keeping a pair natural orbital (0 keeps all) -*/
+        options.add_double("PNO_CUTOFF", 1.0e-8);
+        /*- Maximum number of iterations of the local PNO amplitude equations -*/
+        options.add_int("PNO_MAXITER", 50);
+        /*- Convergence of the local PNO amplitudes (largest change between iterations) -*/
+        options.add_double("PNO_CONVERGENCE", 1.0e-10);
+        /*- Truncate the active virtuals to frozen natural orbitals of the unrelaxed DSRG-PT2 density -*/
+        options.add_int("NAT_ORBS", 0);
+        /*- Keep natural orbitals with occupation above this -*/
+        options.add_double("OCC_TOLERANCE", 1.0e-6);
+        /*- If > 0, keep the natural orbitals carrying this percentage of the virtual occupation instead -*/
+        options.add_double("OCC_PERCENTAGE", 0.0);
+        /*- Add the MP2 energy of the dropped natural orbitals (full-space minus truncated-space
+            MP2) to the MP2 and DSRG-PT2 energies -*/
+        options.add_int("FNO_CORRECTION", 0);
+        /*- Skip occupied pairs whose Schwarz bound on the DSRG-PT2 (or, for the MP2 energy, the MP2)
+            pair energy is below this (0 keeps all) -*/
+        options.add_double("PAIR_CUTOFF", 0.0);
+        /*- Storage of the spin-adapted integrals and amplitudes; SINGLE halves their memory,
+            all contractions still accumulate in double -*/
+        options.add_str("PRECISION", "DOUBLE", "DOUBLE SINGLE");
+        /*- With PRECISION SINGLE, repeat the energy and dipole in double and report the difference -*/
+        options.add_int("PRECISION_CHECK", 0);
+        /*- Maximum number of Z-vector (orbital response) iterations -*/
+        options.add_int("Z_MAXITER", 100);
+        /*- Z-vector convergence on the largest change of Z between iterations -*/
+        options.add_double("Z_CONVERGENCE", 1.0e-10);
+        /*- Number of DIIS vectors for the Z-vector iterations (0 for plain Jacobi) -*/
+        options.add_int("Z_DIIS_MAX_VECS", 8);
+        /*- How far the run goes: ENERGY stops after the MP2 / DSRG-PT2 energies, DENSITY adds the
+            relaxed density and dipole.  GRADIENT (the default of AUTO when GRADIENT is set) is rejected
+            until the relaxed and energy-weighted densities of the DSRG-PT2 gradient exist -*/
+        options.add_str("STAGE", "AUTO", "AUTO ENERGY DENSITY GRADIENT");
+        /*- Density for the dipole: RELAXED solves the Z-vector equations, UNRELAXED only forms the
+            oo / vv correlation density (no orbital response), BOTH reports the two -*/
+        options.add_str("DENSITY_TYPE", "RELAXED", "RELAXED UNRELAXED BOTH");
+        /*- Highest Cartesian multipole of the analytic DSRG-PT2 properties: 1 dipole, 2 adds the
+            quadrupole, ... (0 for none) -*/
+        options.add_int("MULTIPOLE_ORDER", 1);
+        /*- Origin [x, y, z] of the multipole expansion in bohr; the coordinate origin if empty -*/
+        options.add("MULTIPOLE_ORIGIN", new ArrayType());
+        /*- Finite-field batch: field strengths (a.u.) along PERT_DIRECTION, all run in one
+            invocation with shared integrals; only the energies are computed -*/
+        options.add("PERT_LIST", new ArrayType());
+        /*- Finite-field batch: field vectors [[fx, fy, fz], ...] (a.u.), run after PERT_LIST -*/
+        options.add("PERT_FIELDS", new ArrayType());
+        /*- Maximum number of SCF iterations for each finite-field reference -*/
+        options.add_int("MAXITER", 100);
+        /*- Number of DIIS vectors for the finite-field SCF (0 for plain Roothaan iterations) -*/
+        options.add_int("DIIS_MAX_VECS", 8);
+        /*- AO two-electron integrals: MEMORY computes them in every run, MMAP writes them once to a
+            scratch file and maps it read-only, so runs at the same geometry on a node share one copy -*/
+        options.add_str("ERI_STORE", "MEMORY", "MEMORY MMAP");
+        /*- File for ERI_STORE MMAP; by default scf_plug.<fingerprint>.eri in the psi4 scratch
+            directory, named after the geometry, basis and INTS_TOLERANCE.  psi4 does not clean it
+            up: delete it by hand once the runs at that geometry are done, or set ERI_FILE_DELETE -*/
+        options.add_str("ERI_FILE", "");
+        /*- Delete the ERI_STORE MMAP file when this run finishes (runs still mapping it are not
+            affected; the next run at that geometry writes it again) -*/
+        options.add_int("ERI_FILE_DELETE", 0);
+        /*- Restart file of the density runs: orbital energies, orbitals and the Z-vector, which
+            is saved as the solve goes -*/
+        options.add_str("CHECKPOINT_FILE", "");
+        /*- Save the Z-vector to CHECKPOINT_FILE every this many iterations (0 only at the end) -*/
+        options.add_int("Z_CHECKPOINT_INTERVAL", 10);
+        /*- Start the Z-vector from CHECKPOINT_FILE: RESUME continues a killed run (same geometry,
+            basis and s), GUESS seeds a run at another s or a nearby geometry -*/
+        options.add_str("RESTART", "NONE", "NONE RESUME GUESS");
+        /*- Check the vectorised DSRG regulator kernels (AVX2, AVX-512) against the scalar exp
+            before the run and stop if they disagree -*/
+        options.add_int("REGULATOR_CHECK", 0);
     }
     return true;
 }
@@ -55,14 +147,14 @@ void FormDensityMatrix(SharedMatrix D, SharedMatrix C, int nmo, int occ)
 	}
 }
 
-void FormNewFockMatrix(SharedMatrix F, SharedMatrix H, SharedMatrix D, SharedMatrix eri, int nmo)
+void FormNewFockMatrix(SharedMatrix F, SharedMatrix H, SharedMatrix D, const AO_ERI_Store& eri, int nmo)
 {
     for(int p = 0; p < nmo; ++p){
     	for(int q = 0; q < nmo; ++q){
     		F->set(0, p, q, H->get(0, p, q));
     		for(int r = 0; r < nmo; ++r){
     			for(int s = 0; s < nmo; ++s){
-    				F->add(0, p, q, D->get(0, r, s) * ( 2.0 * eri->get(0, p * nmo + q, r * nmo + s) - eri->get(0, p * nmo + r, q * nmo + s)));
+    				F->add(0, p, q, D->get(0, r, s) * ( 2.0 * eri.get(p * nmo + q, r * nmo + s) - eri.get(p * nmo + r, q * nmo + s)));
     			}
     		}
     	}
@@ -81,14 +173,71 @@ double ElecEnergy(double Elec, SharedMatrix D, SharedMatrix H, SharedMatrix F, i
     return Elec;
 }
 
-void AO2MO_TwoElecInts(SharedMatrix eri, SharedMatrix eri_mo, SharedMatrix C, int nmo)
+// SCF for the core Hamiltonian H started from the density D (zero for the core guess);
+// F (AO basis), C and D are updated in place.  The density is extrapolated with DIIS
+// over the last diis_max_vecs Roothaan steps (see ZVector_DIIS).  Stops once the energy
+// changes by less than e_conv and the density by less than d_conv, converged is false
+// if that does not happen within maxiter iterations; returns the electronic energy.
+double Field_SCF(SharedMatrix H, SharedMatrix S, const AO_ERI_Store& eri, SharedMatrix F, SharedMatrix C, SharedMatrix D, int nmo, int doccpi, double e_conv, double d_conv, int maxiter, int diis_max_vecs, int& iternum, bool& converged)
+{
+    int dims[] = {nmo};
+    SharedMatrix evecs (new Matrix("evecs", 1, dims, dims, 0));
+    SharedVector evals (new Vector("evals", 1, dims));
+    SharedMatrix D_new = D->clone();
+    ZVector_DIIS diis(diis_max_vecs);
+
+    FormNewFockMatrix(F, H, D, eri, nmo);
+    double Elec = ElecEnergy(0.0, D, H, F, nmo);
+
+    converged = false;
+    for(iternum = 1; iternum <= maxiter; ++iternum)
+    {
+        double energy_pre = Elec;
+
+        SharedMatrix F_orth = Matrix::triplet(S, F, S, true, false, false);
+        F_orth->diagonalize(evecs, evals);
+        C->copy(Matrix::doublet(S, evecs, false, false));
+        FormDensityMatrix(D_new, C, nmo, doccpi);
+        double d_change = diis.update(D, D_new);
+        FormNewFockMatrix(F, H, D, eri, nmo);
+        Elec = ElecEnergy(Elec, D, H, F, nmo);
+
+        if(fabs(Elec - energy_pre) < e_conv && d_change < d_conv)
+        {
+            converged = true;
+            break;
+        }
+    }
+
+    // the extrapolated density need not be idempotent; finish on the one built from C
+    D->copy(D_new);
+    FormNewFockMatrix(F, H, D, eri, nmo);
+    return ElecEnergy(Elec, D, H, F, nmo);
+}
+
+// (kl|ij) over the first ntrans columns of C (all of them by default); the
+// elements with an index at or beyond ntrans are left zero
+void AO2MO_TwoElecInts(const AO_ERI_Store& eri, SharedMatrix eri_mo, SharedMatrix C, int nmo, int ntrans = -1)
 {
+    if(ntrans < 0 || ntrans > nmo)
+    {
+        ntrans = nmo;
+    }
     int dims[] = {0};
     dims[0] = nmo;
     SharedMatrix X (new Matrix("X", 1, dims, dims, 0));
-    SharedMatrix Y (new Matrix("Y", 1, dims, dims, 0));
-    SharedMatrix eri_temp = eri->clone();
+    SharedMatrix Y;
+    SharedMatrix C_t (new Matrix("C transformed", nmo, ntrans));
+    for(int p = 0; p < nmo; ++p)
+    {
+        for(int k = 0; k < ntrans; ++k)
+        {
+            C_t->set(0, p, k, C->get(0, p, k));
+        }
+    }
+    SharedMatrix eri_temp = eri_mo->clone();
                  eri_temp->zero();
+    eri_mo->zero();
 
     for(int i = 0; i < nmo; ++i)
     {
@@ -98,26 +247,25 @@ void AO2MO_TwoElecInts(SharedMatrix eri, SharedMatrix eri_mo, SharedMatrix C, in
             {
                 for(int l = 0; l <= k; ++l)
                 {
-                    X->set(0, k, l, eri->get(0, i * nmo + j, k * nmo +l));
+                    X->set(0, k, l, eri.get(i * nmo + j, k * nmo +l));
                     X->set(0, l, k, X->get(0, k, l));                 
                 }
             }
-            Y = Matrix::triplet(C, X, C, true, false, false);
-            for(int k = 0; k < nmo; ++k)
+            Y = Matrix::triplet(C_t, X, C_t, true, false, false);
+            for(int k = 0; k < ntrans; ++k)
             {
-                for(int l = 0; l < nmo; ++l)
+                for(int l = 0; l < ntrans; ++l)
                 {
                     eri_temp->set(0, k * nmo + l, i * nmo + j, Y->get(0, k, l));      
                 }
             }        
         }
     }
-    for(int k = 0; k < nmo; ++k)
+    for(int k = 0; k < ntrans; ++k)
     {
-        for(int l = 0; l < nmo; ++l)
+        for(int l = 0; l < ntrans; ++l)
         {
             X->zero();
-            Y->zero();
             for(int i = 0; i < nmo; ++i)
             {
                 for(int j = 0; j <= i; ++j)
@@ -126,10 +274,10 @@ void AO2MO_TwoElecInts(SharedMatrix eri, SharedMatrix eri_mo, SharedMatrix C, in
                     X->set(0, j, i, X->get(0, i, j));                     
                 }
             }
-            Y = Matrix::triplet(C, X, C, true, false, false);
-            for(int i = 0; i < nmo; ++i)
+            Y = Matrix::triplet(C_t, X, C_t, true, false, false);
+            for(int i = 0; i < ntrans; ++i)
             {
-                for(int j = 0; j < nmo; ++j)
+                for(int j = 0; j < ntrans; ++j)
                 {
                     eri_mo->set(0, k * nmo + l, i * nmo +j, Y->get(0, i, j));
                 }
@@ -138,172 +286,176 @@ void AO2MO_TwoElecInts(SharedMatrix eri, SharedMatrix eri_mo, SharedMatrix C, in
     }
 }
 
-void AO2MO_FockMatrix(SharedMatrix F, SharedMatrix F_MO, SharedMatrix C, int nmo)
+// (ia|jb) for the occupied columns [i0, i1) and virtual columns [a0, a1) of C, packed as
+// ovov[((i * nv + a) * no + j) * nv + b] from 0; o N^4 work instead of the N^5 full transform
+void AO2MO_OVOV(const AO_ERI_Store& eri, std::vector<double>& ovov, SharedMatrix C, int nmo, int i0, int i1, int a0, int a1)
 {
-    for(int i = 0; i < nmo; ++i)
+    int no = i1 - i0;
+    int nv = a1 - a0;
+    size_t nov = (size_t)no * nv;
+    SharedMatrix C_o (new Matrix("C occupied", nmo, no));
+    SharedMatrix C_v (new Matrix("C virtual", nmo, nv));
+    for(int p = 0; p < nmo; ++p)
     {
-        for(int j = 0; j < nmo; ++j)
-        {
-            double ints_temp = 0.0;
+        for(int i = 0; i < no; ++i) C_o->set(0, p, i, C->get(0, p, i0 + i));
+        for(int a = 0; a < nv; ++a) C_v->set(0, p, a, C->get(0, p, a0 + a));
+    }
 
-            for(int p = 0; p < nmo; ++p)
+    // (mn|jb) for every AO pair mn
+    SharedMatrix half (new Matrix("(mn|jb)", nmo * nmo, nov));
+    SharedMatrix X (new Matrix("X", nmo, nmo));
+    SharedMatrix Y;
+    for(int m = 0; m < nmo; ++m)
+    {
+        for(int n = 0; n <= m; ++n)
+        {
+            for(int r = 0; r < nmo; ++r)
             {
-                for(int q = 0; q < nmo; ++q)
+                for(int t = 0; t < nmo; ++t)
                 {
-                    ints_temp += F->get(0, p, q) * C->get(0, p, i) * C->get(0, q, j);
+                    X->set(0, r, t, eri.get(m * nmo + n, r * nmo + t));
                 }
             }
-            F_MO->set(0, i, j, ints_temp);
+            Y = Matrix::triplet(C_o, X, C_v, true, false, false);
+            for(size_t jb = 0; jb < nov; ++jb)
+            {
+                double value = Y->get(0, jb / nv, jb % nv);
+                half->set(0, m * nmo + n, jb, value);
+                half->set(0, n * nmo + m, jb, value);
+            }
         }
     }
-}
-
-double MP2_Energy_SO(SharedMatrix eri_mo, SharedMatrix F_MO, int nso, int doccpi, std::vector<double> so_ints, std::vector<double> epsilon_ijab, int frozen_c, int frozen_v)
-{
-    double Emp2 = 0.0;
-    int idx;
 
-    for(int i = frozen_c; i < 2 * doccpi; ++i)
+    ovov.assign(nov * nov, 0.0);
+    for(size_t jb = 0; jb < nov; ++jb)
     {
-        for(int j = frozen_c; j < 2 * doccpi; ++j)
+        for(int m = 0; m < nmo; ++m)
         {
-            for(int a = 2 * doccpi; a < nso - frozen_v; ++a)
+            for(int n = 0; n < nmo; ++n)
             {
-                for(int b = 2 * doccpi; b < nso - frozen_v; ++b)
-                {
-                    idx = i * nso * nso * nso + j * nso * nso + a * nso + b;
-                    Emp2 += 0.25 * so_ints[idx] * so_ints[idx] / epsilon_ijab[idx];
-                }
+                X->set(0, m, n, half->get(0, m * nmo + n, jb));
             }
         }
+        Y = Matrix::triplet(C_o, X, C_v, true, false, false);
+        for(size_t ia = 0; ia < nov; ++ia)
+        {
+            ovov[ia * nov + jb] = Y->get(0, ia / nv, ia % nv);
+        }
     }
-    return(Emp2);
 }
 
-
-/******************** TEST delete by Sep.1. ********************/
-
-double MP2_Energy_MO(SharedMatrix eri_mo, SharedMatrix F_MO, int nmo, int doccpi, std::vector<double> mo_ints_aa, std::vector<double> mo_ints_bb, std::vector<double> mo_ints_ab, std::vector<double> epsilon_ijab_aa, std::vector<double> epsilon_ijab_bb, std::vector<double> epsilon_ijab_ab, int frozen_c, int frozen_v)
+void AO2MO_FockMatrix(SharedMatrix F, SharedMatrix F_MO, SharedMatrix C, int nmo)
 {
-    double Emp2 = 0.0;
-    int idx,idx1,idx2,idx3;
-
-    for(int i = frozen_c/2; i <  doccpi; ++i)
+    for(int i = 0; i < nmo; ++i)
     {
-        for(int j = frozen_c/2; j <  doccpi; ++j)
+        for(int j = 0; j < nmo; ++j)
         {
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            double ints_temp = 0.0;
+
+            for(int p = 0; p < nmo; ++p)
             {
-                for(int b = doccpi; b < nmo - frozen_v/2; ++b)
+                for(int q = 0; q < nmo; ++q)
                 {
-                    idx = i * nmo * nmo * nmo + j * nmo * nmo + a * nmo + b;
-                    // idx1 = i * nmo * nmo * nmo + j * nmo * nmo + b * nmo + a;
-                    // idx2 = j * nmo * nmo * nmo + i * nmo * nmo + a * nmo + b;
-                    // idx3 = j * nmo * nmo * nmo + i * nmo * nmo + b * nmo + a;
-                    
-                    Emp2 += 0.25 * mo_ints_aa[idx] * mo_ints_aa[idx] / epsilon_ijab_aa[idx];
-                    Emp2 += 0.25 * mo_ints_bb[idx] * mo_ints_bb[idx] / epsilon_ijab_bb[idx];
-                    Emp2 += mo_ints_ab[idx] * mo_ints_ab[idx] / epsilon_ijab_ab[idx];
-                    // Emp2 += 0.25 * mo_ints_ab[idx1] * mo_ints_ab[idx1] / epsilon_ijab_aa[idx];
-                    // Emp2 += 0.25 * mo_ints_ab[idx2] * mo_ints_ab[idx2] / epsilon_ijab_aa[idx];
-                    // Emp2 += 0.25 * mo_ints_ab[idx3] * mo_ints_ab[idx3] / epsilon_ijab_aa[idx];
+                    ints_temp += F->get(0, p, q) * C->get(0, p, i) * C->get(0, q, j);
                 }
             }
+            F_MO->set(0, i, j, ints_temp);
         }
     }
-    return(Emp2);
 }
-/******************** TEST delete by Sep.1. ********************/
-
 
-
-double DSRG_PT2_Energy_SO(SharedMatrix eri_mo, SharedMatrix F_MO, int nso, int doccpi, std::vector<double> so_ints, std::vector<double> epsilon_ijab, double S, int frozen_c, int frozen_v)
+double MP2_Energy_MO(SharedMatrix eri_mo, SharedMatrix F_MO, int nmo, int doccpi, const std::vector<double>& mo_ints_aa, const std::vector<double>& mo_ints_bb, const std::vector<double>& mo_ints_ab, const std::vector<double>& epsilon_ijab_aa, const std::vector<double>& epsilon_ijab_bb, const std::vector<double>& epsilon_ijab_ab, int frozen_c, int frozen_v)
 {
-    double Edsrgpt2 = 0.0;
-    int idx;
+    int nact = doccpi - frozen_c/2;
+    int npair = nact * nact;
 
-    for(int i = frozen_c; i < 2 * doccpi; ++i)
+    // one partial sum per (i,j) pair, added up in pair order below so the
+    // result does not depend on the number of threads
+    std::vector<double> Emp2_ij(npair, 0.0);
+
+#pragma omp parallel for schedule(dynamic)
+    for(int ij = 0; ij < npair; ++ij)
     {
-        for(int j = frozen_c; j < 2 * doccpi; ++j)
+        int i = frozen_c/2 + ij / nact;
+        int j = frozen_c/2 + ij % nact;
+        double value = 0.0;
+
+        for(int a = doccpi; a < nmo - frozen_v/2; ++a)
         {
-            for(int a = 2 * doccpi; a < nso - frozen_v; ++a)
+            for(int b = doccpi; b < nmo - frozen_v/2; ++b)
             {
-                for(int b = 2 * doccpi; b < nso - frozen_v; ++b)
-                {
-                    idx = i * nso * nso * nso + j * nso * nso + a * nso + b;
-                    Edsrgpt2 += 0.25 * so_ints[idx] * so_ints[idx] / epsilon_ijab[idx] * (1.0 - pow(e, -2.0 * S * epsilon_ijab[idx] * epsilon_ijab[idx]));
-                }
+                size_t idx = (size_t)i * nmo * nmo * nmo + j * nmo * nmo + a * nmo + b;
+
+                value += 0.25 * mo_ints_aa[idx] * mo_ints_aa[idx] / epsilon_ijab_aa[idx];
+                value += 0.25 * mo_ints_bb[idx] * mo_ints_bb[idx] / epsilon_ijab_bb[idx];
+                value += mo_ints_ab[idx] * mo_ints_ab[idx] / epsilon_ijab_ab[idx];
             }
         }
+        Emp2_ij[ij] = value;
     }
-    return(Edsrgpt2);
-}
-
-
-
-
-
-
-
-
-/******************** TEST delete by Sep.2. ********************/
-
 
-
-double DSRG_PT2_Energy_MO(SharedMatrix eri_mo, SharedMatrix F_MO, int nmo, int doccpi, std::vector<double> mo_ints_aa, std::vector<double> mo_ints_bb, std::vector<double> mo_ints_ab, std::vector<double> epsilon_ijab_aa, std::vector<double> epsilon_ijab_bb, std::vector<double> epsilon_ijab_ab, double S, int frozen_c, int frozen_v)
+    double Emp2 = 0.0;
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        Emp2 += Emp2_ij[ij];
+    }
+    return(Emp2);
+}
+double DSRG_PT2_Energy_MO(SharedMatrix eri_mo, SharedMatrix F_MO, int nmo, int doccpi, const std::vector<double>& mo_ints_aa, const std::vector<double>& mo_ints_bb, const std::vector<double>& mo_ints_ab, const std::vector<double>& epsilon_ijab_aa, const std::vector<double>& epsilon_ijab_bb, const std::vector<double>& epsilon_ijab_ab, double S, int frozen_c, int frozen_v)
 {
-    double Edsrgpt2 = 0.0;
-    int idx, idx1, idx2, idx3;
+    int nvir = nmo - frozen_v/2 - doccpi;
+    int nact = doccpi - frozen_c/2;
+    int npair = nact * nact;
+
+    // per-pair partial sums, reduced in fixed order (see MP2_Energy_MO)
+    std::vector<double> Edsrgpt2_ij(npair, 0.0);
 
-    for(int i = frozen_c/2; i < doccpi; ++i)
+#pragma omp parallel
     {
-        for(int j = frozen_c/2; j < doccpi; ++j)
+        // 1 - e^{-2 s d^2} for one contiguous row of b
+        std::vector<double> reg_aa(nvir), reg_bb(nvir), reg_ab(nvir);
+
+#pragma omp for schedule(dynamic)
+        for(int ij = 0; ij < npair; ++ij)
         {
+            int i = frozen_c/2 + ij / nact;
+            int j = frozen_c/2 + ij % nact;
+            double value = 0.0;
+
             for(int a = doccpi; a < nmo - frozen_v/2; ++a)
             {
-                for(int b = doccpi; b < nmo - frozen_v/2; ++b)
+                size_t row = (size_t)i * nmo * nmo * nmo + j * nmo * nmo + a * nmo + doccpi;
+                DSRG_Regulators(&epsilon_ijab_aa[row], nvir, 2.0 * S, reg_aa.data(), nullptr, nullptr);
+                DSRG_Regulators(&epsilon_ijab_bb[row], nvir, 2.0 * S, reg_bb.data(), nullptr, nullptr);
+                DSRG_Regulators(&epsilon_ijab_ab[row], nvir, 2.0 * S, reg_ab.data(), nullptr, nullptr);
+
+                for(int b = 0; b < nvir; ++b)
                 {
+                    size_t idx = row + b;
 
-                    idx = i * nmo * nmo * nmo + j * nmo * nmo + a * nmo + b;
-                    idx1 = i * nmo * nmo * nmo + j * nmo * nmo + b * nmo + a;
-                    idx2 = j * nmo * nmo * nmo + i * nmo * nmo + a * nmo + b;
-                    idx3 = j * nmo * nmo * nmo + i * nmo * nmo + b * nmo + a;
-                    
-                    Edsrgpt2 += 0.25 * mo_ints_aa[idx] * mo_ints_aa[idx] / epsilon_ijab_aa[idx] * (1.0 - pow(e, -2.0 * S * epsilon_ijab_aa[idx] * epsilon_ijab_aa[idx]));
-                    Edsrgpt2 += 0.25 * mo_ints_bb[idx] * mo_ints_bb[idx] / epsilon_ijab_bb[idx] * (1.0 - pow(e, -2.0 * S * epsilon_ijab_bb[idx] * epsilon_ijab_bb[idx]));
-                    Edsrgpt2 += mo_ints_ab[idx] * mo_ints_ab[idx] / epsilon_ijab_ab[idx] * (1.0 - pow(e, -2.0 * S * epsilon_ijab_ab[idx] * epsilon_ijab_ab[idx]));
-                    // Edsrgpt2 += 0.25 * mo_ints_ab[idx1] * mo_ints_ab[idx1] / epsilon_ijab_aa[idx] * (1.0 - pow(e, -2.0 * S * epsilon_ijab_aa[idx] * epsilon_ijab_aa[idx]));
-                    // Edsrgpt2 += 0.25 * mo_ints_ab[idx2] * mo_ints_ab[idx2] / epsilon_ijab_aa[idx] * (1.0 - pow(e, -2.0 * S * epsilon_ijab_aa[idx] * epsilon_ijab_aa[idx]));
-                    // Edsrgpt2 += 0.25 * mo_ints_ab[idx3] * mo_ints_ab[idx3] / epsilon_ijab_aa[idx] * (1.0 - pow(e, -2.0 * S * epsilon_ijab_aa[idx] * epsilon_ijab_aa[idx]));
-                
+                    value += 0.25 * mo_ints_aa[idx] * mo_ints_aa[idx] / epsilon_ijab_aa[idx] * reg_aa[b];
+                    value += 0.25 * mo_ints_bb[idx] * mo_ints_bb[idx] / epsilon_ijab_bb[idx] * reg_bb[b];
+                    value += mo_ints_ab[idx] * mo_ints_ab[idx] / epsilon_ijab_ab[idx] * reg_ab[b];
                 }
             }
+            Edsrgpt2_ij[ij] = value;
         }
     }
+
+    double Edsrgpt2 = 0.0;
+    for(int ij = 0; ij < npair; ++ij)
+    {
+        Edsrgpt2 += Edsrgpt2_ij[ij];
+    }
     return(Edsrgpt2);
 }
 
 
-
-
-
-
-
 void build_AOdipole_ints(SharedWavefunction wfn, SharedMatrix Dp, int direction) 
 {
+    // all three components come from one cached integral pass
     std::shared_ptr<BasisSet> basisset = wfn->basisset();
-    std::shared_ptr<IntegralFactory> ints_fac = std::make_shared<IntegralFactory>(basisset);
-    int nbf = basisset->nbf();
-
-    std::vector<SharedMatrix> AOdipole_ints_;
-    // AOdipole_ints_.clear();
-    for (const std::string& direction : {"X", "Y", "Z"}) {
-        std::string name = "AO Dipole " + direction;
-        AOdipole_ints_.push_back(SharedMatrix(new Matrix(name, nbf, nbf)));
-    }
-    std::shared_ptr<OneBodyAOInt> aodOBI(ints_fac->ao_dipole());
-    aodOBI->compute(AOdipole_ints_);
-    Dp->copy(AOdipole_ints_[direction]);
+    Dp->copy(Cached_OneElectron_Ints(basisset, basisset->molecule())->dipole[direction]);
 }
 
 extern "C" PSI_API
@@ -333,11 +485,58 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
     size_t   nso = 2 * dims[0];
     int      frozen_c = options.get_int("FROZEN_CORE");
     int      frozen_v = options.get_int("FROZEN_VIRTUAL");
+    std::vector<double> S_list;
+    std::vector<double> Edsrg_pt2_list;
+    for (size_t n = 0; n < options["S_LIST"].size(); ++n){
+        S_list.push_back(options["S_LIST"][n].to_double());
+    }
+    ZVector_Settings zvec;
+    zvec.maxiter = options.get_int("Z_MAXITER");
+    zvec.convergence = options.get_double("Z_CONVERGENCE");
+    zvec.diis_max_vecs = options.get_int("Z_DIIS_MAX_VECS");
+    std::string stage = options.get_str("STAGE");
+    if(stage == "AUTO")
+    {
+        stage = gradient ? "GRADIENT" : "ENERGY";
+    }
+    if(stage == "GRADIENT")
+    {
+        // the TPDM alone is not a gradient: Da would also need the relaxed correlation density
+        // and the Lagrangian the DSRG-PT2 energy-weighted density
+        throw PSIEXCEPTION("STAGE GRADIENT: the DSRG-PT2 gradient is not implemented yet, use STAGE DENSITY for the relaxed density");
+    }
+    bool want_density = stage != "ENERGY";   // relaxed density, Z-vector and dipole
+    bool want_tpdm = stage == "GRADIENT";     // TPDM and the wavefunction for psi4's Deriv
+    bool want_relaxed = want_density && options.get_str("DENSITY_TYPE") != "UNRELAXED";
+    bool want_unrelaxed = want_density && options.get_str("DENSITY_TYPE") != "RELAXED";
+    std::string checkpoint_file = options.get_str("CHECKPOINT_FILE");
+    std::string restart = options.get_str("RESTART");
+    if(restart != "NONE" && checkpoint_file.empty())
+    {
+        throw PSIEXCEPTION("RESTART needs the CHECKPOINT_FILE to start from.");
+    }
+    if(options.get_int("REGULATOR_CHECK"))
+    {
+        std::vector<std::string> checked;
+        double max_dev = DSRG_Regulator_Self_Check(checked);
+        std::cout << "DSRG Regulator Self-Check:    ";
+        for(const std::string& isa : checked)
+        {
+            std::cout << isa << " ";
+        }
+        std::cout << (checked.empty() ? "(scalar only)" : "vs. scalar") << ", max deviation " << std::setprecision(3) << max_dev << std::endl;
+        if(!(max_dev <= 1.0e-13))
+        {
+            throw PSIEXCEPTION("The vectorised DSRG regulator kernel disagrees with the scalar exp.");
+        }
+    }
     std::shared_ptr<MatrixFactory> factory(new MatrixFactory);
     factory->init_with(1, dims, dims);
-    SharedMatrix overlap = mints.ao_overlap();
-    SharedMatrix kinetic = mints.ao_kinetic();
-    SharedMatrix potential = mints.ao_potential();
+    // shared with earlier calls at the same geometry and basis, not to be modified
+    std::shared_ptr<const AO_OneElectron_Ints> one_e = Cached_OneElectron_Ints(ao_basisset, ao_basisset->molecule());
+    SharedMatrix overlap = one_e->overlap;
+    SharedMatrix kinetic = one_e->kinetic;
+    SharedMatrix potential = one_e->potential;
 
     SharedMatrix F_a = ref_wfn->Fa();
     SharedMatrix F_b = ref_wfn->Fb();
@@ -349,7 +548,6 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
 
 
 
-	SharedMatrix Omega = factory->create_shared_matrix("Omega");
     SharedMatrix F (new Matrix("Fock matrix", 1, dims, dims, 0));
     SharedMatrix F_uptp (new Matrix("Unperturbed Fock matrix", 1, dims, dims, 0));
     SharedMatrix F_MO (new Matrix("Fock_MO matrix", 1, dims, dims, 0));
@@ -361,9 +559,24 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
     SharedMatrix S (new Matrix("S matrix", 1, dims, dims, 0));
     SharedMatrix H = factory->create_shared_matrix("H");
     SharedMatrix H_uptb = factory->create_shared_matrix("Unperturbed H");
-    SharedMatrix eri = mints.ao_eri();
-    SharedMatrix eri_mo = eri->clone();
-                 eri_mo->zero();
+    std::unique_ptr<AO_ERI_Store> eri;
+    if(options.get_str("ERI_STORE") == "MMAP")
+    {
+        double threshold = options.get_double("INTS_TOLERANCE");
+        std::string eri_file = options.get_str("ERI_FILE");
+        if(eri_file.empty()) eri_file = AO_ERI_Store::Default_Path(ao_basisset, threshold);
+        eri.reset(new AO_ERI_Store(eri_file, mints, ao_basisset, threshold));
+        if(options.get_int("ERI_FILE_DELETE"))
+        {
+            eri->remove_on_close(eri_file);
+        }
+        std::cout << "AO ERIs mapped from " << eri_file << std::endl;
+    }
+    else
+    {
+        eri.reset(new AO_ERI_Store(mints, ao_basisset));
+    }
+    SharedMatrix eri_mo (new Matrix("MO ERI", nmo * nmo, nmo * nmo));
     SharedMatrix Dp (new Matrix("Dipole correction matrix", 1, dims, dims, 0));
     SharedMatrix Dp_x (new Matrix("Dipole correction matrix x direction", 1, dims, dims, 0));
     SharedMatrix Dp_y (new Matrix("Dipole correction matrix y direction", 1, dims, dims, 0));
@@ -413,34 +626,137 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
     H->add(Dp);
     Dp->copy(Dp_temp);
 
-    //Create S^(-1/2) Matrix
-    Omega->zero();
-    overlap->diagonalize(evecs, evals);
+    //S^(-1/2) Matrix, cached with the overlap
+    S->copy(one_e->S_half);
 
-    for(int i = 0; i < nmo; ++i)
-    {
-    	Omega->set(0, i, i, 1.0 / sqrt(evals->get(0, i)));
+/************************ Finite-field batch ************************/
+
+    // every field shares the AO ERIs, S^-1/2 and the dipole integrals, only H changes;
+    // each SCF starts from the density of the previous field
+    std::vector<Vector3> fields;
+    for (size_t n = 0; n < options["PERT_LIST"].size(); ++n){
+        Vector3 field(0.0, 0.0, 0.0);
+        field[pert_drt] = options["PERT_LIST"][n].to_double();
+        fields.push_back(field);
+    }
+    for (size_t n = 0; n < options["PERT_FIELDS"].size(); ++n){
+        if(options["PERT_FIELDS"][n].size() != 3)
+        {
+            throw PSIEXCEPTION("PERT_FIELDS entries need three components [fx, fy, fz].");
+        }
+        fields.push_back(Vector3(options["PERT_FIELDS"][n][0].to_double(), options["PERT_FIELDS"][n][1].to_double(), options["PERT_FIELDS"][n][2].to_double()));
     }
-     
-    S = Matrix::triplet(evecs, Omega, evecs, false, false, true);
-
-    // std::ofstream s1;
-    // std::ofstream f_1;
-    // s1.open("trial_S_2.dat");
-    // f_1.open("trial_F_2.dat");
-    // for(int i=0;i<dims[0];++i){
-    //     for(int j=0;j<dims[0];++j){
-    //         s1<<std::setprecision(24)<< overlap->get(0,i,j)<< ' ';
-    //         f_1<<std::setprecision(24)<< F_a->get(0,i,j)<< ' ';
-        
-    //     }
-    //     s1<< std::endl;
-    //     f_1<< std::endl;
-    // }
-    // s1.close();
-    // f_1.close();
 
+    if(!fields.empty())
+    {
+        bool df_fields = options.get_str("DSRG_TYPE") == "DF";
+        if(want_density)
+        {
+            throw PSIEXCEPTION("PERT_LIST / PERT_FIELDS compute energies only, use STAGE ENERGY.");
+        }
+        if(!df_fields && !(options.get_str("DSRG_TYPE") == "CONV" && options.get_int("SPIN_ADAPTED") && ref_wfn->same_a_b_orbs()))
+        {
+            throw PSIEXCEPTION("PERT_LIST / PERT_FIELDS need DSRG_TYPE DF, or DSRG_TYPE CONV with a spin-adapted closed-shell reference.");
+        }
+
+        SharedMatrix Dp_xyz[3] = {Dp_x, Dp_y, Dp_z};
+        double Enuc_0 = Enuc - pert * ndip->get(0, pert_drt);
+        double e_conv = CVG > 0.0 ? CVG : 1.0e-12;
+        double d_conv = 1.0e-10;
+        int scf_maxiter = options.get_int("MAXITER");
+        int scf_diis_vecs = options.get_int("DIIS_MAX_VECS");
+
+        std::vector<double> s_all(1, S_const);
+        s_all.insert(s_all.end(), S_list.begin(), S_list.end());
+
+        SharedMatrix H_f = H_uptb->clone();
+        SharedMatrix F_f (new Matrix("Field Fock matrix", 1, dims, dims, 0));
+        SharedMatrix F_f_mo (new Matrix("Field Fock_MO matrix", 1, dims, dims, 0));
+        SharedMatrix C_f (new Matrix("Field C matrix", 1, dims, dims, 0));
+        SharedMatrix D_f (new Matrix("Field Density matrix", 1, dims, dims, 0));   // zero: core guess
+        SharedMatrix field_energies (new Matrix("DSRG-PT2 FIELD ENERGIES", fields.size(), 6));
+        SharedMatrix field_sweep;
+        if(!S_list.empty())
+        {
+            field_sweep = SharedMatrix(new Matrix("DSRG-PT2 FIELD S SWEEP", fields.size(), S_list.size()));
+        }
+
+        bool single = options.get_str("PRECISION") == "SINGLE";
+        size_t nmo4_f = df_fields ? 0 : (size_t)nmo * nmo * nmo * nmo;
+        RHF_Tensor mo_ints_f(nmo4_f, single);
+        RHF_Tensor amp_t_f(nmo4_f, single);
+
+        std::cout << "Finite-Field Batch:           " << fields.size() << " fields" << std::endl;
+        std::cout << "         fx          fy          fz  iter            E(SCF)            E(MP2)       E(DSRG-PT2)" << std::endl;
+        for(size_t n = 0; n < fields.size(); ++n)
+        {
+            H_f->copy(H_uptb);
+            double Enuc_f = Enuc_0;
+            for(int k = 0; k < 3; ++k)
+            {
+                if(fields[n][k] == 0.0) continue;
+                H_f->axpy(fields[n][k], Dp_xyz[k]);
+                Enuc_f += fields[n][k] * ndip->get(0, k);
+            }
+
+            int iter_f = 0;
+            bool converged_f = false;
+            double Escf_f = Field_SCF(H_f, S, *eri, F_f, C_f, D_f, nmo, doccpi, e_conv, d_conv, scf_maxiter, scf_diis_vecs, iter_f, converged_f) + Enuc_f;
+            if(!converged_f)
+            {
+                std::ostringstream msg;
+                msg << "The finite-field SCF did not converge in " << scf_maxiter << " iterations for the field ("
+                    << fields[n][0] << ", " << fields[n][1] << ", " << fields[n][2] << ").";
+                throw PSIEXCEPTION(msg.str());
+            }
 
+            AO2MO_FockMatrix(F_f, F_f_mo, C_f, nmo);
+            std::vector<double> epsilon_f(nmo, 0.0);
+            for (size_t p = 0; p < nmo; ++p){
+                epsilon_f[p] = F_f_mo->get(0, p, p);
+            }
+
+            double Emp2_f = 0.0;
+            std::vector<double> Edsrg_f;
+            if(df_fields)
+            {
+                SharedMatrix B_ia = Build_DF_Ints_ia(mints, ao_basisset, ref_wfn->get_basisset("DF_BASIS_MP2"), C_f, nmo, doccpi, frozen_c, frozen_v);
+                DF_DSRG_PT2_Energy_RHF(B_ia, nmo, doccpi, epsilon_f, s_all, frozen_c, frozen_v, Emp2_f, Edsrg_f);
+            }
+            else
+            {
+                AO2MO_TwoElecInts(*eri, eri_mo, C_f, nmo);
+                Build_Ints_Amps_RHF(eri_mo, nmo, doccpi, epsilon_f, mo_ints_f, amp_t_f, S_const);
+                Emp2_f = MP2_Energy_RHF(nmo, doccpi, mo_ints_f, epsilon_f, frozen_c, frozen_v);
+                Edsrg_f = DSRG_PT2_Energy_Sweep_RHF(nmo, doccpi, mo_ints_f, epsilon_f, s_all, frozen_c, frozen_v);
+            }
+
+            std::cout << std::fixed << std::setprecision(6) << std::setw(11) << fields[n][0] << " " << std::setw(11) << fields[n][1] << " " << std::setw(11) << fields[n][2]
+                      << std::setw(6) << iter_f << std::setprecision(12) << std::setw(18) << Escf_f << std::setw(18) << Escf_f + Emp2_f << std::setw(18) << Escf_f + Edsrg_f[0] << std::endl;
+            std::cout.unsetf(std::ios_base::floatfield);
+
+            for(int k = 0; k < 3; ++k)
+            {
+                field_energies->set(0, n, k, fields[n][k]);
+            }
+            field_energies->set(0, n, 3, Escf_f);
+            field_energies->set(0, n, 4, Escf_f + Emp2_f);
+            field_energies->set(0, n, 5, Escf_f + Edsrg_f[0]);
+            for(size_t m = 0; m < S_list.size(); ++m)
+            {
+                field_sweep->set(0, n, m, Escf_f + Edsrg_f[1 + m]);
+            }
+        }
+        std::cout << std::endl;
+
+        // rows: fx, fy, fz, total SCF, MP2 and DSRG-PT2 energies; the sweep holds the S_LIST totals
+        Process::environment.arrays["DSRG-PT2 FIELD ENERGIES"] = field_energies;
+        if(field_sweep)
+        {
+            Process::environment.arrays["DSRG-PT2 FIELD S SWEEP"] = field_sweep;
+        }
+        return ref_wfn;
+    }
 
     //Create original fock matrix using transformation on H
 	F = Matrix::triplet(S, H, S, true, false, false);
@@ -457,8 +773,8 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
     FormDensityMatrix(D_uptp, C_uptp, nmo, doccpi);
 
     //Create new Fock matrix
-	FormNewFockMatrix(F, H, D, eri, nmo);
-    FormNewFockMatrix(F_uptp, H_uptb, D_uptp, eri, nmo);
+	FormNewFockMatrix(F, H, D, *eri, nmo);
+    FormNewFockMatrix(F_uptp, H_uptb, D_uptp, *eri, nmo);
 
     //Calculate the energy
 	Elec = ElecEnergy(Elec, D_uptp, H_uptb, F_uptp, nmo);/*!!!!! TEST !!!! unperturbed*/
@@ -478,14 +794,14 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
         F->diagonalize(evecs, evals);
         C = Matrix::doublet(S, evecs, false, false);
         FormDensityMatrix(D, C, nmo, doccpi);
-	    FormNewFockMatrix(F, H, D, eri, nmo);
+	    FormNewFockMatrix(F, H, D, *eri, nmo);
         iternum++;
         /*********** unperturbed C *********/
         F_uptp = Matrix::triplet(S, F_uptp, S, true, false, false);
         F_uptp->diagonalize(evecs, evals);
         C_uptp = Matrix::doublet(S, evecs, false, false);
         FormDensityMatrix(D_uptp, C_uptp, nmo, doccpi);
-        FormNewFockMatrix(F_uptp, H_uptb, D_uptp, eri, nmo);
+        FormNewFockMatrix(F_uptp, H_uptb, D_uptp, *eri, nmo);
         Elec = ElecEnergy(Elec, D_uptp, H_uptb, F_uptp, nmo);
         Etot = Elec + Enuc;
     }
@@ -522,15 +838,11 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
     AO2MO_FockMatrix(F_b, F_MO_b, C_b, nmo);
 
 
-
-
-
-
-
-
 /********** Obtain the gradient or not  *************/
 
-    if(gradient)
+    // the density and gradient stages are analytic derivatives at zero field and use the
+    // unperturbed orbitals; the energy stage correlates the field-perturbed reference
+    if(want_density)
     {
         F_MO->copy(F_MO_uptp);
     }
@@ -542,1030 +854,435 @@ SharedWavefunction scf_plug(SharedWavefunction& ref_wfn, Options& options)
 
 /************************ MP2 & DSRG-PT2 (Orbital irrelevant) ver2.0 ************************/
 
-    AO2MO_TwoElecInts(eri, eri_mo, C_uptp, nmo);
-
-    // define the order of spin orbitals and store it as a vector of pairs (orbital index,spin)
-    std::vector<std::pair<size_t, int>> so_labels(nso);
-    for (size_t n = 0; n < nmo; n++) {
-        so_labels[2 * n] = std::make_pair(n, 0);     // 0 = alpha
-        so_labels[2 * n + 1] = std::make_pair(n, 1); // 1 = beta
+    // the DF and PNO energies only need B(ia,Q); the N^4 MO integrals are never formed
+    bool pno_energy = options.get_str("DSRG_TYPE") == "PNO";
+    bool df_energy = options.get_str("DSRG_TYPE") == "DF" || pno_energy;
+    if(df_energy && want_density)
+    {
+        throw PSIEXCEPTION("DSRG_TYPE DF and PNO provide energies only, the relaxed density needs DSRG_TYPE CONV.");
     }
 
-    // allocate the vector that will store the spin orbital integrals
-    size_t nso2 = nso * nso;
-    size_t nso4 = nso2 * nso2;
-    std::vector<double> so_ints(nso4, 0.0);
-    std::vector<double> amp_t(nso4, 0.0);
-    std::vector<double> amp_t_dsrg(nso4, 0.0);
-    std::vector<double> epsilon(nso, 0.0);
-    std::vector<double> epsilon_ijab(nso4, 0.0);
-
-
-    for (size_t p = 0; p < nso; ++p){
-        epsilon[p] = F_MO->get(0, p / 2, p / 2);
-    }
+    // closed-shell reference: the bb block equals aa and aa = ab - ab^T, keep only ab
+    bool closed_shell = options.get_int("SPIN_ADAPTED") && ref_wfn->same_a_b_orbs();
 
-    for (size_t i = 0; i < 2 * doccpi; ++i)
+    // with NAT_ORBS the FNOs come from the OVOV block alone and the one N^4 transform is done
+    // after the rotation
+    bool nat_orbs = options.get_int("NAT_ORBS") && closed_shell && !df_energy;
+    if(!df_energy && !nat_orbs)
     {
-        for (size_t j = 0; j < 2 * doccpi; ++j)
-        {
-            for (size_t a = 2 * doccpi; a < nso; ++a)
-            {
-                for (size_t b = 2 * doccpi; b < nso; ++b)
-                {
-                    epsilon_ijab[four_idx(i, j, a, b, nso)] = epsilon[i] + epsilon[j] - epsilon[a] - epsilon[b];
-                }
-            }
-        }
+        AO2MO_TwoElecInts(*eri, eri_mo, C_uptp, nmo);
     }
 
-
-
-    /************  TEST  delete by Sept.1. ************/
+    // correlation part of the relaxed / unrelaxed density, alpha + beta, in the orbitals C_density
+    SharedMatrix D_corr_relaxed;
+    SharedMatrix D_corr_unrelaxed;
+    SharedMatrix C_density = C_uptp;
 
     size_t nmo2 = nmo * nmo;
     size_t nmo4 = nmo2 * nmo2;
-    std::vector<double> mo_ints_aa(nmo4, 0.0);
-    std::vector<double> mo_ints_bb(nmo4, 0.0);
-    std::vector<double> mo_ints_ab(nmo4, 0.0);   // V_{abab}
 
-    std::vector<double> epsilon_a(nmo, 0.0);
-    std::vector<double> epsilon_b(nmo, 0.0);
-    std::vector<double> epsilon_ijab_aa(nmo4, 0.0);
-    std::vector<double> epsilon_ijab_bb(nmo4, 0.0);
-    std::vector<double> epsilon_ijab_ab(nmo4, 0.0);
-
-
-    for (size_t p = 0; p < nmo; ++p){
-        epsilon_a[p] = F_MO_a->get(0, p, p);
-        epsilon_b[p] = F_MO_b->get(0, p, p);
+    // pair screening from Q_i = sum_a (ia|ia); the bound uses the largest s so it covers S_LIST too
+    double pair_cutoff = options.get_double("PAIR_CUTOFF");
+    if(pair_cutoff > 0.0 && (pno_energy || !(df_energy || closed_shell)))
+    {
+        throw PSIEXCEPTION("PAIR_CUTOFF needs DSRG_TYPE DF, or DSRG_TYPE CONV with a spin-adapted closed-shell reference.");
     }
-    
 
-    for (size_t i = 0; i < doccpi; ++i)
+    // MP2 is not covered by the DSRG bound and is screened with its own mask
+    auto screen_pairs = [&](const std::vector<double>& Q_occ, const std::vector<double>& epsilon_a, std::vector<char>& pair_mask, std::vector<char>& mp2_mask)
+    {
+        pair_mask.clear();
+        mp2_mask.clear();
+        if(pair_cutoff <= 0.0) return;
+
+        double s_max = S_const;
+        for(double s_n : S_list) s_max = std::max(s_max, s_n);
+        // at s = 0 every DSRG-PT2 pair energy vanishes; leave the pairs alone
+        if(s_max <= 0.0) return;
+
+        double Ebound = Pair_Screening_RHF(doccpi, Q_occ, epsilon_a, s_max, pair_cutoff, frozen_c, pair_mask);
+        double Ebound_mp2 = Pair_Screening_RHF(doccpi, Q_occ, epsilon_a, std::numeric_limits<double>::infinity(), pair_cutoff, frozen_c, mp2_mask);
+        int nkept = std::count(pair_mask.begin(), pair_mask.end(), 1);
+        int nkept_mp2 = std::count(mp2_mask.begin(), mp2_mask.end(), 1);
+
+        std::cout << "Pair Screening:               " << nkept << " of " << pair_mask.size() << " pairs kept" << std::endl;
+        std::cout << "Discarded Pair Energy Bound:  " << std::setprecision(15) << Ebound << std::endl;
+        std::cout << "MP2 Pair Screening:           " << nkept_mp2 << " of " << mp2_mask.size() << " pairs kept" << std::endl;
+        std::cout << "Discarded MP2 Energy Bound:   " << std::setprecision(15) << Ebound_mp2 << std::endl;
+        Process::environment.globals["DSRG-PT2 PAIR SCREENING ERROR BOUND"] = Ebound;
+        Process::environment.globals["MP2 PAIR SCREENING ERROR BOUND"] = Ebound_mp2;
+    };
+
+    if(df_energy)
     {
-        for (size_t j = 0; j < doccpi; ++j)
+        std::vector<double> epsilon_a(nmo, 0.0);
+
+        for (size_t p = 0; p < nmo; ++p){
+            epsilon_a[p] = F_MO_a->get(0, p, p);
+        }
+
+        std::vector<double> s_all(1, S_const);
+        s_all.insert(s_all.end(), S_list.begin(), S_list.end());
+
+        if(pno_energy)
+        {
+            std::vector<double> Etrunc;
+            PNO_DSRG_PT2_Energy_RHF(mints, ao_basisset, ref_wfn->get_basisset("DF_BASIS_MP2"), C_uptp, nmo, doccpi, epsilon_a, s_all, options.get_double("PNO_CUTOFF"), frozen_c, frozen_v, options, Emp2, Edsrg_pt2_list, Etrunc);
+
+            std::cout << "PNO Truncation Error (est.):  " << std::setprecision(15) << Etrunc[0] << std::endl;
+            Process::environment.globals["DSRG-PT2 PNO TRUNCATION ERROR"] = Etrunc[0];
+        }
+        else
         {
-            for (size_t a = doccpi; a < nmo; ++a)
+            SharedMatrix B_ia = Build_DF_Ints_ia(mints, ao_basisset, ref_wfn->get_basisset("DF_BASIS_MP2"), C_uptp, nmo, doccpi, frozen_c, frozen_v);
+
+            int nvir = nmo - frozen_v/2 - doccpi;
+            std::vector<double> Q_occ(nmo, 0.0);
+            for(int i = frozen_c/2; i < doccpi; ++i)
             {
-                for (size_t b = doccpi; b < nmo; ++b)
+                for(int a = 0; a < nvir; ++a)
                 {
-                    epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] = epsilon_a[i] + epsilon_a[j] - epsilon_a[a] - epsilon_a[b];
-                    epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] = epsilon_b[i] + epsilon_b[j] - epsilon_b[a] - epsilon_b[b];
-                    epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] = epsilon_a[i] + epsilon_b[j] - epsilon_a[a] - epsilon_b[b];
+                    int ia = (i - frozen_c/2) * nvir + a;
+                    for(int Q = 0; Q < B_ia->ncol(); ++Q)
+                    {
+                        Q_occ[i] += B_ia->get(ia, Q) * B_ia->get(ia, Q);
+                    }
                 }
             }
-        }
-    }
-
+            std::vector<char> pair_mask, mp2_mask;
+            screen_pairs(Q_occ, epsilon_a, pair_mask, mp2_mask);
 
+            DF_DSRG_PT2_Energy_RHF(B_ia, nmo, doccpi, epsilon_a, s_all, frozen_c, frozen_v, Emp2, Edsrg_pt2_list, pair_mask, mp2_mask);
+        }
 
+        Edsrg_pt2 = Edsrg_pt2_list[0];
+        Edsrg_pt2_list.erase(Edsrg_pt2_list.begin());
+    }
+    else if(closed_shell)
+    {
+        std::vector<double> epsilon_a(nmo, 0.0);
 
+        for (size_t p = 0; p < nmo; ++p){
+            epsilon_a[p] = F_MO_a->get(0, p, p);
+        }
 
+        bool single = options.get_str("PRECISION") == "SINGLE";
+        RHF_Tensor mo_ints_ab(nmo4, single);   // V_{abab}
+        RHF_Tensor amp_t_dsrg_ab(nmo4, single);
 
-    // std::ofstream ep1;
-    // std::ofstream ep2;
-    // std::ofstream ep3;
-    // ep1.open("trial_epaa_2.dat");
-    // ep2.open("trial_epbb_2.dat");
-    // ep3.open("trial_epab_2.dat");
+        if(!nat_orbs)
+        {
+            Build_Ints_Amps_RHF(eri_mo, nmo, doccpi, epsilon_a, mo_ints_ab, amp_t_dsrg_ab, S_const);
+        }
 
-    // for (size_t i = 0; i < doccpi; ++i)
-    // {
-    //     for (size_t j = 0; j < doccpi; ++j)
-    //     {
-    //         for (size_t a = doccpi; a < nmo; ++a)
-    //         {
-    //             for (size_t b = doccpi; b < nmo; ++b)
-    //             {
-    //                 ep1<<std::setprecision(24)<< epsilon_ijab_aa[four_idx(i, j, a, b, nmo)]<< ' ';
-    //                 ep2<<std::setprecision(24)<< epsilon_ijab_bb[four_idx(i, j, a, b, nmo)]<< ' ';
-    //                 ep3<<std::setprecision(24)<< epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]<< ' ';
-    //             }
-    //         }
-    //     }   
-    // }
-    // ep1.close();
-    // ep2.close();
-    // ep3.close();
+        // frozen natural orbitals: the dropped ones are treated as frozen virtuals from here on
+        int frozen_v_corr = frozen_v;
+        double dEmp2_fno = 0.0;
+        std::vector<double> dEdsrg_fno(1 + S_list.size(), 0.0);
 
+        if(nat_orbs)
+        {
+            int nvir = nmo - frozen_v/2 - doccpi;
+            SharedMatrix D_vv (new Matrix("DSRG-PT2 unrelaxed vv density", nvir, nvir));
+            double Emp2_full;
+            {
+                std::vector<double> ovov;
+                AO2MO_OVOV(*eri, ovov, C_uptp, nmo, frozen_c/2, doccpi, doccpi, nmo - frozen_v/2);
+                Emp2_full = DSRG_PT2_Density_VV_RHF(D_vv, nmo, doccpi, ovov, epsilon_a, S_const, frozen_c, frozen_v);
+            }
 
+            SharedMatrix C_fno = C_uptp->clone();
+            int nfno = FNO_Rotate_Virtuals_RHF(D_vv, C_fno, epsilon_a, doccpi, options.get_double("OCC_TOLERANCE"), options.get_double("OCC_PERCENTAGE"));
+            frozen_v_corr = frozen_v + 2 * (nvir - nfno);
 
+            std::cout << "Frozen Natural Orbitals:      " << nfno << " of " << nvir << " active virtuals kept" << std::endl;
 
+            // energies only touch the occupied and kept virtual orbitals; the orbital response
+            // of the density couples to the dropped and frozen virtuals as well
+            AO2MO_TwoElecInts(*eri, eri_mo, C_fno, nmo, want_density ? nmo : doccpi + nfno);
+            C_density = C_fno;
+            Build_Ints_Amps_RHF(eri_mo, nmo, doccpi, epsilon_a, mo_ints_ab, amp_t_dsrg_ab, S_const);
+            AO2MO_FockMatrix(Dp_x, Dp_x_mo, C_fno, nmo);
+            AO2MO_FockMatrix(Dp_y, Dp_y_mo, C_fno, nmo);
+            AO2MO_FockMatrix(Dp_z, Dp_z_mo, C_fno, nmo);
 
+            // the MP2 energy of the dropped space, full minus truncated, is added to the MP2
+            // and to every DSRG-PT2 energy
+            if(options.get_int("FNO_CORRECTION"))
+            {
+                dEmp2_fno = Emp2_full - MP2_Energy_RHF(nmo, doccpi, mo_ints_ab, epsilon_a, frozen_c, frozen_v_corr);
+                dEdsrg_fno.assign(1 + S_list.size(), dEmp2_fno);
+                std::cout << "FNO Correction (MP2):         " << std::setprecision(15) << dEmp2_fno << std::endl;
+                Process::environment.globals["DSRG-PT2 FNO CORRECTION"] = dEmp2_fno;
+            }
+        }
 
+        // (ia|ia) = <ii|aa>
+        std::vector<double> Q_occ(nmo, 0.0);
+        for(int i = frozen_c/2; i < doccpi; ++i)
+        {
+            for(int a = doccpi; a < nmo - frozen_v_corr/2; ++a)
+            {
+                Q_occ[i] += mo_ints_ab[four_idx(i, i, a, a, nmo)];
+            }
+        }
+        std::vector<char> pair_mask, mp2_mask;
+        screen_pairs(Q_occ, epsilon_a, pair_mask, mp2_mask);
 
+        SharedMatrix Z_MP2 (new Matrix("Z MP2 matrix", 1, dims, dims, 0));
+        SharedMatrix D_MP2 (new Matrix("MP2 Dipole Density matrix", 1, dims, dims, 0));
 
+        SharedMatrix D_unrelaxed;
+        if(want_unrelaxed)
+        {
+            D_unrelaxed = SharedMatrix(new Matrix("MP2 Unrelaxed Dipole Density matrix", 1, dims, dims, 0));
+        }
 
+        if(want_density)
+        {
+            SharedMatrix Z_guess;
+            ZVector_Checkpoint z_checkpoint;
+            std::shared_ptr<DSRG_Checkpoint> checkpoint;
+            if(!checkpoint_file.empty())
+            {
+                checkpoint = std::make_shared<DSRG_Checkpoint>(Key_Fingerprint(Geometry_Key(ao_basisset, ao_basisset->molecule())), nmo, doccpi, frozen_c, frozen_v_corr, S_const);
+                if(restart != "NONE")
+                {
+                    Z_guess = Checkpoint_ZVector_Guess(checkpoint_file, restart == "RESUME", *checkpoint, nmo, C_density, overlap);
+                }
+                checkpoint->add("EPSILON", 1, nmo, [&](size_t, double*) -> const double* { return epsilon_a.data(); });
+                checkpoint->add("C", C_density);
+                checkpoint->add("Z", Z_guess ? Z_guess : Z_MP2);
+                checkpoint->write(checkpoint_file);
+                z_checkpoint.interval = options.get_int("Z_CHECKPOINT_INTERVAL");
+                z_checkpoint.save = [&](int iter, const std::vector<SharedMatrix>& Z, bool converged) { checkpoint->update_z(Z[0], iter, converged); };
+            }
 
+            DSRG_PT2_Density_RHF(D_MP2, Z_MP2, nmo, doccpi, *eri, C_density, mo_ints_ab, amp_t_dsrg_ab, epsilon_a, S_const, frozen_c, frozen_v_corr, pair_mask, zvec, want_relaxed, D_unrelaxed, Z_guess, z_checkpoint);
 
+            // spatial density, alpha + beta
+            if(want_relaxed)
+            {
+                D_corr_relaxed = D_MP2->clone();
+                D_corr_relaxed->scale(2.0);
+            }
+            if(want_unrelaxed)
+            {
+                D_corr_unrelaxed = D_unrelaxed->clone();
+                D_corr_unrelaxed->scale(2.0);
+            }
+        }
 
-    std::vector<double> amp_t_dsrg_aa(nmo4, 0.0);
-    std::vector<double> amp_t_dsrg_bb(nmo4, 0.0);
-    std::vector<double> amp_t_dsrg_ab(nmo4, 0.0);
+        if(want_tpdm)
+        {
+            Write_DSRG_PT2_TPDM_RHF(_default_psio_lib_, nmo, doccpi, amp_t_dsrg_ab, epsilon_a, S_const, frozen_c, frozen_v_corr, pair_mask);
+        }
 
+        Emp2 = MP2_Energy_RHF(nmo, doccpi, mo_ints_ab, epsilon_a, frozen_c, frozen_v_corr, mp2_mask) + dEmp2_fno;
+        Edsrg_pt2 = DSRG_PT2_Energy_RHF(nmo, doccpi, mo_ints_ab, epsilon_a, S_const, frozen_c, frozen_v_corr, pair_mask) + dEdsrg_fno[0];
+        Edsrg_pt2_list = DSRG_PT2_Energy_Sweep_RHF(nmo, doccpi, mo_ints_ab, epsilon_a, S_list, frozen_c, frozen_v_corr, pair_mask);
+        for(size_t n = 0; n < S_list.size(); ++n)
+        {
+            Edsrg_pt2_list[n] += dEdsrg_fno[1 + n];
+        }
 
-    //form the integrals <pq||rs> = <pq|rs> - <pq|sr> = (pr|qs) - (ps|qr)
-    for (size_t p = 0; p < nmo; p++) 
-    {
-        for (size_t q = 0; q < nmo; q++) 
+        if(single && options.get_int("PRECISION_CHECK"))
         {
-            for (size_t r = 0; r < nmo; r++) 
+            // same space and pairs as above, with double storage
+            RHF_Tensor mo_ints_ref(nmo4, false);
+            RHF_Tensor amp_t_ref(nmo4, false);
+            Build_Ints_Amps_RHF(eri_mo, nmo, doccpi, epsilon_a, mo_ints_ref, amp_t_ref, S_const);
+
+            SharedMatrix Z_ref (new Matrix("Z MP2 matrix", 1, dims, dims, 0));
+            SharedMatrix D_ref (new Matrix("MP2 Dipole Density matrix", 1, dims, dims, 0));
+            SharedMatrix D_ref_unrelaxed;
+            if(want_unrelaxed)
             {
-                for (size_t s = 0; s < nmo; s++) 
-                {
-                        mo_ints_aa[four_idx(p, q, r, s, nmo)] = eri_mo->get(0, p * nmo + r, q * nmo + s) - eri_mo->get(0, p * nmo + s, q * nmo + r);
+                D_ref_unrelaxed = D_ref->clone();
+            }
+            if(want_density)
+            {
+                DSRG_PT2_Density_RHF(D_ref, Z_ref, nmo, doccpi, *eri, C_density, mo_ints_ref, amp_t_ref, epsilon_a, S_const, frozen_c, frozen_v_corr, pair_mask, zvec, want_relaxed, D_ref_unrelaxed);
+            }
 
-                        mo_ints_bb[four_idx(p, q, r, s, nmo)] = eri_mo->get(0, p * nmo + r, q * nmo + s) - eri_mo->get(0, p * nmo + s, q * nmo + r);
-        
-                        mo_ints_ab[four_idx(p, q, r, s, nmo)] = eri_mo->get(0, p * nmo + r, q * nmo + s);
- 
-                    if(p < doccpi && q < doccpi && r >= doccpi && s >= doccpi)
+            double dE = Edsrg_pt2 - dEdsrg_fno[0] - DSRG_PT2_Energy_RHF(nmo, doccpi, mo_ints_ref, epsilon_a, S_const, frozen_c, frozen_v_corr, pair_mask);
+            double dmu[3] = {0.0, 0.0, 0.0};
+            if(want_density)
+            {
+                // the relaxed density if there is one, the unrelaxed one otherwise
+                SharedMatrix D_chk = want_relaxed ? D_MP2 : D_unrelaxed;
+                SharedMatrix D_chk_ref = want_relaxed ? D_ref : D_ref_unrelaxed;
+                for(int p = 0; p < nmo; ++p)
+                {
+                    for(int q = 0; q < nmo; ++q)
                     {
-                        amp_t_dsrg_aa[four_idx(p, q, r, s, nmo)] = mo_ints_aa[four_idx(p, q, r, s, nmo)] / epsilon_ijab_aa[four_idx(p, q, r, s, nmo)] * (1.0 - pow(e, -S_const * epsilon_ijab_aa[four_idx(p, q, r, s, nmo)] * epsilon_ijab_aa[four_idx(p, q, r, s, nmo)]));
-                        amp_t_dsrg_bb[four_idx(p, q, r, s, nmo)] = mo_ints_bb[four_idx(p, q, r, s, nmo)] / epsilon_ijab_bb[four_idx(p, q, r, s, nmo)] * (1.0 - pow(e, -S_const * epsilon_ijab_bb[four_idx(p, q, r, s, nmo)] * epsilon_ijab_bb[four_idx(p, q, r, s, nmo)]));
-                        amp_t_dsrg_ab[four_idx(p, q, r, s, nmo)] = mo_ints_ab[four_idx(p, q, r, s, nmo)] / epsilon_ijab_ab[four_idx(p, q, r, s, nmo)] * (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(p, q, r, s, nmo)] * epsilon_ijab_ab[four_idx(p, q, r, s, nmo)]));
+                        double dD = 2.0 * (D_chk->get(0, p, q) - D_chk_ref->get(0, p, q));
+                        dmu[0] += dD * Dp_x_mo->get(0, p, q);
+                        dmu[1] += dD * Dp_y_mo->get(0, p, q);
+                        dmu[2] += dD * Dp_z_mo->get(0, p, q);
                     }
                 }
             }
+            double dmu_norm = sqrt(dmu[0] * dmu[0] + dmu[1] * dmu[1] + dmu[2] * dmu[2]) / 0.393430307;
+
+            std::cout << "Single Precision Memory:      " << (mo_ints_ab.memory() + amp_t_dsrg_ab.memory()) / 1048576.0 << " MiB (double: " << (mo_ints_ref.memory() + amp_t_ref.memory()) / 1048576.0 << " MiB)" << std::endl;
+            std::cout << "Single Precision Energy Error:" << std::setprecision(15) << dE << std::endl;
+            Process::environment.globals["DSRG-PT2 SINGLE PRECISION ENERGY ERROR"] = dE;
+            if(want_density)
+            {
+                std::cout << "Single Precision Dipole Error:" << std::setprecision(15) << dmu_norm << " Debye" << std::endl;
+                Process::environment.globals["DSRG-PT2 SINGLE PRECISION DIPOLE ERROR"] = dmu_norm;
+            }
         }
     }
+    else
+    {
+        std::vector<double> epsilon_a(nmo, 0.0);
+        std::vector<double> epsilon_b(nmo, 0.0);
+        for (size_t p = 0; p < nmo; ++p){
+            epsilon_a[p] = F_MO_a->get(0, p, p);
+            epsilon_b[p] = F_MO_b->get(0, p, p);
+        }
 
+        std::vector<double> mo_ints_aa, mo_ints_bb, mo_ints_ab;   // <pq||rs>, <pq||rs>, <pq|rs>
+        std::vector<double> epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab;
+        std::vector<double> amp_t_dsrg_aa, amp_t_dsrg_bb, amp_t_dsrg_ab;
+        Build_Ints_Amps_SO(eri_mo, nmo, doccpi, epsilon_a, epsilon_b, mo_ints_aa, mo_ints_bb, mo_ints_ab, epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab, amp_t_dsrg_aa, amp_t_dsrg_bb, amp_t_dsrg_ab, S_const);
 
+        if(want_tpdm)
+        {
+            Write_DSRG_PT2_TPDM(_default_psio_lib_, nmo, doccpi, amp_t_dsrg_aa, amp_t_dsrg_bb, amp_t_dsrg_ab, epsilon_a, S_const, frozen_c, frozen_v);
+        }
 
+        if(want_density)
+        {
+            int dims_nso[] = {(int)nso};
+            SharedMatrix Z_MP2 (new Matrix("Z MP2 matrix", 1, dims_nso, dims_nso, 0));
+            SharedMatrix D_MP2 (new Matrix("MP2 Dipole Density matrix", 1, dims_nso, dims_nso, 0));
 
-    // std::ofstream v1;
-    // std::ofstream v2;
-    // std::ofstream v3;
-    // v1.open("trial_vaa_2.dat");
-    // v2.open("trial_vbb_2.dat");
-    // v3.open("trial_vab_2.dat");
-
-    // for (size_t p = 0; p < nmo; p++) 
-    // {
-    //     for (size_t q = 0; q < nmo; q++) 
-    //     {
-    //         for (size_t r = 0; r < nmo; r++) 
-    //         {
-    //             for (size_t s = 0; s < nmo; s++) 
-    //             {
-    //                 v1<<std::setprecision(24)<< mo_ints_aa[four_idx(p, q, r, s, nmo)]<< ' ';
-    //                 v2<<std::setprecision(24)<< mo_ints_bb[four_idx(p, q, r, s, nmo)]<< ' ';
-    //                 v3<<std::setprecision(24)<< mo_ints_ab[four_idx(p, q, r, s, nmo)]<< ' ';
-    //             }
-    //         }
-    //     }   
-    // }
-    // v1.close();
-    // v2.close();
-    // v3.close();
+            SharedMatrix D_unrelaxed;
+            if(want_unrelaxed)
+            {
+                D_unrelaxed = SharedMatrix(new Matrix("MP2 Unrelaxed Dipole Density matrix", 1, dims_nso, dims_nso, 0));
+            }
 
+            SharedMatrix Z_guess;
+            ZVector_Checkpoint z_checkpoint;
+            std::shared_ptr<DSRG_Checkpoint> checkpoint;
+            if(want_relaxed && !checkpoint_file.empty())
+            {
+                checkpoint = std::make_shared<DSRG_Checkpoint>(Key_Fingerprint(Geometry_Key(ao_basisset, ao_basisset->molecule())), nmo, doccpi, frozen_c, frozen_v, S_const);
+                if(restart != "NONE")
+                {
+                    Z_guess = Checkpoint_ZVector_Guess(checkpoint_file, restart == "RESUME", *checkpoint, nso, C_density, overlap);
+                }
+                checkpoint->add("EPSILON", 1, nmo, [&](size_t, double*) -> const double* { return epsilon_a.data(); });
+                checkpoint->add("C", C_density);
+                checkpoint->add("Z", Z_guess ? Z_guess : Z_MP2);
+                checkpoint->write(checkpoint_file);
+                z_checkpoint.interval = options.get_int("Z_CHECKPOINT_INTERVAL");
+                z_checkpoint.save = [&](int iter, const std::vector<SharedMatrix>& Z, bool converged) { checkpoint->update_z(Z[0], iter, converged); };
+            }
 
+            DSRG_PT2_Density_SO(D_MP2, Z_MP2, nmo, doccpi, *eri, C_density, mo_ints_aa, mo_ints_bb, mo_ints_ab, epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab, amp_t_dsrg_aa, amp_t_dsrg_bb, amp_t_dsrg_ab, epsilon_a, epsilon_b, S_const, frozen_c, frozen_v, zvec, want_relaxed, D_unrelaxed, Z_guess, z_checkpoint);
 
-
-
-
-
-
-
-
-
-
-
-    //form the integrals <pq||rs> = <pq|rs> - <pq|sr> = (pr|qs) - (ps|qr)
-    for (size_t p = 0; p < nso; p++) 
-    {
-        size_t p_orb = so_labels[p].first;
-        int p_spin = so_labels[p].second;
-        for (size_t q = 0; q < nso; q++) 
-        {
-            size_t q_orb = so_labels[q].first;
-            int q_spin = so_labels[q].second;
-            for (size_t r = 0; r < nso; r++) 
+            // spatial density, alpha + beta
+            if(want_relaxed)
             {
-                size_t r_orb = so_labels[r].first;
-                int r_spin = so_labels[r].second;
-                for (size_t s = 0; s < nso; s++) 
-                {
-                    size_t s_orb = so_labels[s].first;
-                    int s_spin = so_labels[s].second;
-                    double integral = 0.0;
-
-                    if ((p_spin == r_spin) and (q_spin == s_spin)) 
-                    {
-                        integral += eri_mo->get(0, p / 2 * nmo + r / 2, q / 2 * nmo + s / 2);
-                    }    
-                    if ((p_spin == s_spin) and (q_spin == r_spin)) 
-                    {
-                        integral -= eri_mo->get(0, p / 2 * nmo + s / 2, q / 2 * nmo + r / 2);
-                    }
-                    so_ints[four_idx(p, q, r, s, nso)] = integral;
-                    if(p < 2 * doccpi && q < 2 * doccpi && r >= 2 * doccpi && s >= 2 * doccpi)
-                    {
-                        amp_t[four_idx(p, q, r, s, nso)] = integral / epsilon_ijab[four_idx(p, q, r, s, nso)];
-                        amp_t_dsrg[four_idx(p, q, r, s, nso)] = integral / epsilon_ijab[four_idx(p, q, r, s, nso)] * (1.0 - pow(e, -S_const * epsilon_ijab[four_idx(p, q, r, s, nso)] * epsilon_ijab[four_idx(p, q, r, s, nso)]));
-                    }
-                }
+                D_corr_relaxed = Spin_Sum_SO(D_MP2, "MP2 Dipole Density matrix");
             }
-        }
-    }
-
-
-    int dims_nso2[] = {0};
-    dims_nso2[0] = nso;
-    // SharedMatrix D_MP2 (new Matrix("MP2 Dipole Density matrix", 1, dims_nso2, dims_nso2, 0));
-    SharedMatrix Z_MP2 (new Matrix("Z MP2 matrix", 1, dims_nso2, dims_nso2, 0));
-    SharedMatrix Z_temp (new Matrix("Z matrix temporal", 1, dims_nso2, dims_nso2, 0));
-    SharedMatrix D_MP2 (new Matrix("MP2 Dipole Density matrix", 1, dims_nso2, dims_nso2, 0));
-
-    Z_MP2->zero();
-    D_MP2->zero();
-
-
-
-
-
-    for(int i = frozen_c/2; i < doccpi; ++i)
-    {
-        for(int j = frozen_c/2; j < doccpi; ++j)
-        {
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            if(want_unrelaxed)
             {
-                for(int b = doccpi; b < nmo - frozen_v/2; ++b)
-                {
-                    double temp1 ;
-                    double temp2 ;
-                    double temp3 ;
-
-                    temp1 = -0.5 *  amp_t_dsrg_aa[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)])) + 2.0 * S_const * mo_ints_aa[four_idx(i, j, a, b, nmo)] * mo_ints_aa[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)]);
-                    temp2 = -0.5 *  amp_t_dsrg_bb[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)])) + 2.0 * S_const * mo_ints_bb[four_idx(i, j, a, b, nmo)] * mo_ints_bb[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)]);
-                    temp3 = 2.0 * ( -0.5 * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)])) + 2.0 * S_const * mo_ints_ab[four_idx(i, j, a, b, nmo)] * mo_ints_ab[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]));
-                    D_MP2->add(0, 2*i, 2*i, temp1 + temp3);
-                    D_MP2->add(0, 2*i+1, 2*i+1, temp2 + temp3);
-                    D_MP2->add(0, 2*a, 2*a, -temp1 - temp3);
-                    D_MP2->add(0, 2*a+1, 2*a+1, -temp2 - temp3);
-                }
+                D_corr_unrelaxed = Spin_Sum_SO(D_unrelaxed, "MP2 Unrelaxed Dipole Density matrix");
             }
         }
-    }
-
-
-
-
 
-    for(int m = frozen_c/2; m < doccpi; ++m)
-    {
-        for(int n = frozen_c/2; n < doccpi; ++n)
-        {
-            for(int j = frozen_c/2; j < doccpi; ++j)
-            {
-                for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-                {
-                    for(int b = doccpi; b < nmo - frozen_v/2; ++b)
-                    {
-                        if(m != n)
-                        {
-                            if(fabs(epsilon_a[m]-epsilon_a[n]) > 1e-8)
-                            {
-                                double temp1;
-                                double temp2;
-                                double temp3;
-
-                                temp1  = 1.0 / (epsilon_a[n] - epsilon_a[m]) * mo_ints_aa[four_idx(m, j, a, b, nmo)] * mo_ints_aa[four_idx(a, b, n, j, nmo)] * ((1.0 - pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)])) / epsilon_ijab_aa[four_idx(n, j, a, b, nmo)] - (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(m, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(m, j, a, b, nmo)])) / epsilon_ijab_aa[four_idx(m, j, a, b, nmo)]);
-                                temp2  = 1.0 / (epsilon_a[n] - epsilon_a[m]) * mo_ints_bb[four_idx(m, j, a, b, nmo)] * mo_ints_bb[four_idx(a, b, n, j, nmo)] * ((1.0 - pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)])) / epsilon_ijab_bb[four_idx(n, j, a, b, nmo)] - (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(m, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(m, j, a, b, nmo)])) / epsilon_ijab_bb[four_idx(m, j, a, b, nmo)]);
-                                temp3  = 2.0 / (epsilon_a[n] - epsilon_a[m]) * mo_ints_ab[four_idx(m, j, a, b, nmo)] * mo_ints_ab[four_idx(a, b, n, j, nmo)] * ((1.0 - pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)])) / epsilon_ijab_ab[four_idx(n, j, a, b, nmo)] - (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(m, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(m, j, a, b, nmo)])) / epsilon_ijab_ab[four_idx(m, j, a, b, nmo)]);
-                                Z_MP2->add(0, 2*n, 2*m, temp1 + temp3);
-                                Z_MP2->add(0, 2*n+1, 2*m+1, temp2 + temp3);
-                            }
-                            else
-                            {
-                                double temp1;
-                                double temp2;
-                                double temp3;
-
-                                temp1 = mo_ints_aa[four_idx(m, j, a, b, nmo)] * mo_ints_aa[four_idx(a, b, n, j, nmo)] * (4.0 * S_const * pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(m, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(m, j, a, b, nmo)]) - (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(m, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(m, j, a, b, nmo)])) / epsilon_ijab_aa[four_idx(m, j, a, b, nmo)] / epsilon_ijab_aa[four_idx(m, j, a, b, nmo)]);
-                                temp2 = mo_ints_bb[four_idx(m, j, a, b, nmo)] * mo_ints_bb[four_idx(a, b, n, j, nmo)] * (4.0 * S_const * pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(m, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(m, j, a, b, nmo)]) - (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(m, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(m, j, a, b, nmo)])) / epsilon_ijab_bb[four_idx(m, j, a, b, nmo)] / epsilon_ijab_bb[four_idx(m, j, a, b, nmo)]);
-                                temp3 = mo_ints_ab[four_idx(m, j, a, b, nmo)] * mo_ints_ab[four_idx(a, b, n, j, nmo)] * (4.0 * S_const * pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(m, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(m, j, a, b, nmo)]) - (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(m, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(m, j, a, b, nmo)])) / epsilon_ijab_ab[four_idx(m, j, a, b, nmo)] / epsilon_ijab_ab[four_idx(m, j, a, b, nmo)]);
-                                Z_MP2->add(0, 2*n, 2*m, temp1 + temp3);
-                                Z_MP2->add(0, 2*n+1, 2*m+1, temp2 + temp3);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-
-
-
-
-    for(int c = doccpi; c < nmo - frozen_v/2; ++c)
-    {
-        for(int d = doccpi; d < nmo - frozen_v/2; ++d)
-        {
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-            {
-                for(int i = frozen_c/2; i < doccpi; ++i)
-                {
-                    for(int j = frozen_c/2; j < doccpi; ++j)
-                    {
-                        if(c != d)
-                        {
-                            if(fabs(epsilon_a[c] - epsilon_a[d]) > 1e-8)
-                            {
-                                double temp1;
-                                double temp2;
-                                double temp3;
-
-                                temp1 = 1.0 / (epsilon_a[d] - epsilon_a[c]) * amp_t_dsrg_aa[four_idx(i, j, a, c, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, d, nmo)] * (epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, d, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, d, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)])) - epsilon_ijab_aa[four_idx(i, j, a, d, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, d, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, d, nmo)])));
-                                temp2 = 1.0 / (epsilon_a[d] - epsilon_a[c]) * amp_t_dsrg_bb[four_idx(i, j, a, c, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, d, nmo)] * (epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, d, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, d, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)])) - epsilon_ijab_bb[four_idx(i, j, a, d, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, d, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, d, nmo)])));
-                                temp3 = 2.0 / (epsilon_a[d] - epsilon_a[c]) * amp_t_dsrg_ab[four_idx(i, j, a, c, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, d, nmo)] * (epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, d, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, d, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)])) - epsilon_ijab_ab[four_idx(i, j, a, d, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, d, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, d, nmo)])));
-                                Z_MP2->add(0, 2*d, 2*c, temp1 + temp3);
-                                Z_MP2->add(0, 2*d+1, 2*c+1, temp2 + temp3);
-                            }
-                            else
-                            {
-                                double temp1;
-                                double temp2;
-                                double temp3;
-
-                                temp1 = mo_ints_aa[four_idx(i, j, a, c, nmo)] * mo_ints_aa[four_idx(i, j, a, d, nmo)] * (-4.0 * S_const * pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)]) + (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)])) / epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] / epsilon_ijab_aa[four_idx(i, j, a, c, nmo)]);
-                                temp2 = mo_ints_bb[four_idx(i, j, a, c, nmo)] * mo_ints_bb[four_idx(i, j, a, d, nmo)] * (-4.0 * S_const * pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)]) + (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)])) / epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] / epsilon_ijab_bb[four_idx(i, j, a, c, nmo)]);
-                                temp3 = 2.0 * mo_ints_ab[four_idx(i, j, a, c, nmo)] * mo_ints_ab[four_idx(i, j, a, d, nmo)] * (-4.0 * S_const * pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)]) + (1.0 - pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)])) / epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] / epsilon_ijab_ab[four_idx(i, j, a, c, nmo)]);
-                                Z_MP2->add(0, 2*d, 2*c, temp1 + temp3);
-                                Z_MP2->add(0, 2*d+1, 2*c+1, temp2 + temp3);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }  
-
-
-
-
-    for(int n = frozen_c/2; n < doccpi; ++n)
-    {
-        for(int N = 0; N < frozen_c/2; ++N)
-        {
-            double temp1;
-            double temp2;
-            double temp3;
-
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-            {
-                for(int b = doccpi; b < nmo - frozen_v/2; ++b)
-                {
-                    for(int j = frozen_c/2; j < doccpi; ++j)
-                    {
-                        temp1 = mo_ints_aa[four_idx(N, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)]));        
-                        temp2 = mo_ints_bb[four_idx(N, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)]));        
-                        temp3 = 2.0 * mo_ints_ab[four_idx(N, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)]));        
-                        Z_MP2->add(0, 2*n, 2*N, (temp1 + temp3) /(epsilon_a[n]-epsilon_a[N]));
-                        Z_MP2->add(0, 2*n+1, 2*N+1, (temp2 + temp3) /(epsilon_a[n]-epsilon_a[N]));
-                    }
-                }
-            }
-            Z_MP2->set(0, 2*N, 2*n, Z_MP2->get(0, 2*n, 2*N));
-            Z_MP2->set(0, 2*N+1, 2*n+1, Z_MP2->get(0, 2*n+1, 2*N+1));
+        Emp2 = MP2_Energy_MO(eri_mo, F_MO, nmo, doccpi, mo_ints_aa, mo_ints_bb, mo_ints_ab, epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab, frozen_c, frozen_v);
+        Edsrg_pt2 = DSRG_PT2_Energy_MO(eri_mo, F_MO, nmo, doccpi, mo_ints_aa, mo_ints_bb, mo_ints_ab, epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab, S_const, frozen_c, frozen_v);
+        for (double s_n : S_list){
+            Edsrg_pt2_list.push_back(DSRG_PT2_Energy_MO(eri_mo, F_MO, nmo, doccpi, mo_ints_aa, mo_ints_bb, mo_ints_ab, epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab, s_n, frozen_c, frozen_v));
         }
     }
 
+    char drt[3];
+    drt[0]='X';
+    drt[1]='Y';  
+    drt[2]='Z';      
 
- 
-    for(int d = doccpi; d < nmo - frozen_v/2; ++d)
-    {
-        for(int D = nmo - frozen_v/2; D < nmo; ++D)
-        {
-            double temp1;
-            double temp2;
-            double temp3;
-
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-            {
-                for(int i = frozen_c/2; i < doccpi; ++i)
-                {
-                    for(int j = frozen_c/2; j < doccpi; ++j)
-                    {
-                        temp1 = mo_ints_aa[four_idx(i, j, a, D, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, d, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, d, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, d, nmo)]));        
-                        temp2 = mo_ints_bb[four_idx(i, j, a, D, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, d, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, d, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, d, nmo)]));        
-                        temp3 = 2.0 * mo_ints_ab[four_idx(i, j, a, D, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, d, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, d, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, d, nmo)]));        
-                        Z_MP2->add(0, 2*d, 2*D, (temp1 + temp3) / (epsilon_a[d] - epsilon_a[D]));
-                        Z_MP2->add(0, 2*d+1, 2*D+1, (temp2 + temp3) / (epsilon_a[d] - epsilon_a[D]));
-                    }
-                }
-            }        
-            Z_MP2->set(0, 2*D, 2*d, Z_MP2->get(0, 2*d, 2*D));
-            Z_MP2->set(0, 2*D+1, 2*d+1, Z_MP2->get(0, 2*d+1, 2*D+1));
-        }
-    } 
-
-
-
-
-    Z_temp->copy(Z_MP2);
-
-
-
-
-
-
-
-
-
-    std::vector<double> Xi_a(nmo, 0.0);
-    std::vector<double> Xi_b(nmo, 0.0);
-    std::vector<double> Xa_a(nmo, 0.0);
-    std::vector<double> Xa_b(nmo, 0.0);
-    std::vector<double> Yi_a(nmo, 0.0);
-    std::vector<double> Yi_b(nmo, 0.0);
-    std::vector<double> Ya_a(nmo, 0.0);
-    std::vector<double> Ya_b(nmo, 0.0);
-
-    for(int i = frozen_c/2; i < doccpi; ++i)
-    {
-        for(int j = frozen_c/2; j < doccpi; ++j)
-        {
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-            {
-                for(int b = doccpi; b < nmo - frozen_v/2; ++b)
-                {
-                    Xi_a[i] += amp_t_dsrg_aa[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)]));
-                    Xi_a[i] += 2.0 * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]));
-                    Xi_b[i] += amp_t_dsrg_bb[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)]));
-                    Xi_b[i] += 2.0 * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]));
-                    Xa_a[a] += amp_t_dsrg_aa[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)]));
-                    Xa_a[a] += 2.0 * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]));
-                    Xa_b[a] += amp_t_dsrg_bb[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)]));
-                    Xa_b[a] += 2.0 * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)])) / (1.0 - pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]));   
-                    
-                    Yi_a[i] += mo_ints_aa[four_idx(i, j, a, b, nmo)] * mo_ints_aa[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)]);
-                    Yi_a[i] += 2.0 * mo_ints_ab[four_idx(i, j, a, b, nmo)] * mo_ints_ab[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]);
-                    Yi_b[i] += mo_ints_bb[four_idx(i, j, a, b, nmo)] * mo_ints_bb[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)]);
-                    Yi_b[i] += 2.0 * mo_ints_ab[four_idx(i, j, a, b, nmo)] * mo_ints_ab[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]);
-                    Ya_a[a] += mo_ints_aa[four_idx(i, j, a, b, nmo)] * mo_ints_aa[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, b, nmo)]);
-                    Ya_a[a] += 2.0 * mo_ints_ab[four_idx(i, j, a, b, nmo)] * mo_ints_ab[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]);
-                    Ya_b[a] += mo_ints_bb[four_idx(i, j, a, b, nmo)] * mo_ints_bb[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, b, nmo)]);
-                    Ya_b[a] += 2.0 * mo_ints_ab[four_idx(i, j, a, b, nmo)] * mo_ints_ab[four_idx(i, j, a, b, nmo)] * pow(e, -2.0 * S_const * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, b, nmo)]);                   
-                }
-            }
-        }
-    }
-
-for( int times = 0; times < 100; ++times)
-{
-    /***********        Z {nc} {cn} (DONE)         ***********/
-    for(int c = doccpi; c < nmo - frozen_v/2; ++c)
+    //Output
+    std::cout << "Perturbation Direction:       "<< drt[pert_drt] << std::endl;
+    std::cout << "DSRG Regulator Kernel:        "<< DSRG_Regulator_ISA() << std::endl;
+	std::cout << "Energy Precision(SCF Iter):   "<< std::setprecision(15) << CVG << std::endl << std::endl;
+	// std::cout << "Iteration times:              "<< iternum << std::endl;
+    std::cout << "Nuclear Repulsion Energy:     "<< std::setprecision(15) << Enuc << std::endl;
+    std::cout << "Electronic Energy:            "<< std::setprecision(15) << Elec << std::endl;
+    std::cout << "SCF Energy:                   "<< std::setprecision(15) << Escf << std::endl;
+    std::cout << "MP2 Energy:                   "<< std::setprecision(15) << Emp2 << std::endl;
+    std::cout << "Total Energy(MP2):            "<< std::setprecision(15) << Escf + Emp2 << std::endl;
+    std::cout << "DSRG-PT2 Energy:              "<< std::setprecision(15) << Edsrg_pt2 << std::endl;
+    std::cout << "Total Energy(DSRG-PT2):       "<< std::setprecision(15) << Escf + Edsrg_pt2 << std::endl << std::endl;
+    if(!S_list.empty())
     {
-        for(int n = frozen_c/2; n < doccpi; ++n)
+        std::cout << "DSRG-PT2 Energy vs. s:" << std::endl;
+        SharedMatrix s_sweep (new Matrix("DSRG-PT2 S SWEEP", S_list.size(), 2));
+        for(size_t n = 0; n < S_list.size(); ++n)
         {
-            double T1_temp1 = 0.0, T1_temp2 = 0.0, T1_temp3 = 0.0;
-            double T2_temp1 = 0.0, T2_temp2 = 0.0, T2_temp3 = 0.0;
-            double T3_temp1 = 0.0, T3_temp2 = 0.0, T3_temp3 = 0.0;
-            double T4_temp1 = 0.0, T4_temp2 = 0.0;
-            double T5_temp1 = 0.0, T5_temp2 = 0.0; 
-
-            for(int j = frozen_c/2; j < doccpi; ++j)
-            {
-                for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-                {
-                    for(int b = doccpi; b < nmo - frozen_v/2; ++b)
-                    {
-                        T1_temp1 += mo_ints_aa[four_idx(c, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)])); 
-                        T1_temp2 += mo_ints_bb[four_idx(c, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)])); 
-                        T1_temp3 += 2.0 * mo_ints_ab[four_idx(c, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)])); 
-                    }
-                }
-            }
-
-            for(int i = frozen_c/2; i < doccpi; ++i)
-            {
-                for(int j = frozen_c/2; j < doccpi; ++j)
-                {
-                    for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-                    {
-                        T2_temp1 -= mo_ints_aa[four_idx(i, j, a, n, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)])); 
-                        T2_temp2 -= mo_ints_bb[four_idx(i, j, a, n, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)])); 
-                        T2_temp3 -= 2.0 * mo_ints_ab[four_idx(i, j, a, n, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)])); 
-                    }
-                }
-            }
-
-
-            for(int i = frozen_c/2; i < doccpi; ++i)
-            {
-                T4_temp1 -= mo_ints_aa[four_idx(i, c, i, n, nmo)] * Xi_a[i];
-                T4_temp1 -= mo_ints_ab[four_idx(i, c, i, n, nmo)] * Xi_b[i];
-                T4_temp2 -= mo_ints_bb[four_idx(i, c, i, n, nmo)] * Xi_b[i];
-                T4_temp2 -= mo_ints_ab[four_idx(i, c, i, n, nmo)] * Xi_a[i];
-
-                T5_temp1 += 4.0 * S_const * mo_ints_aa[four_idx(i, c, i, n, nmo)] * Yi_a[i];
-                T5_temp1 += 4.0 * S_const * mo_ints_ab[four_idx(i, c, i, n, nmo)] * Yi_b[i];
-                T5_temp2 += 4.0 * S_const * mo_ints_bb[four_idx(i, c, i, n, nmo)] * Yi_b[i];
-                T5_temp2 += 4.0 * S_const * mo_ints_ab[four_idx(i, c, i, n, nmo)] * Yi_a[i];
-            }
-
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-            {
-                T4_temp1 += mo_ints_aa[four_idx(a, c, a, n, nmo)] * Xa_a[a];
-                T4_temp1 += mo_ints_ab[four_idx(a, c, a, n, nmo)] * Xa_b[a];
-                T4_temp2 += mo_ints_bb[four_idx(a, c, a, n, nmo)] * Xa_b[a];
-                T4_temp2 += mo_ints_ab[four_idx(a, c, a, n, nmo)] * Xa_a[a];
-
-                T5_temp1 -= 4.0 * S_const * mo_ints_aa[four_idx(a, c, a, n, nmo)] * Ya_a[a];
-                T5_temp1 -= 4.0 * S_const * mo_ints_ab[four_idx(a, c, a, n, nmo)] * Ya_b[a];
-                T5_temp2 -= 4.0 * S_const * mo_ints_bb[four_idx(a, c, a, n, nmo)] * Ya_b[a];
-                T5_temp2 -= 4.0 * S_const * mo_ints_ab[four_idx(a, c, a, n, nmo)] * Ya_a[a];
-            }
-
-
-            for(int p = 0; p < nmo; ++p)
-            {
-                for(int q = 0; q < nmo; ++q)
-                {
-                    if (p != q)
-                    {
-                        T3_temp1 += mo_ints_aa[four_idx(p, n, q, c, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                        T3_temp1 += mo_ints_ab[four_idx(p, n, q, c, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T3_temp2 += mo_ints_bb[four_idx(p, n, q, c, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T3_temp2 += mo_ints_ab[four_idx(p, n, q, c, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                    }
-                }
-            }
-
-            Z_temp->set(0, 2*n, 2*c, (T1_temp1 + T1_temp3 + T2_temp1 + T2_temp3 + T3_temp1 + T4_temp1 + T5_temp1) / (epsilon_a[n] - epsilon_a[c]));
-            Z_temp->set(0, 2*c, 2*n, Z_temp->get(0, 2*n, 2*c));
-            Z_temp->set(0, 2*n+1, 2*c+1, (T1_temp2 + T1_temp3 + T2_temp2 + T2_temp3 + T3_temp2 + T4_temp2 + T5_temp2) / (epsilon_a[n] - epsilon_a[c]));
-            Z_temp->set(0, 2*c+1, 2*n+1, Z_temp->get(0, 2*n+1, 2*c+1));
+            std::ostringstream s_str;
+            s_str << S_list[n];
+            std::cout << "    s = " << std::setw(12) << std::left << s_str.str() << std::right << std::setprecision(15) << Edsrg_pt2_list[n] << "    " << Escf + Edsrg_pt2_list[n] << std::endl;
+            Process::environment.globals["DSRG-PT2 CORRELATION ENERGY (S=" + s_str.str() + ")"] = Edsrg_pt2_list[n];
+            Process::environment.globals["DSRG-PT2 TOTAL ENERGY (S=" + s_str.str() + ")"] = Escf + Edsrg_pt2_list[n];
+            s_sweep->set(0, n, 0, S_list[n]);
+            s_sweep->set(0, n, 1, Edsrg_pt2_list[n]);
         }
+        Process::environment.arrays["DSRG-PT2 S SWEEP"] = s_sweep;
+        std::cout << std::endl;
     }
 
-    /***********        Z {IA} {AI} (DONE)        ***********/
-    for(int I = 0; I < frozen_c/2; ++I)
+    // analytic multipoles of reference + correlation density, nuclear part included
+    int multipole_order = options.get_int("MULTIPOLE_ORDER");
+    if(want_density && multipole_order > 0)
     {
-        for(int A = nmo - frozen_v/2; A < nmo; ++A)
+        Vector3 origin(0.0, 0.0, 0.0);
+        if(options["MULTIPOLE_ORIGIN"].size() == 3)
         {
-            double T1_temp1 = 0.0, T1_temp2 = 0.0;
-            double T2_temp1 = 0.0, T2_temp2 = 0.0;
-            double T3_temp1 = 0.0, T3_temp2 = 0.0;
-
-            for(int p = 0; p < nmo; ++p)
-            {
-                for(int q = 0; q < nmo; ++q)
-                {
-                    if (p != q)
-                    {
-                        T1_temp1 += mo_ints_aa[four_idx(p, A, q, I, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                        T1_temp1 += mo_ints_ab[four_idx(p, A, q, I, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T1_temp2 += mo_ints_bb[four_idx(p, A, q, I, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T1_temp2 += mo_ints_ab[four_idx(p, A, q, I, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                    }
-                }
-            }
-
-            for(int i = frozen_c/2; i < doccpi; ++i)
-            {
-                T2_temp1 -= mo_ints_aa[four_idx(i, I, i, A, nmo)] * Xi_a[i];
-                T2_temp1 -= mo_ints_ab[four_idx(i, I, i, A, nmo)] * Xi_b[i];
-                T2_temp2 -= mo_ints_bb[four_idx(i, I, i, A, nmo)] * Xi_b[i];
-                T2_temp2 -= mo_ints_ab[four_idx(i, I, i, A, nmo)] * Xi_a[i];
-
-                T3_temp1 += 4.0 * S_const * mo_ints_aa[four_idx(i, I, i, A, nmo)] * Yi_a[i];
-                T3_temp1 += 4.0 * S_const * mo_ints_ab[four_idx(i, I, i, A, nmo)] * Yi_b[i];
-                T3_temp2 += 4.0 * S_const * mo_ints_bb[four_idx(i, I, i, A, nmo)] * Yi_b[i];
-                T3_temp2 += 4.0 * S_const * mo_ints_ab[four_idx(i, I, i, A, nmo)] * Yi_a[i];
-            }
-
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
+            for(int k = 0; k < 3; ++k)
             {
-                T2_temp1 += mo_ints_aa[four_idx(a, I, a, A, nmo)] * Xa_a[a];
-                T2_temp1 += mo_ints_ab[four_idx(a, I, a, A, nmo)] * Xa_b[a];
-                T2_temp2 += mo_ints_bb[four_idx(a, I, a, A, nmo)] * Xa_b[a];
-                T2_temp2 += mo_ints_ab[four_idx(a, I, a, A, nmo)] * Xa_a[a];
-
-                T3_temp1 -= 4.0 * S_const * mo_ints_aa[four_idx(a, I, a, A, nmo)] * Ya_a[a];
-                T3_temp1 -= 4.0 * S_const * mo_ints_ab[four_idx(a, I, a, A, nmo)] * Ya_b[a];
-                T3_temp2 -= 4.0 * S_const * mo_ints_bb[four_idx(a, I, a, A, nmo)] * Ya_b[a];
-                T3_temp2 -= 4.0 * S_const * mo_ints_ab[four_idx(a, I, a, A, nmo)] * Ya_a[a];
+                origin[k] = options["MULTIPOLE_ORIGIN"][k].to_double();
             }
-
-            Z_temp->set(0, 2*I, 2*A, (T1_temp1 + T2_temp1 + T3_temp1) / (epsilon_a[I] - epsilon_a[A]));
-            Z_temp->set(0, 2*A, 2*I, Z_temp->get(0, 2*I, 2*A));
-            Z_temp->set(0, 2*I+1, 2*A+1, (T1_temp2 + T2_temp2 + T3_temp2) / (epsilon_a[I] - epsilon_a[A]));
-            Z_temp->set(0, 2*A+1, 2*I+1, Z_temp->get(0, 2*I+1, 2*A+1));
         }
-    }        
-
-    /***********        Z {cN} {Nc} (DONE)        ***********/
-    for(int c = doccpi ; c < nmo - frozen_v/2; ++c)
-    {
-        for(int N = 0; N < frozen_c/2; ++N)
+        else if(options["MULTIPOLE_ORIGIN"].size() != 0)
         {
-            double T1_temp1 = 0.0, T1_temp2 = 0.0;
-            double T2_temp1 = 0.0, T2_temp2 = 0.0;
-            double T3_temp1 = 0.0, T3_temp2 = 0.0;
-            double T4_temp1 = 0.0, T4_temp2 = 0.0, T4_temp3 = 0.0;
-
-            for(int p = 0; p < nmo; ++p)
-            {
-                for(int q = 0; q < nmo; ++q)
-                {
-                    if (p != q)
-                    {
-                        T1_temp1 += mo_ints_aa[four_idx(p, c, q, N, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                        T1_temp1 += mo_ints_ab[four_idx(p, c, q, N, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T1_temp2 += mo_ints_bb[four_idx(p, c, q, N, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T1_temp2 += mo_ints_ab[four_idx(p, c, q, N, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                    }
-                }
-            }
-
-            for(int i = frozen_c/2; i < doccpi; ++i)
-            {
-                T2_temp1 -= mo_ints_aa[four_idx(i, N, i, c, nmo)] * Xi_a[i];
-                T2_temp1 -= mo_ints_ab[four_idx(i, N, i, c, nmo)] * Xi_b[i];
-                T2_temp2 -= mo_ints_bb[four_idx(i, N, i, c, nmo)] * Xi_b[i];
-                T2_temp2 -= mo_ints_ab[four_idx(i, N, i, c, nmo)] * Xi_a[i];
-
-                T3_temp1 += 4.0 * S_const * mo_ints_aa[four_idx(i, N, i, c, nmo)] * Yi_a[i];
-                T3_temp1 += 4.0 * S_const * mo_ints_ab[four_idx(i, N, i, c, nmo)] * Yi_b[i];
-                T3_temp2 += 4.0 * S_const * mo_ints_bb[four_idx(i, N, i, c, nmo)] * Yi_b[i];
-                T3_temp2 += 4.0 * S_const * mo_ints_ab[four_idx(i, N, i, c, nmo)] * Yi_a[i];
-            }
-
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-            {
-                T2_temp1 += mo_ints_aa[four_idx(a, N, a, c, nmo)] * Xa_a[a];
-                T2_temp1 += mo_ints_ab[four_idx(a, N, a, c, nmo)] * Xa_b[a];
-                T2_temp2 += mo_ints_bb[four_idx(a, N, a, c, nmo)] * Xa_b[a];
-                T2_temp2 += mo_ints_ab[four_idx(a, N, a, c, nmo)] * Xa_a[a];
-
-                T3_temp1 -= 4.0 * S_const * mo_ints_aa[four_idx(a, N, a, c, nmo)] * Ya_a[a];
-                T3_temp1 -= 4.0 * S_const * mo_ints_ab[four_idx(a, N, a, c, nmo)] * Ya_b[a];
-                T3_temp2 -= 4.0 * S_const * mo_ints_bb[four_idx(a, N, a, c, nmo)] * Ya_b[a];
-                T3_temp2 -= 4.0 * S_const * mo_ints_ab[four_idx(a, N, a, c, nmo)] * Ya_a[a];
-            }
-
-            for(int i = frozen_c/2; i < doccpi; ++i)
-            {
-                for(int j = frozen_c/2; j < doccpi; ++j)
-                {
-                    for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-                    {
-                        T4_temp1 -= mo_ints_aa[four_idx(i, j, a, N, nmo)] * amp_t_dsrg_aa[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)] * epsilon_ijab_aa[four_idx(i, j, a, c, nmo)])); 
-                        T4_temp2 -= mo_ints_bb[four_idx(i, j, a, N, nmo)] * amp_t_dsrg_bb[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)] * epsilon_ijab_bb[four_idx(i, j, a, c, nmo)])); 
-                        T4_temp3 -= 2.0 * mo_ints_ab[four_idx(i, j, a, N, nmo)] * amp_t_dsrg_ab[four_idx(i, j, a, c, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)] * epsilon_ijab_ab[four_idx(i, j, a, c, nmo)])); 
-                    }
-                }
-            }
-
-            Z_temp->set(0, 2*N, 2*c, (T1_temp1 + T2_temp1 + T3_temp1 + T4_temp1 + T4_temp3) / (epsilon_a[N] - epsilon_a[c]));
-            Z_temp->set(0, 2*c, 2*N, Z_temp->get(0, 2*N, 2*c));
-            Z_temp->set(0, 2*N+1, 2*c+1, (T1_temp2 + T2_temp2 + T3_temp2 + T4_temp2 + T4_temp3) / (epsilon_a[N] - epsilon_a[c]));
-            Z_temp->set(0, 2*c+1, 2*N+1, Z_temp->get(0, 2*N+1, 2*c+1));
+            throw PSIEXCEPTION("MULTIPOLE_ORIGIN needs three coordinates [x, y, z].");
         }
-    }   
+        Multipole_Properties multipoles(ao_basisset, molecule, multipole_order, origin);
 
-    /***********        Z {Cn} {nC}         ***********/
-    for(int C = nmo - frozen_v/2; C < nmo; ++C)
-    {
-        for(int n = frozen_c/2; n < doccpi; ++n)
+        SharedMatrix D_scf (new Matrix("SCF MO density", 1, dims, dims, 0));
+        for(int i = 0; i < doccpi; ++i)
         {
-            double T1_temp1 = 0.0, T1_temp2 = 0.0;
-            double T2_temp1 = 0.0, T2_temp2 = 0.0;
-            double T3_temp1 = 0.0, T3_temp2 = 0.0;
-            double T4_temp1 = 0.0, T4_temp2 = 0.0, T4_temp3 = 0.0;
-
-            for(int p = 0; p < nmo; ++p)
-            {
-                for(int q = 0; q < nmo; ++q)
-                {
-                    if (p != q)
-                    {
-                        T1_temp1 += mo_ints_aa[four_idx(p, n, q, C, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                        T1_temp1 += mo_ints_ab[four_idx(p, n, q, C, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T1_temp2 += mo_ints_bb[four_idx(p, n, q, C, nmo)] * Z_MP2->get(0, 2*q+1, 2*p+1);
-                        T1_temp2 += mo_ints_ab[four_idx(p, n, q, C, nmo)] * Z_MP2->get(0, 2*q, 2*p);
-                    }
-                }
-            }
-
-            for(int i = frozen_c/2; i < doccpi; ++i)
-            {
-                T2_temp1 -= mo_ints_aa[four_idx(i, n, i, C, nmo)] * Xi_a[i];
-                T2_temp1 -= mo_ints_ab[four_idx(i, n, i, C, nmo)] * Xi_b[i];
-                T2_temp2 -= mo_ints_bb[four_idx(i, n, i, C, nmo)] * Xi_b[i];
-                T2_temp2 -= mo_ints_ab[four_idx(i, n, i, C, nmo)] * Xi_a[i];
-
-                T3_temp1 += 4.0 * S_const * mo_ints_aa[four_idx(i, n, i, C, nmo)] * Yi_a[i];
-                T3_temp1 += 4.0 * S_const * mo_ints_ab[four_idx(i, n, i, C, nmo)] * Yi_b[i];
-                T3_temp2 += 4.0 * S_const * mo_ints_bb[four_idx(i, n, i, C, nmo)] * Yi_b[i];
-                T3_temp2 += 4.0 * S_const * mo_ints_ab[four_idx(i, n, i, C, nmo)] * Yi_a[i];
-            }
-
-            for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-            {
-                T2_temp1 += mo_ints_aa[four_idx(a, n, a, C, nmo)] * Xa_a[a];
-                T2_temp1 += mo_ints_ab[four_idx(a, n, a, C, nmo)] * Xa_b[a];
-                T2_temp2 += mo_ints_bb[four_idx(a, n, a, C, nmo)] * Xa_b[a];
-                T2_temp2 += mo_ints_ab[four_idx(a, n, a, C, nmo)] * Xa_a[a];
-
-                T3_temp1 -= 4.0 * S_const * mo_ints_aa[four_idx(a, n, a, C, nmo)] * Ya_a[a];
-                T3_temp1 -= 4.0 * S_const * mo_ints_ab[four_idx(a, n, a, C, nmo)] * Ya_b[a];
-                T3_temp2 -= 4.0 * S_const * mo_ints_bb[four_idx(a, n, a, C, nmo)] * Ya_b[a];
-                T3_temp2 -= 4.0 * S_const * mo_ints_ab[four_idx(a, n, a, C, nmo)] * Ya_a[a];
-            }
-
-            for(int j = frozen_c/2; j < doccpi; ++j)
-            {
-                for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-                {
-                    for(int b = doccpi; b < nmo - frozen_v/2; ++b)
-                    {
-                        T4_temp1 += mo_ints_aa[four_idx(C, j, a, b, nmo)] * amp_t_dsrg_aa[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)] * epsilon_ijab_aa[four_idx(n, j, a, b, nmo)])); 
-                        T4_temp2 += mo_ints_bb[four_idx(C, j, a, b, nmo)] * amp_t_dsrg_bb[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)] * epsilon_ijab_bb[four_idx(n, j, a, b, nmo)])); 
-                        T4_temp3 += 2.0 * mo_ints_ab[four_idx(C, j, a, b, nmo)] * amp_t_dsrg_ab[four_idx(n, j, a, b, nmo)] * (1.0 + pow(e, -S_const * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)] * epsilon_ijab_ab[four_idx(n, j, a, b, nmo)])); 
-                    }
-                }
-            }
-
-            Z_temp->set(0, 2*n, 2*C, (T1_temp1 + T2_temp1 + T3_temp1 + T4_temp1 + T4_temp3) / ( epsilon_a[n] - epsilon_a[C] ));
-            Z_temp->set(0, 2*C, 2*n, Z_temp->get(0, 2*n, 2*C));
-            Z_temp->set(0, 2*n+1, 2*C+1, (T1_temp2 + T2_temp2 + T3_temp2 + T4_temp2 + T4_temp3) / ( epsilon_a[n] - epsilon_a[C] ));
-            Z_temp->set(0, 2*C+1, 2*n+1, Z_temp->get(0, 2*n+1, 2*C+1));
+            D_scf->set(0, i, i, 2.0);
         }
-    }  
-    Z_MP2->copy(Z_temp);
-}
-
-
-
-    for(int p = 0; p < nso; ++p)
-    {
-        for(int q = 0; q < nso; ++q)
+        if(want_relaxed)
         {
-            if(p!=q) 
-            {
-                D_MP2->set(0, p, q, 0.5 * Z_MP2->get(0, p, q));
-            }
+            SharedMatrix D_total = D_scf->clone();
+            D_total->add(D_corr_relaxed);
+            multipoles.report("DSRG-PT2", multipoles.compute(C_density, D_total));
         }
-    }
-
-
-
-    double dipole_MP2_x = 0.0;
-    double dipole_MP2_y = 0.0;
-    double dipole_MP2_z = 0.0;
-
-    for(int p = 0; p < nso; ++p)
-    {
-        for(int q = 0; q < nso; ++q)
+        if(want_unrelaxed)
         {
-            dipole_MP2_x += D_MP2->get(0, p, q) * Dp_x_mo->get(0, p / 2, q / 2);
-            dipole_MP2_y += D_MP2->get(0, p, q) * Dp_y_mo->get(0, p / 2, q / 2);
-            dipole_MP2_z += D_MP2->get(0, p, q) * Dp_z_mo->get(0, p / 2, q / 2);
+            SharedMatrix D_total = D_scf->clone();
+            D_total->add(D_corr_unrelaxed);
+            multipoles.report("DSRG-PT2 UNRELAXED", multipoles.compute(C_density, D_total));
         }
     }
-
-    // Emp2 = MP2_Energy_SO(eri_mo, F_MO, nso, doccpi, so_ints, epsilon_ijab, frozen_c, frozen_v );
-    // Edsrg_pt2 = DSRG_PT2_Energy_SO(eri_mo, F_MO, nso, doccpi, so_ints, epsilon_ijab, S_const, frozen_c, frozen_v );
-
-    /****** test ********/
-
-    Emp2 = MP2_Energy_MO(eri_mo, F_MO, nmo, doccpi, mo_ints_aa, mo_ints_bb, mo_ints_ab, epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab, frozen_c, frozen_v);
-    Edsrg_pt2 = DSRG_PT2_Energy_MO(eri_mo, F_MO, nmo, doccpi, mo_ints_aa, mo_ints_bb, mo_ints_ab, epsilon_ijab_aa, epsilon_ijab_bb, epsilon_ijab_ab, S_const, frozen_c, frozen_v);
-
-
-    /****** test ********/
-    char drt[3];
-    drt[0]='X';
-    drt[1]='Y';  
-    drt[2]='Z';      
-
-    //Output
-    std::cout << "Perturbation Direction:       "<< drt[pert_drt] << std::endl;
-	std::cout << "Energy Precision(SCF Iter):   "<< std::setprecision(15) << CVG << std::endl << std::endl;
-	// std::cout << "Iteration times:              "<< iternum << std::endl;
-    std::cout << "Nuclear Repulsion Energy:     "<< std::setprecision(15) << Enuc << std::endl;
-    std::cout << "Electronic Energy:            "<< std::setprecision(15) << Elec << std::endl;
-    std::cout << "SCF Energy:                   "<< std::setprecision(15) << Escf << std::endl;
-    std::cout << "MP2 Energy:                   "<< std::setprecision(15) << Emp2 << std::endl;
-    std::cout << "Total Energy(MP2):            "<< std::setprecision(15) << Escf + Emp2 << std::endl;
-    std::cout << "DSRG-PT2 Energy:              "<< std::setprecision(15) << Edsrg_pt2 << std::endl;
-    std::cout << "Total Energy(DSRG-PT2):       "<< std::setprecision(15) << Escf + Edsrg_pt2 << std::endl << std::endl;
-    if(gradient)
-    {
-        double debye = 0.393430307;
-        std::cout << "DSRG Dipole Moment_x(Debye):         "<< std::setprecision(15) << dipole_MP2_x/debye << std::endl;
-        std::cout << "DSRG Dipole Moment_y:                "<< std::setprecision(15) << dipole_MP2_y/debye << std::endl;
-        std::cout << "DSRG Dipole Moment_z:                "<< std::setprecision(15) << dipole_MP2_z/debye +1.6594 << std::endl;
-        std::cout << "DSRG Total Dipole Moment:            "<< std::setprecision(15) << sqrt(dipole_MP2_x*dipole_MP2_x+dipole_MP2_y*dipole_MP2_y+(dipole_MP2_z+1.6594*debye)*(dipole_MP2_z+1.6594*debye))/debye << std::endl;
-    }
     std::cout << std::endl;
     std::cout << std::endl << std::endl << std::endl;
 
-    for(int i = 0; i < nso; ++i)
+    // ENERGY and DENSITY runs end here, only psi4's Deriv reads the TPDM and the wavefunction below
+    if(!want_tpdm)
     {
-        std::cout << i + 1 << "    " << std::setprecision(15) << epsilon[i] << std::endl;
+        return ref_wfn;
     }
-    std::cout << "doccpi   =   " << doccpi <<" nmo   =   "<<nmo<< std::endl;
-
-
-
-
-//     std::vector<double> read_f_1(nmo2, 0.0);
-//     std::vector<double> read_f_2(nmo2, 0.0);
-//     std::vector<double> d_f(nmo2, 0.0);
-
-
-//     std::ifstream f1;
-//     std::ifstream f2;
-//     f1.open("trial_F_1.dat");
-//     f2.open("trial_F_2.dat");
-//     for(size_t i=0;i<nmo;++i){
-//         for(size_t j=0;j<nmo;++j){
-//             f1>>read_f_1[two_idx(i,j,nmo)];
-//             f2>>read_f_2[two_idx(i,j,nmo)];
-//             d_f[two_idx(i,j,nmo)]=(read_f_2[two_idx(i,j,nmo)]-read_f_1[two_idx(i,j,nmo)])/0.000001;
-        
-//         }
-//     }
-//    f1.close();
-//    f2.close();
-
-
-//     std::vector<double> read_epaa_1(nmo4, 0.0);
-//     std::vector<double> read_epaa_2(nmo4, 0.0);
-//     std::vector<double> read_epbb_1(nmo4, 0.0);
-//     std::vector<double> read_epbb_2(nmo4, 0.0);
-//     std::vector<double> read_epab_1(nmo4, 0.0);
-//     std::vector<double> read_epab_2(nmo4, 0.0);
-//     std::vector<double> d_epaa(nmo4, 0.0);
-//     std::vector<double> d_epbb(nmo4, 0.0);
-//     std::vector<double> d_epab(nmo4, 0.0);
-
-//     std::ifstream epaa1;
-//     std::ifstream epaa2;
-//     std::ifstream epbb1;
-//     std::ifstream epbb2;
-//     std::ifstream epab1;
-//     std::ifstream epab2;
-
-
-//     std::ofstream tst_epp;
-//     tst_epp.open("tst_epp.dat");
-
-
-//     epaa1.open("trial_epaa_1.dat");
-//     epaa2.open("trial_epaa_2.dat");
-//     epbb1.open("trial_epbb_1.dat");
-//     epbb2.open("trial_epbb_2.dat");
-//     epab1.open("trial_epab_1.dat");
-//     epab2.open("trial_epab_2.dat");
-//     for (size_t i = 0; i < doccpi; ++i)
-//     {
-//         for (size_t j = 0; j < doccpi; ++j)
-//         {
-//             for (size_t a = doccpi; a < nmo; ++a)
-//             {
-//                 for (size_t b = doccpi; b < nmo; ++b)
-//                 {
-//                     epaa1>>read_epaa_1[four_idx(i,j,a,b,nmo)];
-//                     epaa2>>read_epaa_2[four_idx(i,j,a,b,nmo)];
-//                     d_epaa[four_idx(i,j,a,b,nmo)]=(read_epaa_2[four_idx(i,j,a,b,nmo)]-read_epaa_1[four_idx(i,j,a,b,nmo)])/0.00000001;
-//                     tst_epp<<read_epaa_1[four_idx(i,j,a,b,nmo)]-read_epaa_2[four_idx(i,j,a,b,nmo)]<<' ';
-
-//                     epbb1>>read_epbb_1[four_idx(i,j,a,b,nmo)];
-//                     epbb2>>read_epbb_2[four_idx(i,j,a,b,nmo)];
-//                     d_epbb[four_idx(i,j,a,b,nmo)]=(read_epbb_2[four_idx(i,j,a,b,nmo)]-read_epbb_1[four_idx(i,j,a,b,nmo)])/0.00000001;
-
-//                     epab1>>read_epab_1[four_idx(i,j,a,b,nmo)];
-//                     epab2>>read_epab_2[four_idx(i,j,a,b,nmo)];
-//                     d_epab[four_idx(i,j,a,b,nmo)]=(read_epab_2[four_idx(i,j,a,b,nmo)]-read_epab_1[four_idx(i,j,a,b,nmo)])/0.00000001;
-        
-//                 }
-//             }
-//         }   
-//     }
-//    epaa1.close();
-//    epaa2.close();
-//    epbb1.close();
-//    epbb2.close();
-//    epab1.close();
-//    epab2.close();
-//    tst_epp.close();
-
-
-//     std::vector<double> read_vaa_1(nmo4, 0.0);
-//     std::vector<double> read_vaa_2(nmo4, 0.0);
-//     std::vector<double> read_vbb_1(nmo4, 0.0);
-//     std::vector<double> read_vbb_2(nmo4, 0.0);
-//     std::vector<double> read_vab_1(nmo4, 0.0);
-//     std::vector<double> read_vab_2(nmo4, 0.0);
-//     std::vector<double> d_vaa(nmo4, 0.0);
-//     std::vector<double> d_vbb(nmo4, 0.0);
-//     std::vector<double> d_vab(nmo4, 0.0);
-
-//     std::ifstream vaa1;
-//     std::ifstream vaa2;
-//     std::ifstream vbb1;
-//     std::ifstream vbb2;
-//     std::ifstream vab1;
-//     std::ifstream vab2;
-//     vaa1.open("trial_vaa_1.dat");
-//     vaa2.open("trial_vaa_2.dat");
-//     vbb1.open("trial_vbb_1.dat");
-//     vbb2.open("trial_vbb_2.dat");
-//     vab1.open("trial_vab_1.dat");
-//     vab2.open("trial_vab_2.dat");
-//     for (size_t p = 0; p < nmo; p++) 
-//     {
-//         for (size_t q = 0; q < nmo; q++) 
-//         {
-//             for (size_t r = 0; r < nmo; r++) 
-//             {
-//                 for (size_t s = 0; s < nmo; s++) 
-//                 {
-//                     vaa1>>read_vaa_1[four_idx(p, q, r, s, nmo)];
-//                     vaa2>>read_vaa_2[four_idx(p, q, r, s, nmo)];
-//                     d_vaa[four_idx(p, q, r, s, nmo)]=(read_vaa_2[four_idx(p, q, r, s, nmo)]-read_vaa_1[four_idx(p, q, r, s, nmo)])/0.00000001;
-
-//                     vbb1>>read_vbb_1[four_idx(p, q, r, s, nmo)];
-//                     vbb2>>read_vbb_2[four_idx(p, q, r, s, nmo)];
-//                     d_vbb[four_idx(p, q, r, s, nmo)]=(read_vbb_2[four_idx(p, q, r, s, nmo)]-read_vbb_1[four_idx(p, q, r, s, nmo)])/0.00000001;
-
-//                     vab1>>read_vab_1[four_idx(p, q, r, s, nmo)];
-//                     vab2>>read_vab_2[four_idx(p, q, r, s, nmo)];
-//                     d_vab[four_idx(p, q, r, s, nmo)]=(read_vab_2[four_idx(p, q, r, s, nmo)]-read_vab_1[four_idx(p, q, r, s, nmo)])/0.00000001;
-        
-//                 }
-//             }
-//         }   
-//     }
-//    vaa1.close();
-//    vaa2.close();
-//    vbb1.close();
-//    vbb2.close();
-//    vab1.close();
-//    vab2.close();
-
-
-
-
-
-
-
-
-
-
-
-// double gd=0.0;
-
-
-
-//   for(int i = frozen_c/2; i < doccpi; ++i)
-//     {
-//         for(int j = frozen_c/2; j < doccpi; ++j)
-//         {
-//             for(int a = doccpi; a < nmo - frozen_v/2; ++a)
-//             {
-//                 for(int b = doccpi; b < nmo - frozen_v/2; ++b)
-//                 {
-//                     gd += S_const*mo_ints_aa[four_idx(i,j,a,b,nmo)]*mo_ints_aa[four_idx(i,j,a,b,nmo)]*pow(e,-2.0*S_const*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)]*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)])*d_epaa[four_idx(i,j,a,b,nmo)];
-//                     gd += S_const*mo_ints_bb[four_idx(i,j,a,b,nmo)]*mo_ints_bb[four_idx(i,j,a,b,nmo)]*pow(e,-2.0*S_const*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)]*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)])*d_epbb[four_idx(i,j,a,b,nmo)];
-//                     gd += 4.0* S_const*mo_ints_ab[four_idx(i,j,a,b,nmo)]*mo_ints_ab[four_idx(i,j,a,b,nmo)]*pow(e,-2.0*S_const*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)]*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)])*d_epab[four_idx(i,j,a,b,nmo)];
-
-//                     gd += 0.5 * d_vaa[four_idx(i,j,a,b,nmo)]*amp_t_dsrg_aa[four_idx(i,j,a,b,nmo)]*(1.0+pow(e,-S_const*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)]*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)]));
-//                     gd += 0.5 * d_vbb[four_idx(i,j,a,b,nmo)]*amp_t_dsrg_bb[four_idx(i,j,a,b,nmo)]*(1.0+pow(e,-S_const*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)]*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)]));
-//                     gd += 2.0 * d_vab[four_idx(i,j,a,b,nmo)]*amp_t_dsrg_ab[four_idx(i,j,a,b,nmo)]*(1.0+pow(e,-S_const*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)]*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)]));
-                
-//                     gd += -0.25 * d_epaa[four_idx(i,j,a,b,nmo)]* amp_t_dsrg_aa[four_idx(i,j,a,b,nmo)]*amp_t_dsrg_aa[four_idx(i,j,a,b,nmo)]*(1.0+pow(e,-S_const*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)]*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)]))/(1.0-pow(e,-S_const*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)]*epsilon_ijab_aa[four_idx(i,j,a,b,nmo)]));
-//                     gd += -0.25 * d_epbb[four_idx(i,j,a,b,nmo)]* amp_t_dsrg_bb[four_idx(i,j,a,b,nmo)]*amp_t_dsrg_bb[four_idx(i,j,a,b,nmo)]*(1.0+pow(e,-S_const*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)]*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)]))/(1.0-pow(e,-S_const*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)]*epsilon_ijab_bb[four_idx(i,j,a,b,nmo)]));
-//                     gd += -1.00 * d_epab[four_idx(i,j,a,b,nmo)]* amp_t_dsrg_ab[four_idx(i,j,a,b,nmo)]*amp_t_dsrg_ab[four_idx(i,j,a,b,nmo)]*(1.0+pow(e,-S_const*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)]*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)]))/(1.0-pow(e,-S_const*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)]*epsilon_ijab_ab[four_idx(i,j,a,b,nmo)]));
-                    
-//                 }
-//             }
-//         }
-//     }
-
-
-
-
-
-// std::cout<<std::endl<<gd<<std::endl<<std::endl;
-
-
-
-
-
-
-
-
-
-
-
 
     /***********************************************************************/
     /*                                                                     */     
@@ -1575,42 +1292,10 @@ for( int times = 0; times < 100; ++times)
     /*                                                                     */ 
     /***********************************************************************/   
 
-    // std::shared_ptr<PSIO> psio (new PSIO());
-    // std::shared_ptr<PSIO> psio= ref_wfn->psio();
-    auto psio = _default_psio_lib_;
-
-
-    psio->open(PSIF_AO_TPDM,PSIO_OPEN_OLD);
-    psio->close(PSIF_AO_TPDM,0);
-    IWL d2aa(psio.get(), PSIF_MO_AA_TPDM, 1.0e-14, 0, 0);
-    IWL d2ab(psio.get(), PSIF_MO_AB_TPDM, 1.0e-14, 0, 0);
-    IWL d2bb(psio.get(), PSIF_MO_BB_TPDM, 1.0e-14, 0, 0);
-
-
-  for(int i = 0; i < doccpi; ++i)
-    {
-        for(int j = 0; j < doccpi; ++j)
-        {  
-            d2aa.write_value(i, i, j, j, 0.0, 0, "NULL", 0);
-            d2bb.write_value(i, i, j, j, 0.0, 0, "NULL", 0); 
-            d2ab.write_value(i, i, j, j, 0.0, 0, "NULL", 0); 
-        }
-    }    
-
-
-
-   
-    d2aa.flush(1);
-    d2bb.flush(1);
-    d2ab.flush(1);
-
-    d2aa.set_keep_flag(1);
-    d2bb.set_keep_flag(1);
-    d2ab.set_keep_flag(1);
-
-    d2aa.close();
-    d2bb.close();
-    d2ab.close();
+    // d2aa / d2ab / d2bb were written next to the amplitudes (Write_DSRG_PT2_TPDM*), in the
+    // orbitals C_density; the back-transformation and the densities below use the same ones
+    C_a->copy(C_density);
+    ref_wfn->Cb()->copy(C_density);
 
 
     /***********************************************************************/
@@ -1621,74 +1306,34 @@ for( int times = 0; times < 100; ++times)
     /*                                                                     */ 
     /***********************************************************************/  
 
-
-
-    //double energy = v2rdm->compute_energy();
-
-    //Process::environment.globals["CURRENT ENERGY"] = energy;
-
-    //if ( options.get_str("DERTYPE") == "FIRST" ) {
-        // backtransform the tpdm
-
-
-
-
-
-        std::vector<std::shared_ptr<MOSpace> > spaces;
-        spaces.push_back(MOSpace::all);
-        std::shared_ptr<TPDMBackTransform> transform = std::shared_ptr<TPDMBackTransform>(
-        new TPDMBackTransform(ref_wfn,
-                        spaces,
-                        IntegralTransform::TransformationType::Unrestricted, // Transformation type
-                        IntegralTransform::OutputType::DPDOnly,              // Output buffer
-                        IntegralTransform::MOOrdering::QTOrder,              // MO ordering
-                        IntegralTransform::FrozenOrbitals::None));           // Frozen orbitals?
-        transform->backtransform_density();
-        transform.reset();
-   
-
-
-
-
-    //}
-
-
-
-
-
-
+    std::vector<std::shared_ptr<MOSpace> > spaces;
+    spaces.push_back(MOSpace::all);
+    std::shared_ptr<TPDMBackTransform> transform = std::shared_ptr<TPDMBackTransform>(
+    new TPDMBackTransform(ref_wfn,
+                    spaces,
+                    IntegralTransform::TransformationType::Unrestricted, // Transformation type
+                    IntegralTransform::OutputType::DPDOnly,              // Output buffer
+                    IntegralTransform::MOOrdering::QTOrder,              // MO ordering
+                    IntegralTransform::FrozenOrbitals::None));           // Frozen orbitals?
+    transform->backtransform_density();
+    transform.reset();
+
+    // reference one-particle and energy-weighted densities only: the relaxed correlation
+    // density and the DSRG-PT2 W are still missing, which is why STAGE GRADIENT is rejected
     ref_wfn->Da()->zero();
     for (int p=0; p < doccpi; ++p)
     {
         ref_wfn->Da()->set(0,p,p,1.0);
     }
-    ref_wfn->Da()->print();
     ref_wfn->Da()->back_transform(C_a);
     ref_wfn->Db()->copy(ref_wfn->Da());
-    ref_wfn->X()->print();
-
 
     ref_wfn->Lagrangian()->copy(F_MO);
-     ref_wfn->Lagrangian()->Matrix::scale(1.0);
     for (int p=doccpi; p < nmo; ++p)
     {
         ref_wfn->Lagrangian()->set(0,p,p,0);
     }
-
-    ref_wfn->Lagrangian()->print();
     ref_wfn->Lagrangian()->back_transform(C_a);
-    ref_wfn->Lagrangian()->print();
-
-   
-
-
-    
-
-
-
-F_MO->print();
-
-
 
     return ref_wfn;
 
@@ -52,14 +52,23 @@ def run_scf_plug(name, **kwargs):
     if ref_wfn is None:
         ref_wfn = psi4.driver.scf_helper(name, **kwargs)
 
+    # Auxiliary basis for the density-fitted (and PNO) DSRG-PT2 energy
+    if psi4.core.get_option('SCF_PLUG', 'DSRG_TYPE') in ['DF', 'PNO']:
+        aux_basis = psi4.core.BasisSet.build(ref_wfn.molecule(), "DF_BASIS_MP2",
+                                             psi4.core.get_option('SCF_PLUG', 'DF_BASIS_MP2'),
+                                             "RIFIT", psi4.core.get_global_option('BASIS'))
+        ref_wfn.set_basisset("DF_BASIS_MP2", aux_basis)
+
 
     # Ensure IWL files have been written when not using DF/CD
     # proc_util.check_iwl_file_from_scf_type(psi4.core.get_option('SCF', 'SCF_TYPE'), ref_wfn)
 
-    # analytic derivatives do not work with scf_type df/cd
-    scf_type = psi4.core.get_option('SCF', 'SCF_TYPE')
-    if ( scf_type == 'CD' or scf_type == 'DF' ):
-        raise ValidationError("""Error: analytic gradients not implemented for scf_type %s.""" % scf_type)
+    # the plugin has no DSRG-PT2 gradient yet (relaxed and energy-weighted densities are missing)
+    stage = psi4.core.get_option('SCF_PLUG', 'STAGE')
+    if stage == 'AUTO':
+        stage = 'GRADIENT' if psi4.core.get_option('SCF_PLUG', 'GRADIENT') else 'ENERGY'
+    if stage == 'GRADIENT':
+        raise ValidationError("""Error: analytic DSRG-PT2 gradients are not implemented, use STAGE DENSITY.""")
 
     # Call the Psi4 plugin
     # Please note that setting the reference wavefunction in this way is ONLY for plugins
@@ -68,18 +77,6 @@ def run_scf_plug(name, **kwargs):
     print(scf_plug_wfn)
     print(ref_wfn)
 
-    derivobj = psi4.core.Deriv(scf_plug_wfn)
-    derivobj.set_deriv_density_backtransformed(True)
-    derivobj.set_ignore_reference(True)
-    grad = derivobj.compute()
-
-
-   
-
-   
-
-    scf_plug_wfn.set_gradient(grad)
-
     return scf_plug_wfn
 
 
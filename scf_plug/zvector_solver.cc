@@ -0,0 +1,240 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#include "psi4/libmints/matrix.h"
+#include "psi4/libqt/qt.h"
+#include "zvector_solver.h"
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+namespace psi{ namespace scf_plug {
+
+double ZVector_DIIS::update(SharedMatrix Z, SharedMatrix Z_new)
+{
+    size_t n = (size_t)Z->rowdim() * Z->coldim();
+    double* z = Z->pointer()[0];
+    double* z_new = Z_new->pointer()[0];
+
+    std::vector<double> err(n);
+    double max_err = 0.0;
+    for(size_t k = 0; k < n; ++k)
+    {
+        err[k] = z_new[k] - z[k];
+        max_err = std::max(max_err, fabs(err[k]));
+    }
+
+    if(max_vecs_ < 2)
+    {
+        Z->copy(Z_new);
+        return max_err;
+    }
+
+    if((int)z_.size() == max_vecs_)
+    {
+        z_.erase(z_.begin());
+        err_.erase(err_.begin());
+    }
+    z_.push_back(std::vector<double>(z_new, z_new + n));
+    err_.push_back(err);
+
+    // [B 1; 1 0] [c; lambda] = [0; 1], B scaled by its largest diagonal element
+    int m = z_.size();
+    std::vector<double> B((m + 1) * (m + 1), 0.0), c(m + 1, 0.0);
+    double scale = 0.0;
+    for(int i = 0; i < m; ++i)
+    {
+        for(int j = 0; j <= i; ++j)
+        {
+            double dot = 0.0;
+            for(size_t k = 0; k < n; ++k)
+            {
+                dot += err_[i][k] * err_[j][k];
+            }
+            B[i * (m + 1) + j] = B[j * (m + 1) + i] = dot;
+        }
+        scale = std::max(scale, B[i * (m + 1) + i]);
+    }
+    if(scale == 0.0)
+    {
+        Z->copy(Z_new);
+        return max_err;
+    }
+    for(int i = 0; i < m; ++i)
+    {
+        for(int j = 0; j < m; ++j)
+        {
+            B[i * (m + 1) + j] /= scale;
+        }
+        B[i * (m + 1) + m] = B[m * (m + 1) + i] = 1.0;
+    }
+    c[m] = 1.0;
+
+    std::vector<int> ipiv(m + 1);
+    if(C_DGESV(m + 1, 1, B.data(), m + 1, ipiv.data(), c.data(), m + 1) != 0)
+    {
+        // linearly dependent history: restart from the plain Jacobi step
+        z_.erase(z_.begin(), z_.end() - 1);
+        err_.erase(err_.begin(), err_.end() - 1);
+        Z->copy(Z_new);
+        return max_err;
+    }
+
+    Z->zero();
+    for(int i = 0; i < m; ++i)
+    {
+        for(size_t k = 0; k < n; ++k)
+        {
+            z[k] += c[i] * z_[i][k];
+        }
+    }
+    return max_err;
+}
+
+constexpr double Divided_Difference::near_gap;
+
+Divided_Difference::Divided_Difference(const std::vector<double>& epsilon, int p0, int p1)
+    : n_(p1 > p0 ? p1 - p0 : 0), eps_(epsilon.begin() + p0, epsilon.begin() + p0 + n_), W_(n_ * n_, 0.0)
+{
+    for(size_t p = 0; p < n_; ++p)
+    {
+        for(size_t q = 0; q < n_; ++q)
+        {
+            if(p == q) continue;
+            if(fabs(gap(p, q)) > near_gap)
+            {
+                W_[p * n_ + q] = 1.0 / gap(p, q);
+            }
+            else
+            {
+                near_.push_back(p * n_ + q);
+            }
+        }
+    }
+}
+
+void Divided_Difference::combine(const std::vector<double>& M, const std::vector<double>& N, std::vector<double>& R) const
+{
+    R.assign(n_ * n_, 0.0);
+    for(size_t p = 0; p < n_; ++p)
+    {
+        for(size_t q = 0; q < n_; ++q)
+        {
+            size_t pq = p * n_ + q;
+            R[q * n_ + p] = (M[pq] - M[q * n_ + p]) * W_[pq];
+        }
+    }
+    for(size_t pq : near_)
+    {
+        R[(pq % n_) * n_ + pq / n_] = N[pq];
+    }
+}
+
+void Hessian_JK(const AO_ERI_Store& eri, SharedMatrix C, const std::vector<SharedMatrix>& Z, std::vector<SharedMatrix>& J, std::vector<SharedMatrix>& K)
+{
+    int nrhs = Z.size();
+    int nbf = eri.nbf();
+    size_t nbf2 = (size_t)nbf * nbf;
+    J.assign(nrhs, SharedMatrix());
+    K.assign(nrhs, SharedMatrix());
+    if(nrhs == 0) return;
+
+    // Ps(k, ls) = P_k(l, s) and the AO results, row m of right-hand side k at (m * nrhs + k) * nbf
+    std::vector<double> Ps(nrhs * nbf2), Js(nrhs * nbf2), Ks(nrhs * nbf2);
+    for(int k = 0; k < nrhs; ++k)
+    {
+        SharedMatrix P = Matrix::triplet(C, Z[k], C, false, false, true);
+        std::copy(P->pointer()[0], P->pointer()[0] + nbf2, &Ps[k * nbf2]);
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for(int m = 0; m < nbf; ++m)
+    {
+        // A(n, ls) = (mn|ls): rows m * nbf .. m * nbf + nbf - 1 are contiguous
+        const double* A = eri.row((size_t)m * nbf);
+        double* Jm = &Js[(size_t)m * nrhs * nbf];
+        double* Km = &Ks[(size_t)m * nrhs * nbf];
+
+        // J(m, n) = sum_ls (mn|ls) P(l, s)
+        C_DGEMM('N', 'T', nrhs, nbf, nbf2, 1.0, Ps.data(), nbf2, const_cast<double*>(A), nbf2, 0.0, Jm, nbf);
+
+        // K(m, n) = sum_l sum_s (ml|ns) P(l, s), the (ml|..) block read as (n, s)
+        std::fill(Km, Km + nrhs * nbf, 0.0);
+        for(int l = 0; l < nbf; ++l)
+        {
+            C_DGEMM('N', 'T', nrhs, nbf, nbf, 1.0, &Ps[(size_t)l * nbf], nbf2, const_cast<double*>(A + l * nbf2), nbf, 1.0, Km, nbf);
+        }
+    }
+
+    for(int k = 0; k < nrhs; ++k)
+    {
+        SharedMatrix J_ao (new Matrix("AO Coulomb", nbf, nbf));
+        SharedMatrix K_ao (new Matrix("AO exchange", nbf, nbf));
+        for(int m = 0; m < nbf; ++m)
+        {
+            std::copy(&Js[((size_t)m * nrhs + k) * nbf], &Js[((size_t)m * nrhs + k + 1) * nbf], J_ao->pointer()[m]);
+            std::copy(&Ks[((size_t)m * nrhs + k) * nbf], &Ks[((size_t)m * nrhs + k + 1) * nbf], K_ao->pointer()[m]);
+        }
+        J[k] = Matrix::triplet(C, J_ao, C, true, false, false);
+        K[k] = Matrix::triplet(C, K_ao, C, true, false, false);
+    }
+}
+
+void Apply_ZVector_Guess(SharedMatrix Z, SharedMatrix guess, int nocc)
+{
+    int n = Z->rowdim();
+    for(int p = 0; p < n; ++p)
+    {
+        for(int q = 0; q < n; ++q)
+        {
+            if((p < nocc) != (q < nocc))
+            {
+                Z->set(0, p, q, guess->get(0, p, q));
+            }
+        }
+    }
+}
+
+void Print_ZVector_Convergence(int iter, double max_change, const ZVector_Settings& zvec)
+{
+    std::streamsize precision = std::cout.precision();
+    if(iter <= zvec.maxiter)
+    {
+        std::cout << "Z-vector Converged:           " << iter << " iterations, max change " << std::setprecision(3) << max_change << std::endl;
+    }
+    else
+    {
+        std::cout << "Z-vector NOT Converged:       " << zvec.maxiter << " iterations, max change " << std::setprecision(3) << max_change << std::endl;
+    }
+    std::cout.precision(precision);
+}
+
+}} // End namespaces
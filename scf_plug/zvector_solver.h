@@ -0,0 +1,204 @@
+/*
+ * @BEGIN LICENSE
+ *
+ * scf_plug by Psi4 Developer, a plugin to:
+ *
+ * Psi4: an open-source quantum chemistry software package
+ *
+ * Copyright (c) 2007-2017 The Psi4 Developers.
+ *
+ * The copyrights for code used from other parties are included in
+ * the corresponding files.
+ *
+ * This file is part of Psi4.
+ *
+ * Psi4 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * Psi4 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * @END LICENSE
+ */
+
+#ifndef ZVECTOR_SOLVER_H
+#define ZVECTOR_SOLVER_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <psi4/libmints/typedefs.h>
+#include "psi4/libmints/matrix.h"
+#include "psi4/libqt/qt.h"
+#include "eri_store.h"
+
+namespace psi{ namespace scf_plug {
+
+// convergence control for the Z-vector (orbital response) iterations
+struct ZVector_Settings
+{
+    int maxiter = 100;             // Z_MAXITER
+    double convergence = 1.0e-10;  // Z_CONVERGENCE, on max |Z_new - Z|
+    int diis_max_vecs = 8;         // Z_DIIS_MAX_VECS, 0 gives plain Jacobi
+};
+
+// periodic save of the iterates of a solve, for restarts
+struct ZVector_Checkpoint
+{
+    int interval = 0;   // Z_CHECKPOINT_INTERVAL, every interval iterations (0: only at the end)
+    std::function<void(int iter, const std::vector<SharedMatrix>& Z, bool converged)> save;   // empty for none
+};
+
+/*
+ * DIIS-accelerated Jacobi iterations for the Z-vector equations.
+ *
+ * A Jacobi sweep divides the orbital gradient by the orbital-energy difference,
+ * which is the diagonal preconditioner of the response equations.  The change
+ * Z_new - Z of that sweep is the DIIS error vector; the next iterate is the
+ * DIIS extrapolation of the last diis_max_vecs sweeps.
+ */
+class ZVector_DIIS
+{
+public:
+    ZVector_DIIS(int max_vecs) : max_vecs_(max_vecs) {}
+
+    // Z_new is the Jacobi sweep from Z; Z is replaced by the next iterate and
+    // max |Z_new - Z| is returned
+    double update(SharedMatrix Z, SharedMatrix Z_new);
+
+private:
+    int max_vecs_;
+    std::vector<std::vector<double>> z_;
+    std::vector<std::vector<double>> err_;
+};
+
+/*
+ * Coulomb and exchange parts of the orbital-Hessian product, built through the
+ * AO integrals.  For each MO-basis Z[k], with P = C Z[k] C^T,
+ *
+ *     J[k] = C^T J(P) C,    J(P)(m, n) = sum_ls (mn|ls) P(l, s)
+ *     K[k] = C^T K(P) C,    K(P)(m, n) = sum_ls (ml|ns) P(l, s)
+ *
+ * that is J[k](X, Y) = sum_pq (XY|pq) Z(p, q) and K[k](X, Y) = sum_pq (Xp|Yq) Z(p, q).
+ * Every block of (m.|..) integrals is read once and applied to all right-hand
+ * sides with DGEMMs, so a pass costs nbf^4 per right-hand side and never touches
+ * the MO integrals.
+ */
+void Hessian_JK(const AO_ERI_Store& eri, SharedMatrix C, const std::vector<SharedMatrix>& Z, std::vector<SharedMatrix>& J, std::vector<SharedMatrix>& K);
+
+/*
+ * Block solve of nrhs Z-vector equations that share one orbital Hessian, each
+ * right-hand side with its own DIIS history.  Per pass
+ *
+ *     hessian(active, F)        F[k] = Hessian x Z[k] for every k in active, in one batched product
+ *     sweep(k, F[k], Z_new)     Jacobi step of right-hand side k into Z_new
+ *
+ * and right-hand sides drop out of the batch once max |Z_new - Z| < convergence.
+ * Z[k] holds the starting guess (with its fixed oo / vv blocks) and the solution.
+ * Returns the iteration count (> maxiter if not all converged); max_change is
+ * the largest change of the last pass.  checkpoint.save, if set, receives the
+ * iterates every checkpoint.interval iterations and once at the end.
+ */
+template <class Hessian, class Sweep>
+int Solve_ZVector_Block(const std::vector<SharedMatrix>& Z, Hessian hessian, Sweep sweep, const ZVector_Settings& zvec, double& max_change, const ZVector_Checkpoint& checkpoint = ZVector_Checkpoint())
+{
+    size_t nrhs = Z.size();
+    std::vector<ZVector_DIIS> diis(nrhs, ZVector_DIIS(zvec.diis_max_vecs));
+    std::vector<SharedMatrix> F(nrhs), Z_new(nrhs);
+    std::vector<char> converged(nrhs, 0);
+    for(size_t k = 0; k < nrhs; ++k)
+    {
+        F[k] = Z[k]->clone();
+        Z_new[k] = Z[k]->clone();
+    }
+
+    int iter;
+    max_change = 0.0;
+    for(iter = 1; iter <= zvec.maxiter; ++iter)
+    {
+        std::vector<size_t> active;
+        for(size_t k = 0; k < nrhs; ++k)
+        {
+            if(!converged[k]) active.push_back(k);
+        }
+        if(active.empty()) break;
+
+        hessian(active, F);
+
+        max_change = 0.0;
+        for(size_t k : active)
+        {
+            sweep(k, F[k], Z_new[k]);
+            double change = diis[k].update(Z[k], Z_new[k]);
+            converged[k] = change < zvec.convergence;
+            max_change = std::max(max_change, change);
+        }
+        if(std::find(converged.begin(), converged.end(), 0) == converged.end()) break;
+        if(checkpoint.save && checkpoint.interval > 0 && iter % checkpoint.interval == 0)
+        {
+            checkpoint.save(iter, Z, false);
+        }
+    }
+    if(checkpoint.save)
+    {
+        checkpoint.save(std::min(iter, zvec.maxiter), Z, iter <= zvec.maxiter);
+    }
+    return iter;
+}
+
+/*
+ * Restart guess: copy into Z the blocks of guess the Jacobi sweeps solve for,
+ * those with one index below nocc and one above; the fixed oo / vv blocks of Z
+ * are kept.  Any guess is admissible, it only changes the iteration count.
+ */
+void Apply_ZVector_Guess(SharedMatrix Z, SharedMatrix guess, int nocc);
+
+/*
+ * Divided differences of an orbital range [p0, p1) for the off-diagonal oo / vv
+ * relaxed-density blocks.  With the packed product M(p, q) = sum_K X(K, p) Y(K, q)
+ * accumulated by DGEMM,
+ *
+ *     Z(q, p) = (M(p, q) - M(q, p)) / (e_q - e_p)
+ *
+ * for the pairs further apart than near_gap; W(p, q) = 1 / (e_q - e_p) is
+ * precomputed.  The near pairs, degenerate ones included, would lose digits to
+ * the cancellation in M(p, q) - M(q, p); the caller sums them directly into
+ * N(p, q) with DSRG_Divided_Differences instead.  At near_gap both routes are
+ * accurate to ~1e-13 relative, so there is no step at the switch.
+ */
+class Divided_Difference
+{
+public:
+    static constexpr double near_gap = 1.0e-3;
+
+    Divided_Difference(const std::vector<double>& epsilon, int p0, int p1);
+
+    // near pairs p != q, packed as p * n + q
+    const std::vector<size_t>& near_pairs() const { return near_; }
+
+    // e_q - e_p
+    double gap(size_t p, size_t q) const { return eps_[q] - eps_[p]; }
+
+    // R(q, p) = Z(q, p), n x n row-major, from M and from N for the near pairs
+    void combine(const std::vector<double>& M, const std::vector<double>& N, std::vector<double>& R) const;
+
+private:
+    size_t n_;
+    std::vector<double> eps_;
+    std::vector<double> W_;
+    std::vector<size_t> near_;
+};
+
+// report the iteration count, iter > maxiter meaning not converged
+void Print_ZVector_Convergence(int iter, double max_change, const ZVector_Settings& zvec);
+
+}} // End namespaces
+
+#endif